@@ -5,18 +5,77 @@
 #include "file.h"
 
 #include <unordered_map>
+#include <algorithm>
+#include <vector>
 #include <pthread.h>
+#include <atomic>
+#include <deque>
+#include <list>
+#include <map>
+#include <string>
 #include <iostream>
 
+#define DEFAULT_BUFFER_PARTITIONS 16    // upper bound of partition count
+#define MIN_FRAMES_PER_PARTITION 16     // keep enough frames to pin a split path
+
+/* Frame arena */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)    // arena granularity when backed by huge pages
+
+/* Page cleaner */
+#define CLEANER_CLEAN_PERCENT 25        // share of each partition's eviction end kept clean
+#define CLEANER_BATCH_SIZE 32           // max dirty frames written per partition per round
+#define CLEANER_INTERVAL_MS 20          // sleep between rounds unless woken by eviction
+#define CLEANER_SYNC_ROUNDS 50          // table files are synced every this many rounds
+
+/* Read-ahead */
+#define PREFETCH_MIN_PAGES 2            // read-ahead window once a scan turns sequential
+#define PREFETCH_MAX_PAGES 64           // read-ahead window upper bound
+
+/* Buffer replacement policies */
+#define BUFFER_POLICY_LRU 0     // move-to-head LRU list
+#define BUFFER_POLICY_CLOCK 1   // reference bit + clock sweep at eviction
+#define BUFFER_POLICY_2Q 2      // probationary FIFO + main LRU, scan resistant
+
+/* 2Q queue sizes */
+#define PROBATION_PERCENT 25    // share of frames in the probationary queue
+#define GHOST_PERCENT 50        // pages remembered after leaving probation
+#define CORRELATED_REFERENCE_GAP 4  // same thread re-reference within this many accesses is correlated
+
+/* Statistics */
+#define PAGE_TYPE_HEADER 0
+#define PAGE_TYPE_INTERNAL 1
+#define PAGE_TYPE_LEAF 2
+#define NUM_PAGE_TYPES 3
+#define LATCH_WAIT_BUCKETS 20   // bucket 0: no wait, bucket i: [2^(i-1), 2^i) us, last one open ended
+
+/* Page latch modes */
+#define PAGE_LATCH_SHARED 0     // read-only access (find, scan)
+#define PAGE_LATCH_EXCLUSIVE 1  // page modification (insert, update, delete)
+
+/* recLSN of a frame with no logged change since its last write back */
+#define NO_REC_LSN UINT64_MAX
+
 extern pthread_mutex_t buffer_manager_latch;
 
+/* Frame metadata, the page bytes live in the pool arena */
 struct buffer_t {
-    char frame[PAGE_SIZE];
+    char* frame;
     int64_t table_id;
     pagenum_t pagenum;
     bool is_dirty;
+    bool ref_bit;
+    bool in_probation;      // 2Q: frame is in the probationary queue
+    const void* last_accessor;  // thread of last reference
+    uint64_t last_access;       // access sequence of that thread
+    bool is_prefetched;     // read ahead and not referenced yet
+    int page_type;          // PAGE_TYPE_*, refreshed on load and write back
+    uint64_t rec_LSN;       // end of log when buffer_write_page first dirtied the frame
 
-    pthread_mutex_t page_latch;
+    // frame can't be evicted while pinned.
+    // pinned only under partition latch, unpinned after page latch is released.
+    std::atomic<int> pin_count;
+    std::atomic<bool> drop_pending;     // dropped while pinned, the last unpin unmaps it
+    pthread_rwlock_t page_latch;
 
     struct buffer_t* next;
     struct buffer_t* prev;
@@ -24,14 +83,71 @@ struct buffer_t {
     buffer_t();
 };
 
-class BufferManager {
+/* Dirty page table entry of a checkpoint */
+struct dirty_page_t {
+    int64_t table_id;
+    pagenum_t pagenum;
+    uint64_t rec_LSN;       // redo of the page starts here
+};
+
+/* Counters of one table, by page type */
+struct buffer_table_stats_t {
+    uint64_t hits[NUM_PAGE_TYPES];
+    uint64_t misses[NUM_PAGE_TYPES];
+    uint64_t evictions[NUM_PAGE_TYPES];
+    uint64_t write_backs[NUM_PAGE_TYPES];
+
+    buffer_table_stats_t();
+    void add(const buffer_table_stats_t& other);
+};
+
+/* Snapshot of buffer pool statistics */
+struct buffer_stats_t {
+    int frame_count;
+    int partition_count;
+    std::map<int64_t, buffer_table_stats_t> tables;
+    uint64_t prefetch_issued;
+    uint64_t prefetch_hits;
+    uint64_t page_latch_waits[LATCH_WAIT_BUCKETS];
+    uint64_t partition_latch_waits[LATCH_WAIT_BUCKETS];
+
+    buffer_stats_t();
+    /* sum over tables and page types */
+    buffer_table_stats_t total() const;
+    /* hits / (hits + misses), 0 if nothing was read */
+    double hit_rate() const;
+    /* share of read-ahead pages referenced before eviction */
+    double prefetch_hit_rate() const;
+    /* human readable report */
+    void print(std::ostream& os) const;
+};
+
+/* One slice of the buffer pool.
+ * Each partition owns its frames, hash table and LRU list,
+ * guarded by its own latch.
+ */
+class BufferPartition {
     /* field */
-    buffer_t* buf_head;
+    buffer_t* buf_head;     // LRU list (main queue of 2Q)
     buffer_t* buf_tail;
+    buffer_t* a1_head;      // 2Q probationary FIFO
+    buffer_t* a1_tail;
+    int a1_count;
+    std::list<int64_t> a1_ghosts;   // 2Q keys of pages recently evicted from probation
+    std::unordered_map<int64_t, std::list<int64_t>::iterator> a1_ghost_index;
+    buffer_t* frame_meta;   // metadata of all frames, apart from the page bytes
     std::vector<buffer_t*> buf_pool;
     std::unordered_map<int64_t, buffer_t*> hash_pointer;
     int max_count;
     int cur_count;
+    int policy;
+    int clock_hand;
+    int prefetch_pinned;
+
+    // statistics, guarded by partition latch like everything else here
+    std::unordered_map<int64_t, buffer_table_stats_t> table_stats;
+    uint64_t prefetch_issued;
+    uint64_t prefetch_hits;
 
     private:
         /* set buffer initial value */
@@ -40,36 +156,203 @@ class BufferManager {
         void move_to_head(buffer_t* buf);
         /* insert into head */
         void insert_into_head(buffer_t* buf);
+        /* unlink buffer from its list */
+        void unlink(buffer_t* buf);
+        /* link buffer right after (head) */
+        void link_after(buffer_t* head, buffer_t* buf);
+        /* find unpinned clean frame from (tail), remember first dirty one */
+        buffer_t* find_list_victim(buffer_t* head, buffer_t* tail, buffer_t** dirty_victim);
+        /* find victim buffer (by LRU / 2Q policy) */
+        buffer_t* find_victim();
+        /* find victim buffer (by CLOCK policy) */
+        buffer_t* find_clock_victim();
+        /* find clean victim in the cleaned window, nullptr if none */
+        buffer_t* find_clean_victim();
+        buffer_t* find_clean_in_list(buffer_t* head, buffer_t* tail);
+        /* pin dirty frames near (tail) for the page cleaner */
+        void collect_dirty_in_list(buffer_t* head, buffer_t* tail, std::vector<buffer_t*>& batch);
+        /* 2Q: check re-reference belongs to the same operation */
+        bool is_correlated(buffer_t* buf);
+        void stamp_access(buffer_t* buf);
+        /* 2Q: max frames in probationary queue */
+        int a1_max_count();
+        /* 2Q: ghost entries of pages evicted from probation */
+        void remember_ghost(int64_t key);
+        bool forget_ghost(int64_t key);
+        /* number of frames at eviction end that the cleaner keeps clean */
+        int clean_window();
+        /* take a never used frame */
+        buffer_t* take_unused_frame();
+        /* unmap victim frame */
+        void recycle_frame(buffer_t* buf);
+        /* map and pin frame to (table_id, pagenum) */
+        void map_frame(buffer_t* buf, int64_t table_id, pagenum_t pagenum);
+        /* counters of (table_id) */
+        buffer_table_stats_t& stats_of(int64_t table_id);
+
+    public:
+        pthread_mutex_t partition_latch;
+
+        /* constructor, (frames) is the partition's slice of the arena */
+        BufferPartition(int max_count, int policy, char* frames);
         /* convert pair to key */
-        int64_t convert_pair_to_key(int64_t table_id, pagenum_t pagenum);
-        /* flush buffer */
-        void flush_buffer(buffer_t* buf);
-        /* flush (pagenum) page buffer */
-        void flush_buffer(int64_t table_id, pagenum_t pagenum);
+        static int64_t convert_pair_to_key(int64_t table_id, pagenum_t pagenum);
+        /* tell page type from frame contents, caller holds the page latch */
+        static int classify_page(buffer_t* buf);
         /* check (pagenum) page buffer exist */
         bool is_buffer_exist(int64_t table_id, pagenum_t pagenum);
         /* find buffer (pagenum) page buffer location */
         buffer_t* find_buffer(int64_t table_id, pagenum_t pagenum);
-        /* find victim buffer (by LRU policy) */
-        buffer_t* find_victim();
+        /* count hit, pin and move buffer to head */
+        void touch_buffer(buffer_t* buf);
+        /* map a free or clean victim frame to a missing page, returned pinned and latched
+         * exclusive for the read. nullptr and (dirty_victim) set if the victim must be written back first
+         */
+        buffer_t* begin_load(int64_t table_id, pagenum_t pagenum, buffer_t** dirty_victim);
+        /* count the miss once the page is read */
+        void end_load(buffer_t* buf);
+        /* map a clean frame for read-ahead without reading, nullptr if none to spare */
+        buffer_t* reserve_prefetch_frame(int64_t table_id, pagenum_t pagenum);
+        /* unpin read-ahead frame */
+        void end_prefetch(buffer_t* buf);
+        /* pin dirty frames near the eviction end for the page cleaner */
+        void collect_dirty(std::vector<buffer_t*>& batch);
+        /* drop (pagenum) page buffer from hash without write back, once it's unpinned */
+        void drop_buffer(int64_t table_id, pagenum_t pagenum);
+        /* unmap a frame with a pending drop if nobody pins it anymore */
+        void finish_drop(buffer_t* buf);
+        /* drop buffers of pages (from) and after of a table without write back */
+        void drop_table_tail(int64_t table_id, pagenum_t from);
+        /* collect all dirty frames for a batched flush */
+        void collect_all_dirty(std::vector<buffer_t*>& frames);
+        /* collect dirty frames with logged changes and their recLSN */
+        void collect_dirty_pages(std::vector<dirty_page_t>& pages);
+        /* pin dirty unpinned frames with recLSN before 'LSN' */
+        void collect_dirty_before(uint64_t LSN, std::vector<buffer_t*>& batch);
+        /* pin dirty unpinned frames of a table */
+        void collect_table_dirty(int64_t table_id, std::vector<buffer_t*>& batch);
+        /* count write back of a latched frame */
+        void count_write_back(buffer_t* buf);
+        /* add counters of this partition to (stats) */
+        void merge_stats(buffer_stats_t& stats);
+        void reset_stats();
+        /* Destructor */
+        ~BufferPartition();
+};
+
+class BufferManager {
+    /* field */
+    std::vector<BufferPartition*> partitions;
+    int max_count;
+
+    // page bytes of every frame, one page aligned allocation
+    char* arena;
+    size_t arena_size;
+    bool use_huge_pages;
+    bool arena_huge;        // arena is actually backed by huge pages
+
+    pthread_t cleaner_thread;
+    bool cleaner_running;
+    pthread_mutex_t cleaner_latch;
+    pthread_cond_t cleaner_cond;
+
+    pthread_t prefetcher_thread;
+    bool prefetcher_running;
+    pthread_mutex_t prefetch_latch;
+    pthread_cond_t prefetch_cond;
+    std::deque<std::pair<int64_t, pagenum_t>> prefetch_queue;
+
+    std::atomic<uint64_t> page_latch_waits[LATCH_WAIT_BUCKETS];
+    std::atomic<uint64_t> partition_latch_waits[LATCH_WAIT_BUCKETS];
+    pthread_mutex_t stats_dump_latch;
+    int stats_dump_interval_ms;     // 0: no periodic dump
+    std::string stats_dump_path;    // empty: stdout
+    timespec last_stats_dump;
+
+    private:
+        /* pick partition of (table_id, pagenum) page */
+        BufferPartition* get_partition(int64_t table_id, pagenum_t pagenum);
+        /* take latches, recording how long we waited */
+        void lock_partition(BufferPartition* part);
+        void lock_page(buffer_t* buf, int latch_mode);
+        static void record_wait(std::atomic<uint64_t>* histogram, const timespec& start);
+        /* take a page from the free space map, nearest after (hint) first. 0 if none is free */
+        pagenum_t take_free_page(int64_t table_id, page_t* header_page, pagenum_t hint);
+        /* dump statistics if the dump interval has passed (page cleaner) */
+        void dump_stats_if_due();
+        /* map / unmap frame arena */
+        bool alloc_arena(size_t frame_count);
+        void free_arena();
+        /* page cleaner thread body */
+        static void* cleaner_main(void* arg);
+        /* write back one batch of dirty frames from every partition */
+        void clean_partitions();
+        /* flush the log, from a thread that may already hold the log latch */
+        void force_log();
+        /* write back a pinned dirty victim for a miss, false if a writer latched it meanwhile */
+        bool write_back_victim(BufferPartition* part, buffer_t* buf);
+        /* write back a latched frame of (part) if it is dirty, the log is forced already */
+        void write_back_frame(BufferPartition* part, buffer_t* buf);
+        /* unpin a frame of (part), finishing a drop that waited for it */
+        void release_pin(BufferPartition* part, buffer_t* buf);
+        /* write back pinned frames in (table_id, pagenum) order */
+        void write_batch(std::vector<buffer_t*>& batch);
+        /* write frames with one batched submission and mark them clean */
+        void write_frames(std::vector<buffer_t*>& frames);
+        /* start / stop page cleaner */
+        void start_cleaner();
+        void stop_cleaner();
+        /* read-ahead thread body */
+        static void* prefetcher_main(void* arg);
+        /* read missing pages into the pool with one batched read */
+        void prefetch_pages(std::vector<std::pair<int64_t, pagenum_t>>& pages);
+        /* start / stop read-ahead thread */
+        void start_prefetcher();
+        void stop_prefetcher();
 
     public:
         /* constructor */
         BufferManager();
-        /* set max buffer count */
-        void init_buf(int max_count);
+        /* set max buffer count, returns non-zero if the arena can't be allocated */
+        int init_buf(int max_count, int policy = BUFFER_POLICY_LRU, int num_partitions = 0);
+        /* back the arena of next init_buf with 2 MiB huge pages if the system has them */
+        void set_huge_pages(bool enable);
+        /* check arena got huge pages */
+        bool is_arena_huge();
+        /* wake page cleaner up before its interval ends */
+        void wake_cleaner();
+        /* read pages into the pool in background */
+        void buffer_prefetch(int64_t table_id, const std::vector<pagenum_t>& pagenums);
+        /* snapshot of statistics since init_buf or the last reset */
+        buffer_stats_t get_stats();
+        void reset_stats();
+        /* print statistics to (path) every (interval_ms), 0 turns it off. empty path is stdout */
+        void set_stats_dump(int interval_ms, const std::string& path = "");
+        void dump_stats();
         /* unpin buffer */
         void unpin_buffer(int64_t table_id, pagenum_t pagenum);
-        /* open table */
-        int64_t buffer_open_table_file(const char* pathname);
-        /* allocate page */
-        pagenum_t buffer_alloc_page(int64_t table_id);
-        /* read page through buffer */
-        buffer_t* buffer_read_page(int64_t table_id, pagenum_t pagenum);
-        /* write page on buffer block */
-        void buffer_write_page(int64_t table_id, pagenum_t pagenum); 
+        /* open table (TABLE_OPEN_BUFFERED / TABLE_OPEN_DIRECT) */
+        int64_t buffer_open_table_file(const char* pathname, int open_mode = TABLE_OPEN_BUFFERED);
+        /* allocate page, the free one nearest after (hint) first */
+        pagenum_t buffer_alloc_page(int64_t table_id, pagenum_t hint = 0);
+        /* read page through buffer, returns it pinned and latched in 'latch_mode' */
+        buffer_t* buffer_read_page(int64_t table_id, pagenum_t pagenum, int latch_mode = PAGE_LATCH_EXCLUSIVE);
+        /* write page on buffer block, call it before logging the change.
+         * (rec_LSN) is the LSN of a change logged already (redo), default is the end of log
+         */
+        void buffer_write_page(int64_t table_id, pagenum_t pagenum, uint64_t rec_LSN = NO_REC_LSN);
+        /* dirty page table for a fuzzy checkpoint */
+        void get_dirty_pages(std::vector<dirty_page_t>& pages);
+        /* write back pages dirty since before 'LSN', so they stop holding log segments */
+        void write_back_before(uint64_t LSN);
+        /* write back every dirty page of a table and sync it, its log records first */
+        void buffer_flush_table(int64_t table_id);
+        /* write back (pagenums) of a table and sync it, their log records first */
+        void buffer_flush_pages(int64_t table_id, const std::vector<pagenum_t>& pagenums);
         /* free page */
         void buffer_free_page(int64_t table_id, pagenum_t pagenum);
+        /* cut unused pages off the end of table file, returns its new page count */
+        pagenum_t buffer_truncate_table(int64_t table_id);
         /* close table */
         void buffer_close_table_file();
         /* flush all buffer blocks and de-allocate buffer blocks */
@@ -80,4 +363,4 @@ class BufferManager {
 
 extern BufferManager buffer_manager;
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,109 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "page.h"
+
+#include <pthread.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/* Leaf page compression of cold tables.
+ * Compressed leaves are extents of 512 byte sectors in a companion file
+ * <table path>.lz, their slot in the table file is punched out. Every extent
+ * starts with its page number and a generation, so the page map is rebuilt
+ * by one scan of the companion file when the table is opened.
+ */
+#define COMPRESSION_NONE 0
+#define COMPRESSION_LZ 1                    // built-in LZ77 codec, LZ4 style token stream
+
+#define COMPRESSED_FILE_SUFFIX ".lz"
+#define EXTENT_SECTOR_SIZE 512
+#define EXTENT_MAGIC 0x5a4c5047             // "GPLZ"
+#define EXTENT_HEADER_SIZE 32               // magic, length, page number, generation, checksum
+#define EXTENT_GROWTH_SECTORS 2048          // companion file grows 1 MiB at a time
+#define EXTENT_SCAN_SECTORS 2048            // sectors read per step of the open scan
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+namespace lz {
+    // compress (src_len) bytes into (dest), 0 if the result does not fit in (dest_cap)
+    int compress(const char* src, int src_len, char* dest, int dest_cap);
+    // decompress into exactly (dest_len) bytes, false on corrupt input
+    bool decompress(const char* src, int src_len, char* dest, int dest_len);
+}
+
+/* Compression counters of one table */
+struct compression_stats_t {
+    uint64_t pages_written;     // leaf write backs stored compressed
+    uint64_t raw_bytes;         // their size as pages
+    uint64_t stored_bytes;      // sectors they took
+    uint64_t pages_read;        // buffer misses served from an extent
+    uint64_t decompress_ns;     // time spent decompressing them
+    uint64_t stored_pages;      // pages kept compressed now
+
+    compression_stats_t();
+    /* raw / stored bytes, 0 if nothing was written */
+    double ratio() const;
+    /* mean decompression time of a miss */
+    double decompress_ns_per_miss() const;
+    /* human readable report */
+    void print(std::ostream& os) const;
+};
+
+/* Where a compressed page lives in the companion file */
+struct extent_t {
+    uint64_t sector;
+    uint32_t sector_cnt;
+    uint64_t generation;
+};
+
+/* Companion file of a compressed table.
+ * Extents of one page are written to new sectors, the old ones are freed once
+ * the new copy is on disk, so a torn write never hides the last good copy.
+ */
+class CompressedExtents {
+    int fd;
+    pthread_mutex_t latch;
+    std::unordered_map<pagenum_t, extent_t> extents;
+    std::vector<bool> used_sectors;
+    uint64_t next_fit;          // sector the next allocation search starts from
+    uint64_t generation;
+    compression_stats_t stats;
+
+    private:
+        /* contiguous free sectors, the file grows if there are none */
+        uint64_t alloc_sectors(uint32_t count);
+        void free_sectors(const extent_t& extent);
+        /* clear magic of an extent, the open scan skips it from now on */
+        void invalidate(const extent_t& extent);
+
+    public:
+        /* constructor */
+        CompressedExtents();
+        ~CompressedExtents();
+        /* open or create companion file of table (pathname) and rebuild the page map */
+        bool open(const std::string& pathname, int flags);
+        /* check (pagenum) is stored compressed */
+        bool has_page(pagenum_t pagenum);
+        /* read and decompress (pagenum) into (dest), false if it isn't stored here */
+        bool read_page(pagenum_t pagenum, page_t* dest);
+        /* store (src) compressed, false if it doesn't save a sector.
+         * 'first_time' tells the page was not stored here before.
+         */
+        bool write_page(pagenum_t pagenum, const page_t* src, bool* first_time);
+        /* forget (pagenum), it is written in place from now on */
+        void drop_page(pagenum_t pagenum);
+        /* forget pages from (pagenum) on, the table file was cut there */
+        void drop_from(pagenum_t pagenum);
+        compression_stats_t get_stats();
+        /* fdatasync the companion file, with the table file at checkpoints */
+        void sync();
+        void close();
+};
+
+#endif
@@ -7,6 +7,7 @@
 #include "trx.h"
 #include "lock_table.h"
 #include "log.h"
+#include "vacuum.h"
 
 #include <stdint.h>
 
@@ -15,9 +16,13 @@
 #include <vector>
 
 /** Open existing data file using ‘pathname’ or create one if not existed. 
+ * 'open_mode' TABLE_OPEN_DIRECT bypasses the kernel page cache (O_DIRECT).
+ * 'open_mode' TABLE_OPEN_MMAP_READONLY maps an existing file read-only, finds and scans
+ * read pages in place without the buffer pool, inserts, deletes and updates fail.
+ * The table catalog keeps the id of 'pathname', it is the same after a restart.
  * If success, return a unique table id else return negative value.
  */
-int64_t open_table(const char* pathname);
+int64_t open_table(const char* pathname, int open_mode = TABLE_OPEN_BUFFERED);
 
 /** Insert key/value pair to data file.
  * If success, return 0 else return non-zero value.
@@ -48,6 +53,34 @@ int db_delete(int64_t table_id, int64_t key);
 int db_scan(int64_t table_id, int64_t begin_key, int64_t end_key,
 std::vector<int64_t>* keys, std::vector<char*>* values, std::vector<uint16_t>* val_sizes);
 
+/** Build the tree of an empty table from records given by 'next' in ascending key order.
+ * Leaves are filled to 'fill_percent' (50 - 100) of a page, internal levels are built bottom-up.
+ * No other operation may run on the table meanwhile.
+ * If success, return 0 else return non-zero value (records before a bad one stay loaded).
+ */
+int db_bulk_load(int64_t table_id, const bulk_load_next_t& next, int fill_percent = BULK_LOAD_FILL_PERCENT);
+
+/** Compact a table online: tree pages are rewritten in order (leaves in key order) into
+ * contiguous pages at the front of the file and the free tail of the file is cut off.
+ * Other operations on the table keep running between steps, inserts and deletes wait until it ends.
+ * Leaves with record locks of running transactions stay in place.
+ * 'stats' gets reclaimed space and leaf locality if not null.
+ * If success, return 0 else return non-zero value.
+ */
+int db_vacuum(int64_t table_id, vacuum_stats_t* stats = nullptr);
+
+/** Set compression mode of a table (COMPRESSION_NONE / COMPRESSION_LZ), kept in its header page.
+ * With COMPRESSION_LZ leaves are compressed when written back and decompressed on a buffer miss,
+ * they live in variable size extents of the companion file <pathname>.lz.
+ * Leaves compressed before stay readable after COMPRESSION_NONE, they go back in place when written.
+ * If success, return 0 else return non-zero value.
+ */
+int db_set_compression(int64_t table_id, int mode);
+
+/** Get compression ratio and decompression time per miss of a table since it was opened.
+ */
+compression_stats_t db_get_compression_stats(int64_t table_id);
+
 /** Update a record containing the 'key'.
  * If a matching key exists, update its value with 'value'.
  * If success, return 0 else return non-zero value and the transacntion has to be aborted.
@@ -55,14 +88,28 @@ std::vector<int64_t>* keys, std::vector<char*>* values, std::vector<uint16_t>* v
 int db_update(int64_t table_id, int64_t key, char* value, uint16_t new_val_size, uint16_t* old_val_size, int trx_id);
 
 /** Initialize DBMS.
+ * 'buf_policy' selects buffer replacement policy (BUFFER_POLICY_LRU / BUFFER_POLICY_CLOCK / BUFFER_POLICY_2Q).
  * If success, return 0 else return non-zero value.
  */
-int init_db(int num_buf);
+int init_db(int num_buf, int buf_policy = BUFFER_POLICY_LRU);
 
 /** Initialize DBMS Project 6
+ * 'buf_policy' selects buffer replacement policy (BUFFER_POLICY_LRU / BUFFER_POLICY_CLOCK / BUFFER_POLICY_2Q).
+ * If success, return 0 else return non-zero value.
+ */
+int init_db(int buf_num, int flag, int log_num, char* log_path, char* logmsg_path, int buf_policy = BUFFER_POLICY_LRU);
+
+/** Get buffer pool statistics since init_db.
+ * Hits, misses, evictions and write backs per table and page type, and latch waits,
+ * to size 'num_buf' of init_db from real workloads.
+ */
+buffer_stats_t get_buffer_stats();
+
+/** Take a fuzzy checkpoint now, besides the periodic ones (CHECKPOINT_INTERVAL_MS).
+ * Recovery analyzes the log from the last checkpoint and redoes it from the oldest recLSN of its dirty pages.
  * If success, return 0 else return non-zero value.
  */
-int init_db(int buf_num, int flag, int log_num, char* log_path, char* logmsg_path);
+int db_checkpoint();
 
 /** Shutdown DBMS.
  * If success, return 0 else return non-zero value.
@@ -5,52 +5,200 @@
 #include <map>
 #include <utility>
 #include <string>
+#include <pthread.h>
 
 #include "page.h"
+#include "compress.h"
+
+/* Durability modes of table files.
+ * Data pages are protected by the WAL, so table files don't need to be
+ * synced on every write.
+ */
+#define DURABILITY_NONE 0           // never sync, leave write back to the OS
+#define DURABILITY_CHECKPOINT 1     // fdatasync table files at checkpoints
+#define DURABILITY_PER_WRITE 2      // fdatasync after every page write
+
+/* I/O backends of table files */
+#define IO_BACKEND_PREAD 0          // blocking pread / pwrite
+#define IO_BACKEND_URING 1          // io_uring, falls back to pread if unavailable
+#define WRITE_RUN_MAX_PAGES 64      // max adjacent pages written by one vectored write
+
+/* Table files grow by extents reserved with fallocate, pages in them are
+ * initialized only when handed out. Free pages are tracked by bitmap pages
+ * (see PAGES_PER_BITMAP), not linked through the pages themselves.
+ */
+#define DEFAULT_GROWTH_PAGES (INITIAL_DB_FILE_SIZE / PAGE_SIZE)     // 10 MiB per extension
+
+/* Open modes of table files */
+#define TABLE_OPEN_BUFFERED 0       // through the kernel page cache
+#define TABLE_OPEN_DIRECT 1         // O_DIRECT, the buffer pool is the only cache
+#define TABLE_OPEN_MMAP_READONLY 2  // read-only, pages are read in place from a shared mapping
+
+/* One page of a batched read / write */
+struct file_io_req_t {
+    int64_t table_id;
+    pagenum_t pagenum;
+    page_t* page;
+};
 
 namespace file_io {
     off_t get_file_size(int fd);
     bool is_valid_magic_number(int fd);
-    void extend_file(int fd);
+    bool reserve_extent(int fd, pagenum_t start_pagenum, pagenum_t page_cnt);
+    bool extend_file(int fd, page_t* header_page);
+    bool convert_free_list(int fd, page_t* header_page);
     void read_page(int fd, pagenum_t pagenum, void* dest);
     void write_page(int fd, pagenum_t pagenum, const page_t* src);
-    void make_free_pages(int fd, pagenum_t start_pagenum, pagenum_t new_page_cnt, pagenum_t total_cnt);
 }
 
+/* Read-only mapping of a table file */
+struct table_mapping_t {
+    const char* base;
+    pagenum_t page_cnt;
+};
+
+/* Table catalog and file handles.
+ * Table ids are given out once per path and kept in the catalog file, so log
+ * records keep naming the same table across restarts. Files are reopened on
+ * demand, at most max_open_files descriptors are held at a time.
+ */
+#define DEFAULT_CATALOG_PATH "TABLE_CATALOG"    // lines of "<table id> <pathname>"
+#define DEFAULT_MAX_OPEN_FILES 512              // descriptors kept by the fd cache
+#define TABLE_CHUNK_SIZE 1024                   // table slots per chunk of the table id array
+#define MAX_TABLE_CHUNKS 1024                   // up to 1M table ids
+
+/* Opened table file */
+struct table_file_t {
+    int64_t table_id;
+    std::string pathname;
+    int flags;                  // open flags, the fd cache reopens with them
+    int fd;                     // -1 while closed by the fd cache
+    int users;                  // pins of the fd, never closed while in use
+    bool written;               // written since the last sync
+    uint64_t last_used;         // tick of the last acquire, least recent is closed first
+    table_mapping_t mapping;    // base is nullptr unless TABLE_OPEN_MMAP_READONLY
+    int compression;            // COMPRESSION_NONE / COMPRESSION_LZ, leaves written back from now on
+    CompressedExtents* extents; // nullptr until the table is compressed once
+};
+
 // Manger for opened tables.
 class TableManager {
+    table_file_t** chunks[MAX_TABLE_CHUNKS];                // table id -> opened file, read without latch
+    std::vector<table_file_t*> opened_tables;
+    std::map<std::string, int64_t> catalog;
+    std::vector<std::string> catalog_paths;                 // table id -> pathname
+    std::string catalog_path;
+    bool catalog_loaded;
     int64_t next_table_id;
-    std::map<int, int64_t> fd_to_table_id;
-    std::map<int64_t, int> table_id_to_fd;
-    std::vector<int> opened_files;
+    int open_fd_count;
+    int max_open_files;
+    uint64_t use_tick;
+    pthread_mutex_t table_manager_latch;
+
+    table_file_t* get_table(int64_t table_id);
+    void load_catalog();
+    // close least recently used fds until there is room for one more
+    void make_room_for_fd();
 
     public:
-        TableManager() : next_table_id(0) {}
-        int64_t get_table_id(int fd);
+        TableManager();
+        // id of (pathname) in the catalog, a new one is given out and persisted if it has none
         int64_t get_table_id(std::string pathname);
+        // pathname of (table_id) in the catalog, empty if there is none
+        std::string get_pathname(int64_t table_id);
+        void insert_table(int64_t table_id, int fd, int flags, std::string pathname);
+        bool is_opened(int64_t table_id);
+        // pin fd of an opened table, reopening it if the fd cache closed it. -1 on failure
+        int acquire_fd(int64_t table_id);
+        void release_fd(int64_t table_id, bool written = false);
+        // fd without a pin, only while nothing else opens tables
         int get_fd(int64_t table_id);
-        void insert_table(int fd, std::string pathname);
-        void insert_table(int fd);
+        // fdatasync opened tables written since their last sync
+        void sync_files();
+        void insert_mapping(int64_t table_id, table_mapping_t mapping);
+        const table_mapping_t* get_mapping(int64_t table_id);
+        // set compression mode, the companion file is opened on first use. false on failure
+        bool set_compression(int64_t table_id, int mode);
+        int get_compression(int64_t table_id);
+        // companion file of a table, nullptr if no page of it was ever compressed
+        CompressedExtents* get_extents(int64_t table_id);
+        void set_catalog_path(const std::string& path);
+        void set_max_open_files(int count);
         void close_all();
 };
 
 extern TableManager table_manager;
 
+// Open table file, dropping O_DIRECT if the file system refuses it
+int open_table_fd(const char* pathname, int flags);
+
 // Open existing database file or create one if it doesn't exist
-int64_t file_open_table_file(const char* pathname);
+// TABLE_OPEN_DIRECT falls back to buffered I/O if the file system refuses O_DIRECT
+int64_t file_open_table_file(const char* pathname, int open_mode = TABLE_OPEN_BUFFERED);
 
-// Allocate an on-disk page from the free page list
-uint64_t file_alloc_page(int64_t table_id);
+// Allocate an on-disk page, the free one nearest after (hint) first.
+// Returns 0 if the file can't grow any more.
+uint64_t file_alloc_page(int64_t table_id, pagenum_t hint = 0);
 
-// Free an on-disk page to the free page list
+// Free an on-disk page
 void file_free_page(int64_t table_id, pagenum_t page_number);
 
+// Page of a table opened with TABLE_OPEN_MMAP_READONLY, read in place.
+// nullptr if the table isn't mapped or (pagenum) is past the mapping.
+const page_t* file_get_mapped_page(int64_t table_id, pagenum_t pagenum);
+
+// Check table is opened with TABLE_OPEN_MMAP_READONLY
+bool file_is_mapped(int64_t table_id);
+
+// Tell the kernel pages (pagenums) of a mapped table are read soon
+void file_advise_mapped_pages(int64_t table_id, const std::vector<pagenum_t>& pagenums);
+
+// Grow table file by one extent, (header_page) is updated and written back by the caller
+bool file_extend_table(int64_t table_id, page_t* header_page);
+
+// Cut table file to its first (page_cnt) pages, the header is updated by the caller
+bool file_truncate_table(int64_t table_id, pagenum_t page_cnt);
+
 // Read an on-disk page into the in-memory page structure(dest)
 void file_read_page(int64_t table_id, pagenum_t page_number, struct page_t* dest);
 
 // Write an in-memory page(src) to the on-disk page
 void file_write_page(int64_t table_id, pagenum_t page_number, const struct page_t* src);
 
+// Read pages in one batch
+void file_read_pages(std::vector<file_io_req_t>& reqs);
+
+// Write pages in one batch, sorted and coalesced into vectored writes
+void file_write_pages(std::vector<file_io_req_t>& reqs);
+
+// Choose I/O backend, returns the backend actually in use
+int file_init_io_backend(int backend);
+
+// Set growth increment of table files in pages, 0 doubles the file every time
+void file_set_growth_increment(pagenum_t page_cnt);
+
+// Set durability mode (DURABILITY_NONE / DURABILITY_CHECKPOINT / DURABILITY_PER_WRITE)
+void file_set_durability_mode(int mode);
+
+// Set path of the table catalog, before the first table is opened
+void file_set_catalog_path(const char* path);
+
+// Set max number of table files kept open, the rest are reopened on demand
+void file_set_max_open_files(int count);
+
+// Pathname of (table_id) in the table catalog, empty if there is none
+std::string file_get_table_path(int64_t table_id);
+
+// Set compression mode of a table (COMPRESSION_NONE / COMPRESSION_LZ), leaves are
+// compressed when written back from now on, stored ones stay readable after COMPRESSION_NONE
+bool file_set_table_compression(int64_t table_id, int mode);
+
+// Compression counters of a table since it was opened
+compression_stats_t file_get_compression_stats(int64_t table_id);
+
+// Sync opened table files if the durability mode asks for it at checkpoints
+void file_checkpoint_table_files();
+
 // Close the database file
 void file_close_table_files();
 
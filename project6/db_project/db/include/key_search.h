@@ -0,0 +1,31 @@
+#ifndef KEY_SEARCH_H
+#define KEY_SEARCH_H
+
+#include "page.h"
+
+/* In-page key search.
+ * Branch-free binary search narrows the sorted keys of a page down to a window of
+ * KEY_SEARCH_WINDOW keys, a compare kernel counts the keys <= the search key in it.
+ * The kernel is chosen by CPU features when the program starts.
+ */
+#define KEY_SEARCH_SCALAR 0
+#define KEY_SEARCH_SSE42 1          // pcmpgtq, two keys per compare
+#define KEY_SEARCH_AVX2 2           // four keys per compare
+#define KEY_SEARCH_AUTO -1
+
+#define KEY_SEARCH_WINDOW 16        // internal keys of four cache lines, leaf keys of three
+
+namespace key_search {
+    // index of the child of internal page to descend to for (key)
+    slotnum_t internal_child_idx(const page_t* internal_page, int64_t key);
+    // number of slots of leaf page with keys <= (key), the insert position of (key)
+    slotnum_t leaf_upper_bound(const page_t* leaf_page, int64_t key);
+    // slot of (key) in leaf page, -1 if there is none
+    slotnum_t leaf_find_slot(const page_t* leaf_page, int64_t key);
+    // choose compare kernel, KEY_SEARCH_AUTO picks the best one the CPU has.
+    // returns the kernel actually in use
+    int set_kernel(int kernel);
+    int get_kernel();
+}
+
+#endif
@@ -3,7 +3,7 @@
 
 #include <stdint.h>
 #include <pthread.h>
-#include <unordered_map>
+#include <map>
 
 #define SHARED_LOCK 0
 #define EXCLUSIVE_LOCK 1
@@ -21,7 +21,7 @@ struct lock_t {
     lock_table_entry_t* sentinel;
     pthread_cond_t cond;
     int lock_mode;
-    pagenum_t record_id;
+    int64_t record_id;          // key of the record
     lock_t* next_trx_lock_obj;
     int owner_trx_id;
 
@@ -36,7 +36,7 @@ struct lock_t {
         owner_trx_id = -1;
     }
 
-    lock_t(pagenum_t record_id, int trx_id, int lock_mode) {
+    lock_t(int64_t record_id, int trx_id, int lock_mode) {
         prev = nullptr;
         next = nullptr;
         sentinel = nullptr;
@@ -48,15 +48,16 @@ struct lock_t {
     }
 };
 
+/* Locks of one record, found by key so they hold wherever the record moves */
 struct lock_table_entry_t {
     int64_t table_id;
-    int64_t page_id;
+    int64_t key;
     lock_t* head;
     lock_t* tail;
 
-    lock_table_entry_t(int64_t table_id, int64_t page_id) {
+    lock_table_entry_t(int64_t table_id, int64_t key) {
         this->table_id = table_id;
-        this->page_id = page_id;
+        this->key = key;
         this->head = new lock_t();
         this->tail = new lock_t();
         this->head->next = this->tail;
@@ -76,7 +77,8 @@ bool is_conflict(lock_t* lock_obj);
 
 /* APIs for lock table */
 int init_lock_table();
-lock_t *lock_acquire(int64_t table_id, pagenum_t page_id, int64_t key, int trx_id, int lock_mode);
+lock_t *lock_acquire(int64_t table_id, int64_t key, int trx_id, int lock_mode);
 int lock_release(lock_t* lock_obj);
+bool lock_is_range_locked(int64_t table_id, int64_t low_key, int64_t high_key);
 
 #endif /* __LOCK_TABLE_H__ */
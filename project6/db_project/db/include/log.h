@@ -6,10 +6,25 @@
 #define COMMIT_LOG 2
 #define ROLLBACK_LOG 3
 #define COMPENSATE_LOG 4
+#define BEGIN_CHECKPOINT_LOG 5
+#define END_CHECKPOINT_LOG 6
 
 #define DEFAULT_LOG_SIZE 28
 #define DEFAULT_UPDATE_LOG_SIZE 48
 #define DEFAULT_COMPENSATE_LOG_SIZE 56
+#define DEFAULT_END_CHECKPOINT_LOG_SIZE 36
+#define CHECKPOINT_TRX_ENTRY_SIZE 12       // trx id, last LSN
+#define CHECKPOINT_PAGE_ENTRY_SIZE 24      // table id, page id, recLSN
+
+/* Fuzzy checkpoints */
+#define CHECKPOINT_INTERVAL_MS 10000       // between periodic checkpoints, skipped while the log is idle
+#define CHECKPOINT_MASTER_SUFFIX ".ckpt"   // master record file next to the log: LSN of the last begin checkpoint
+
+/* Log segments: <log path>.<segment number>, LSN / segment size picks the file */
+#define LOG_SEGMENT_SIZE (16 * 1024 * 1024)    // bytes per segment of a new log, an existing log keeps its own
+#define LOG_SEGMENT_DIGITS 6                   // zero padded segment number
+#define LOG_SEGMENT_SPARES 4                   // freed segments renamed ahead for reuse, the rest are removed
+#define LOG_SEGMENT_FILL_CHUNK (1024 * 1024)   // zero fill unit of a new segment
 
 #include "db.h"
 #include "buffer.h"
@@ -25,11 +40,15 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
 
 #include <string>
 #include <iostream>
 #include <vector>
 #include <set>
+#include <map>
+#include <atomic>
 
 using slotnum_t = int16_t;
 
@@ -45,7 +64,7 @@ class log_t {
         uint32_t trx_id;
         uint32_t log_type;
 
-        virtual void write_log(int fd);
+        virtual void write_log(std::string& out);
 };
 
 // Begin / Commit / Rollback Log
@@ -54,21 +73,21 @@ class begin_log_t : public log_t {
         begin_log_t();
         begin_log_t(int trx_id);
 
-        void write_log(int fd) override;
+        void write_log(std::string& out) override;
 };
 class commit_log_t : public log_t {
     public:
         commit_log_t();
         commit_log_t(int trx_id);
 
-        void write_log(int fd) override;
+        void write_log(std::string& out) override;
 };
 class rollback_log_t : public log_t {
     public:
         rollback_log_t();
         rollback_log_t(int trx_id);
 
-        void write_log(int fd) override;
+        void write_log(std::string& out) override;
 };
 
 // Update / Compensate Log
@@ -84,7 +103,7 @@ class update_log_t : public log_t {
         update_log_t();
         update_log_t(int trx_id, uint64_t table_id, uint64_t page_id, slotnum_t offset, uint16_t data_length, std::string old_image, std::string new_image);
 
-        void write_log(int fd) override;
+        void write_log(std::string& out) override;
         void add_old_image(std::string old_img);
         void add_new_image(std::string new_img);
 };
@@ -101,11 +120,29 @@ class compensate_log_t : public log_t {
         compensate_log_t();
         compensate_log_t(int trx_id, uint64_t table_id, uint64_t page_id, slotnum_t offset, uint16_t data_length, std::string old_image, std::string new_image, uint64_t next_undo_LSN);
 
-        void write_log(int fd) override;
+        void write_log(std::string& out) override;
         void add_old_image(std::string old_img);
         void add_new_image(std::string new_img);
 };
 
+// Begin / End Checkpoint Log
+class begin_checkpoint_log_t : public log_t {
+    public:
+        begin_checkpoint_log_t();
+
+        void write_log(std::string& out) override;
+};
+class end_checkpoint_log_t : public log_t {
+    public:
+        std::vector<std::pair<int, uint64_t>> active_trx;   // transaction table: trx id, last LSN
+        std::vector<dirty_page_t> dirty_pages;              // dirty page table with recLSNs
+
+        end_checkpoint_log_t();
+        end_checkpoint_log_t(const std::vector<std::pair<int, uint64_t>>& active_trx, const std::vector<dirty_page_t>& dirty_pages);
+
+        void write_log(std::string& out) override;
+};
+
 // Log Buffer Manager
 class LogBufferManager {
     private:
@@ -113,31 +150,81 @@ class LogBufferManager {
         int max_size;
         char* log_path;
         char* logmsg_path;
-        int log_file_fd;
+        bool log_opened;
+        int master_fd;
         FILE* logmsg_file;
 
         std::set<int> win_trx;
         std::set<int> lose_trx;
+        std::map<std::pair<int64_t, pagenum_t>, uint64_t> dirty_pages;   // dirty page table of analysis
+        uint64_t redo_LSN;          // smallest recLSN, redo starts here
+
+        pthread_t checkpointer_thread;
+        bool checkpointer_running;
+        pthread_mutex_t checkpointer_latch;
+        pthread_cond_t checkpointer_cond;
+        int checkpoint_interval_ms;
+        uint64_t last_checkpoint_end;   // end of log after the last checkpoint
+
+        std::map<uint64_t, int> segment_fds;    // opened segment files
+        uint64_t segment_size;
+        uint64_t default_segment_size;  // size of segments of a new log
+        uint64_t first_segment;     // oldest segment on disk
+        uint64_t last_segment;      // newest segment on disk, spares ahead of the log included
+        std::string archive_dir;    // freed segments move here instead of being reused, empty if none
+        std::unordered_map<int, uint64_t> trx_first_LSN;   // first LSN of running transactions
 
         begin_log_t make_begin_log(char* buf);
         commit_log_t make_commit_log(char* buf);
         rollback_log_t make_rollback_log(char* buf);
         update_log_t make_update_log(char* buf);
         compensate_log_t make_compensate_log(char* buf);
+        end_checkpoint_log_t make_end_checkpoint_log(char* buf);
+
+        std::string segment_path(uint64_t segno);
+        /* fd of a segment, a missing one is created zero filled if 'create' else -1 */
+        int get_segment_fd(uint64_t segno, bool create);
+        void sync_log_dir();
+        /* find segments of the log, a single file log of older versions is split once */
+        void open_segments();
+        void write_log_bytes(const char* src, uint64_t size, uint64_t LSN);
+        bool read_log_bytes(char* dest, uint64_t size, uint64_t LSN);
+        /* record at LSN in a new[] buffer, nullptr past the end of log */
+        char* read_log_record(uint64_t LSN, uint32_t* log_size, uint32_t* log_type);
+        /* reuse, archive or remove segments wholly before 'keep_LSN' */
+        void recycle_segments(uint64_t keep_LSN);
+
+        /* LSN of the last complete checkpoint, 0 if there is none */
+        uint64_t read_master_record();
+        void write_master_record(uint64_t begin_LSN);
+        void note_dirty_page(int64_t table_id, pagenum_t pagenum, uint64_t rec_LSN);
+        /* checkpointer thread body */
+        static void* checkpointer_main(void* arg);
+        void start_checkpointer();
 
         int analyze_log();
         int redo_pass(int flag, int log_num);
         int undo_pass(int flag, int log_num);
 
     public:
-        uint64_t next_LSN;
+        std::atomic<uint64_t> next_LSN;    // read without latch for recLSNs of frames
 
         LogBufferManager();
         void init(int buf_size, char* log_path, char* logmsg_path);
-        void add_log(log_t* log);
-        void add_log_no_latch(log_t* log);
+        /* hand (log) over to the buffer and return its LSN, (log) may be flushed and freed right after */
+        uint64_t add_log(log_t* log);
+        uint64_t add_log_no_latch(log_t* log);
         void flush_logs();
         void recovery(int flag, int log_num);
+        /* write begin / end checkpoint records and point the master record at them */
+        void checkpoint();
+        /* periodic checkpoint interval, 0 turns it off */
+        void set_checkpoint_interval(int interval_ms);
+        /* segment size of logs created by the next init */
+        void set_segment_size(uint64_t size);
+        /* keep freed segments in 'dir' instead of reusing them, nullptr turns it off */
+        void set_archive_dir(const char* dir);
+        void stop_checkpointer();
         void end_log();
 };
 
@@ -2,37 +2,77 @@
 #define ON_DISK_BPT_H
 
 #include <algorithm>
+#include <functional>
 
 #include "buffer.h"
+#include "key_search.h"
+
+#define BULK_LOAD_FILL_PERCENT 90   // default share of a page filled by the bulk loader
+
+/* Input of the bulk loader, stores the next record and returns true, or returns false at the end.
+ * (value) must stay valid until the next call.
+ */
+typedef std::function<bool(int64_t* key, const char** value, uint16_t* size)> bulk_load_next_t;
+
+/* Internal pages a descent went through, root first.
+ * Splits and merges take parents from it, pages keep no parent pointer.
+ */
+typedef std::vector<pagenum_t> tree_path_t;
 
 /* Util Functions */
 slotnum_t cut_leaf(page_t* leaf);
 slotnum_t cut_internal();
 pagenum_t get_left_idx(int64_t table_id, pagenum_t parent, pagenum_t left);
-pagenum_t get_neighbor_idx(int64_t table_id, pagenum_t node);
+pagenum_t get_neighbor_idx(int64_t table_id, pagenum_t parent, pagenum_t node);
 
 /* Find */
-pagenum_t find_leaf(int64_t table_id, pagenum_t root, int64_t key);
+pagenum_t find_leaf(int64_t table_id, pagenum_t root, int64_t key, tree_path_t* path = nullptr);
+pagenum_t find_leaf_siblings(int64_t table_id, pagenum_t root, int64_t key,
+std::vector<std::pair<pagenum_t, int64_t>>* siblings, int64_t* fence, bool* has_fence);
 std::pair<pagenum_t, slotnum_t> find(int64_t table_id, pagenum_t root, int64_t key);
+/* Copy the record of (key) out under the leaf latch, slots may move once it's released.
+ * Returns 0 on success, -1 if there is no (key).
+ */
+int find_record(int64_t table_id, pagenum_t root, int64_t key, char* value, uint16_t* size);
+/* Latch the leaf of (key) exclusively and find the slot of (key) in it, the caller
+ * changes the record in place and unpins the leaf.
+ * Returns the leaf, or 0 with nothing latched if there is no (key).
+ */
+pagenum_t latch_record(int64_t table_id, pagenum_t root, int64_t key, buffer_t** leaf_page, slotnum_t* slot);
+pagenum_t find_leaf_mapped(int64_t table_id, pagenum_t root, int64_t key,
+std::vector<std::pair<pagenum_t, int64_t>>* siblings, int64_t* fence, bool* has_fence);
+std::pair<pagenum_t, slotnum_t> find_mapped(int64_t table_id, pagenum_t root, int64_t key);
 
 /* Insertion */
-pagenum_t make_internal_node(int64_t table_id);
-pagenum_t make_leaf(int64_t table_id);
+pagenum_t make_internal_node(int64_t table_id, pagenum_t near = 0);
+pagenum_t make_leaf(int64_t table_id, pagenum_t near = 0);
 pagenum_t insert_into_leaf(int64_t table_id, pagenum_t leaf, int64_t key, const char* value, uint16_t size);
-pagenum_t insert_into_leaf_after_splitting(int64_t table_id, pagenum_t root, pagenum_t leaf, int64_t key, const char* value, uint16_t size);
+pagenum_t insert_into_leaf_after_splitting(int64_t table_id, pagenum_t root, pagenum_t leaf, int64_t key, const char* value, uint16_t size, tree_path_t* path);
 pagenum_t insert_into_node(int64_t table_id, pagenum_t root, pagenum_t node, slotnum_t left_idx, int64_t key, pagenum_t right);
-pagenum_t insert_into_node_after_splitting(int64_t table_id, pagenum_t root, pagenum_t old_node, pagenum_t left_index, int64_t key, pagenum_t right);
-pagenum_t insert_into_parent(int64_t table_id, pagenum_t root, pagenum_t left, int64_t key, pagenum_t right);
+pagenum_t insert_into_node_after_splitting(int64_t table_id, pagenum_t root, pagenum_t old_node, pagenum_t left_index, int64_t key, pagenum_t right, tree_path_t* path);
+pagenum_t insert_into_parent(int64_t table_id, pagenum_t root, pagenum_t left, int64_t key, pagenum_t right, tree_path_t* path);
 pagenum_t insert_into_new_root(int64_t table_id, pagenum_t left, int64_t key, pagenum_t right);
 pagenum_t start_new_tree(int64_t table_id, int64_t key, const char* value, uint16_t size);
 pagenum_t insert(int64_t table_id, pagenum_t root, int64_t key, const char* value, uint16_t size);
+/* Insert unless internal pages would split: into the leaf of (key), or into a new
+ * right half of it that its parent has room for.
+ * Returns 0 if inserted, 1 for a duplicate key, -1 if an internal page must split.
+ */
+int insert_in_leaf(int64_t table_id, pagenum_t root, int64_t key, const char* value, uint16_t size);
 
 /* Deletion */
 pagenum_t adjust_root(int64_t table_id, pagenum_t root);
-pagenum_t merge_nodes(int64_t table_id, pagenum_t root, pagenum_t node, pagenum_t neighbor, pagenum_t neighbor_idx, int64_t prime_key);
-pagenum_t redistribute_nodes(int64_t table_id, pagenum_t root, pagenum_t node, pagenum_t neighbor, pagenum_t neighbor_idx, pagenum_t prime_key_idx, int64_t prime_key);
+pagenum_t merge_nodes(int64_t table_id, pagenum_t root, pagenum_t node, pagenum_t neighbor, pagenum_t neighbor_idx, int64_t prime_key, tree_path_t* path);
+pagenum_t redistribute_nodes(int64_t table_id, pagenum_t root, pagenum_t parent, pagenum_t node, pagenum_t neighbor, pagenum_t neighbor_idx, pagenum_t prime_key_idx, int64_t prime_key);
 pagenum_t remove_entry_from_node(int64_t table_id, int64_t key, pagenum_t node);
-pagenum_t delete_entry(int64_t table_id, pagenum_t root, pagenum_t node, int64_t key);
+pagenum_t delete_entry(int64_t table_id, pagenum_t root, pagenum_t node, int64_t key, tree_path_t* path);
 pagenum_t master_delete(int64_t table_id, pagenum_t root, int64_t key);
+/* Delete only if the leaf of (key) stays full enough, latching nothing but that leaf.
+ * Returns 0 if deleted, 1 if there is no (key), -1 if the tree must change shape.
+ */
+int delete_in_leaf(int64_t table_id, pagenum_t root, int64_t key);
+
+/* Bulk Load */
+int bulk_load(int64_t table_id, const bulk_load_next_t& next, int fill_percent);
 
 #endif
\ No newline at end of file
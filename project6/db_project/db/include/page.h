@@ -17,17 +17,42 @@
 #define KEY_COUNT_OFFSET (12)
 #define LEAF_PAGE_OFFSET (112)
 #define LEAF_PAGE_SLOT_OFFSET (128)
+#define LEAF_RECORD_START_OFFSET (32)
 #define INTERNAL_PAGE_OFFSET (120)
+#define HIGH_KEY_OFFSET (96)
+#define INTERNAL_RIGHT_LINK_OFFSET (104)
 #define SLOT_SIZE (12)
 #define INTERNAL_ORDER (249)
 #define PAGE_HEADER_SIZE (128)
 #define INITIAL_FREE_SPACE (3968)
 #define THRESHOLD (2500)
 
+/* Leaf pages are slotted: sorted slots grow up from LEAF_PAGE_SLOT_OFFSET, records grow
+ * down from the end of the page in any order. Deleted records leave holes, they are
+ * compacted away only when the gap between slots and records is too small for an insert.
+ * Free space of the header counts the holes too. The header also keeps where the records
+ * start, 0 in leaves written before it was kept.
+ */
+
+/* B-link: each tree page links to the next page of its level (leaves through their right
+ * sibling) and keeps a high key, the first key past the page. The last page of a level
+ * has no right link and no high key. A descent that lands left of its key moves right.
+ */
+
+/* Free space map: one bitmap page per group of PAGES_PER_BITMAP pages,
+ * their page numbers are kept in the header page.
+ */
+#define PAGES_PER_BITMAP (PAGE_SIZE * 8)
+#define HEADER_BITMAP_COUNT_OFFSET (40)
+#define HEADER_BITMAP_PAGES_OFFSET (48)
+#define HEADER_COMPRESSION_OFFSET (PAGE_SIZE - 8)
+#define MAX_BITMAP_PAGES ((HEADER_COMPRESSION_OFFSET - HEADER_BITMAP_PAGES_OFFSET) / 8)
+
 typedef uint64_t pagenum_t;
 typedef int16_t slotnum_t;
 
-struct page_t {
+/* page aligned, so any page_t can be the buffer of O_DIRECT I/O */
+struct alignas(PAGE_SIZE) page_t {
     char data[PAGE_SIZE];
 };
 
@@ -40,9 +65,12 @@ namespace page_io {
     bool is_leaf(const page_t* page);
     uint32_t get_key_count(const page_t* page);
     void set_key_count(page_t* page, uint32_t key_count);
-    pagenum_t get_parent_page(const page_t* page);
-    void set_parent_page(page_t* page, pagenum_t parent_page);
     void set_free_page_next(page_t* page, pagenum_t next_free_page);
+    pagenum_t get_right_link(const page_t* page);
+    void set_right_link(page_t* page, pagenum_t right_link);
+    int64_t get_high_key(const page_t* page);
+    void set_high_key(page_t* page, int64_t high_key);
+    bool is_past_high_key(const page_t* page, int64_t key);
 
     /* Newly Implemented Functions For Project 6 */
     void set_page_LSN(page_t* page, uint64_t LSN);
@@ -54,6 +82,21 @@ namespace page_io {
         void set_next_free_page(page_t* header_page, pagenum_t next_free_page);
         pagenum_t get_root_page(const page_t* header_page);
         pagenum_t get_page_count(const page_t* header_page);
+        void set_first_unused_page(page_t* header_page, pagenum_t first_unused_page);
+        pagenum_t get_first_unused_page(const page_t* header_page);
+        uint64_t get_bitmap_count(const page_t* header_page);
+        pagenum_t get_bitmap_page(const page_t* header_page, uint64_t group);
+        void add_bitmap_page(page_t* header_page, pagenum_t bitmap_page);
+        void set_bitmap_count(page_t* header_page, uint64_t bitmap_cnt);
+        uint32_t get_group_size(const page_t* header_page, uint64_t group);
+        int get_compression(const page_t* header_page);
+        void set_compression(page_t* header_page, int mode);
+    }
+    namespace bitmap {
+        bool is_used(const page_t* bitmap_page, uint32_t idx);
+        void set_used(page_t* bitmap_page, uint32_t idx);
+        void set_free(page_t* bitmap_page, uint32_t idx);
+        int64_t find_free(const page_t* bitmap_page, uint32_t from, uint32_t limit);
     }
     namespace internal {
         void set_new_internal_page(page_t* internal_page);
@@ -75,6 +118,11 @@ namespace page_io {
         int64_t get_key(const page_t* leaf_page, slotnum_t slot_num);
         slotnum_t get_record_size(const page_t* leaf_page, slotnum_t slot_num);
         slotnum_t get_offset(const page_t* leaf_page, slotnum_t slot_num);
+        slotnum_t get_record_start(const page_t* leaf_page);
+        void set_record_start(page_t* leaf_page, slotnum_t record_start);
+        void compact(page_t* leaf_page);
+        void insert_slot(page_t* leaf_page, slotnum_t slot_num, int64_t key, const char* value, uint16_t size);
+        void remove_slot(page_t* leaf_page, slotnum_t slot_num);
     }
 }
 
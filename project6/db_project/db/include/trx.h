@@ -30,12 +30,12 @@ extern int64_t global_trx_id;
 // Transaction Manager
 class TrxManager {
     private:
+        // undo finds the record by key, splits and vacuum may have moved it
         struct log_t {
             std::string old_value;
             int old_val_size;
             int64_t table_id;
-            pagenum_t page_id;
-            slotnum_t slot_num;
+            int64_t key;
         };
         
         std::unordered_map<int, lock_t*> trx_table;
@@ -51,7 +51,7 @@ class TrxManager {
         // print adj
         void print_adj();
         // add log
-        void add_log_to_trx(int64_t table_id, pagenum_t page_id, slotnum_t slot_num, int trx_id);
+        void add_log_to_trx(int64_t table_id, int64_t key, const std::string& old_value, int trx_id);
         // update wait for graph
         void update_graph(lock_t* lock);
         // check cycle
@@ -89,6 +89,12 @@ int trx_commit(int trx_id);
  */
 int trx_abort(int trx_id);
 
-int trx_get_lock(int64_t table_id, pagenum_t page_id, slotnum_t slot_num, int trx_id, int lock_mode);
+int trx_get_lock(int64_t table_id, int64_t key, int trx_id, int lock_mode);
+
+/**
+ * Overwrite the record of (key) and log it as an update of (trx_id), under one leaf latch.
+ * The old value goes to (old_value). Returns 0 on success, -1 if there is no (key).
+ */
+int trx_update_record(int64_t table_id, int64_t key, const char* value, uint16_t size, int trx_id, std::string* old_value);
 
 #endif
\ No newline at end of file
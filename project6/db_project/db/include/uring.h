@@ -0,0 +1,73 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <linux/io_uring.h>
+
+#include <vector>
+
+#define URING_QUEUE_DEPTH 64    // max in-flight requests of one ring
+
+/* One I/O request, a single buffer or a vector of them (iov set) */
+struct uring_req_t {
+    int fd;
+    off_t offset;
+    void* buf;
+    size_t len;
+    const iovec* iov;
+    int iovcnt;
+};
+
+/* Minimal io_uring wrapper on raw syscalls.
+ * A ring is not thread safe, every thread owns its own ring.
+ */
+class IoUring {
+    /* field */
+    int ring_fd;
+    unsigned entries;
+
+    void* sq_ptr;
+    size_t sq_len;
+    void* cq_ptr;
+    size_t cq_len;
+    io_uring_sqe* sqes;
+    size_t sqes_len;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    io_uring_cqe* cqes;
+
+    std::vector<iovec> iovecs;
+
+    private:
+        /* submit queued sqes and wait for all of them */
+        bool submit_and_wait(unsigned count);
+        /* run one chunk (<= entries) of requests */
+        bool run_chunk(int opcode, uring_req_t* reqs, unsigned count);
+
+    public:
+        /* constructor */
+        IoUring();
+        /* set up ring, returns false if io_uring is not available */
+        bool init(unsigned entries = URING_QUEUE_DEPTH);
+        /* check ring is set up */
+        bool is_ready();
+        /* read requests, returns false on any failed request */
+        bool read(std::vector<uring_req_t>& reqs);
+        /* write requests, returns false on any failed request */
+        bool write(std::vector<uring_req_t>& reqs);
+        /* tear down ring */
+        void destroy();
+        /* Destructor */
+        ~IoUring();
+};
+
+#endif
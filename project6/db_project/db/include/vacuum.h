@@ -0,0 +1,72 @@
+#ifndef VACUUM_H
+#define VACUUM_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <iostream>
+#include <map>
+
+#include "buffer.h"
+#include "lock_table.h"
+
+#define VACUUM_STEP_PAGES 16        // pages moved per step, operations run between steps
+
+#define TABLE_ACCESS_READ 0         // finds and scans
+#define TABLE_ACCESS_MODIFY 1       // leaf changes, leaf splits into parents with room
+#define TABLE_ACCESS_RESHAPE 2      // splits, bulk load, anything else
+#define TABLE_ACCESS_MERGE 3        // merges and redistributions, readers wait too
+
+/* Latches that let vacuum move pages of a live table.
+ * Every operation holds access_latch shared while it runs, vacuum takes it
+ * exclusive one step at a time. Writers also hold modify_latch, shared if only
+ * leaves change or split and exclusive if internal pages may split or merge. Vacuum keeps
+ * it exclusive for its whole run, so only vacuum reshapes the tree meanwhile.
+ * Merges move keys left and free pages, which a descent past the parent can't follow,
+ * so they take access_latch exclusive too and free the pages right away.
+ */
+struct table_latch_t {
+    pthread_rwlock_t access_latch;
+    pthread_rwlock_t modify_latch;
+};
+
+/* Holds the latches of a table for the scope of one operation */
+class TableAccess {
+    table_latch_t* latch;
+    int mode;
+
+    public:
+        TableAccess(int64_t table_id, int mode);
+        ~TableAccess();
+};
+
+/* Result of one vacuum run */
+struct vacuum_stats_t {
+    pagenum_t pages_before;         // table file size in pages
+    pagenum_t pages_after;
+    pagenum_t pages_moved;
+    pagenum_t leaf_count;
+    pagenum_t leaves_skipped;       // kept in place, a transaction holds record locks on them
+    pagenum_t leaf_runs_before;     // runs of leaves in consecutive pages along the key order
+    pagenum_t leaf_runs_after;
+
+    vacuum_stats_t();
+    /* bytes cut off the table file */
+    uint64_t reclaimed_bytes() const;
+    /* share of right sibling steps that go to the next page */
+    double sequential_ratio_before() const;
+    double sequential_ratio_after() const;
+    /* human readable report */
+    void print(std::ostream& os) const;
+};
+
+/* set up latches of an opened table, once */
+void init_table_latch(int64_t table_id);
+table_latch_t* get_table_latch(int64_t table_id);
+
+/* rewrite tree pages in order (internal nodes breadth first, then leaves in key order)
+ * into the lowest pages of the file and cut the free tail off. Returns 0 on success
+ */
+int vacuum_table(int64_t table_id, vacuum_stats_t* stats);
+
+#endif
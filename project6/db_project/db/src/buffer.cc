@@ -1,72 +1,246 @@
 #include "buffer.h"
+#include "log.h"
+
+#include <time.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <fstream>
+#include <set>
 
 BufferManager buffer_manager;
 pthread_mutex_t buffer_manager_latch;
 
-int total_cnt;
-int cache_hit;
+
+/* page accesses of current thread, tells correlated references apart */
+thread_local uint64_t thread_access_seq;
+
+/* Latches a thread took without waiting. Only the thread adds to them, so the
+ * common case touches no shared cache line; readers of the stats sum them up.
+ */
+struct uncontended_latches_t {
+    std::atomic<uint64_t> page;
+    std::atomic<uint64_t> partition;
+
+    uncontended_latches_t();
+    ~uncontended_latches_t();
+};
+pthread_mutex_t uncontended_latches_latch = PTHREAD_MUTEX_INITIALIZER;
+std::set<uncontended_latches_t*> live_uncontended_latches;
+uint64_t exited_page_latches, exited_partition_latches;     // threads that are gone
+thread_local uncontended_latches_t thread_uncontended_latches;
+
+uncontended_latches_t::uncontended_latches_t() {
+    page = partition = 0;
+    pthread_mutex_lock(&uncontended_latches_latch);
+    live_uncontended_latches.insert(this);
+    pthread_mutex_unlock(&uncontended_latches_latch);
+}
+uncontended_latches_t::~uncontended_latches_t() {
+    pthread_mutex_lock(&uncontended_latches_latch);
+    live_uncontended_latches.erase(this);
+    exited_page_latches += page;
+    exited_partition_latches += partition;
+    pthread_mutex_unlock(&uncontended_latches_latch);
+}
+/* sum of every thread's counts */
+static void sum_uncontended_latches(uint64_t* page, uint64_t* partition) {
+    pthread_mutex_lock(&uncontended_latches_latch);
+    *page = exited_page_latches;
+    *partition = exited_partition_latches;
+    for(uncontended_latches_t* counts : live_uncontended_latches) {
+        *page += counts->page.load(std::memory_order_relaxed);
+        *partition += counts->partition.load(std::memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&uncontended_latches_latch);
+}
+static void reset_uncontended_latches() {
+    pthread_mutex_lock(&uncontended_latches_latch);
+    exited_page_latches = exited_partition_latches = 0;
+    for(uncontended_latches_t* counts : live_uncontended_latches) counts->page = counts->partition = 0;
+    pthread_mutex_unlock(&uncontended_latches_latch);
+}
 
 buffer_t::buffer_t() {
+    frame = nullptr;
     table_id = -1;
     pagenum = -1;
     is_dirty = false;
-    page_latch = PTHREAD_MUTEX_INITIALIZER;
+    ref_bit = false;
+    in_probation = false;
+    last_accessor = nullptr;
+    last_access = 0;
+    is_prefetched = false;
+    page_type = PAGE_TYPE_HEADER;
+    rec_LSN = NO_REC_LSN;
+    pin_count = 0;
+    drop_pending = false;
+    pthread_rwlock_init(&page_latch, NULL);
     next = nullptr;
     prev = nullptr;
 }
 
+/************************************************************************/
+// * BUFFER STATISTICS                                                  //
+/************************************************************************/
+
+static const char* page_type_names[NUM_PAGE_TYPES] = {"header", "internal", "leaf"};
+
+buffer_table_stats_t::buffer_table_stats_t() {
+    memset(hits, 0, sizeof(hits));
+    memset(misses, 0, sizeof(misses));
+    memset(evictions, 0, sizeof(evictions));
+    memset(write_backs, 0, sizeof(write_backs));
+}
+void buffer_table_stats_t::add(const buffer_table_stats_t& other) {
+    for(int i = 0; i < NUM_PAGE_TYPES; ++i) {
+        hits[i] += other.hits[i];
+        misses[i] += other.misses[i];
+        evictions[i] += other.evictions[i];
+        write_backs[i] += other.write_backs[i];
+    }
+}
+
+buffer_stats_t::buffer_stats_t() {
+    frame_count = partition_count = 0;
+    prefetch_issued = prefetch_hits = 0;
+    memset(page_latch_waits, 0, sizeof(page_latch_waits));
+    memset(partition_latch_waits, 0, sizeof(partition_latch_waits));
+}
+buffer_table_stats_t buffer_stats_t::total() const {
+    buffer_table_stats_t sum;
+    for(auto& table : tables) sum.add(table.second);
+    return sum;
+}
+double buffer_stats_t::hit_rate() const {
+    buffer_table_stats_t sum = total();
+    uint64_t hits = 0, reads = 0;
+    for(int i = 0; i < NUM_PAGE_TYPES; ++i) {
+        hits += sum.hits[i];
+        reads += sum.hits[i] + sum.misses[i];
+    }
+    return reads == 0 ? 0.0 : (double)hits / reads;
+}
+double buffer_stats_t::prefetch_hit_rate() const {
+    return prefetch_issued == 0 ? 0.0 : (double)prefetch_hits / prefetch_issued;
+}
+static void print_wait_histogram(std::ostream& os, const char* name, const uint64_t* histogram) {
+    os << name << " wait (us):";
+    for(int i = 0; i < LATCH_WAIT_BUCKETS; ++i) {
+        if(histogram[i] == 0) continue;
+        if(i == 0) os << " none " << histogram[i];
+        else if(i == LATCH_WAIT_BUCKETS - 1) os << " >=" << (1ULL << (i - 1)) << " " << histogram[i];
+        else os << " <" << (1ULL << i) << " " << histogram[i];
+    }
+    os << std::endl;
+}
+void buffer_stats_t::print(std::ostream& os) const {
+    os << "buffer pool: " << frame_count << " frames, " << partition_count << " partitions, hit rate "
+       << hit_rate() << ", prefetch hit rate " << prefetch_hit_rate() << std::endl;
+    for(auto& table : tables) {
+        for(int i = 0; i < NUM_PAGE_TYPES; ++i) {
+            const buffer_table_stats_t& s = table.second;
+            if(s.hits[i] + s.misses[i] + s.evictions[i] + s.write_backs[i] == 0) continue;
+            os << "  table " << table.first << " " << page_type_names[i]
+               << ": hits " << s.hits[i] << ", misses " << s.misses[i]
+               << ", evictions " << s.evictions[i] << ", write backs " << s.write_backs[i] << std::endl;
+        }
+    }
+    print_wait_histogram(os, "  page latch", page_latch_waits);
+    print_wait_histogram(os, "  partition latch", partition_latch_waits);
+}
+
+/************************************************************************/
+// * BUFFER PARTITION                                                   //
+/************************************************************************/
+
 /* private */
-void BufferManager::set_buf(buffer_t* buf, int64_t table_id, pagenum_t pagenum) {
+void BufferPartition::set_buf(buffer_t* buf, int64_t table_id, pagenum_t pagenum) {
     buf->table_id = table_id;
     buf->pagenum = pagenum;
 }
-void BufferManager::move_to_head(buffer_t* buf) {
+void BufferPartition::move_to_head(buffer_t* buf) {
+    unlink(buf);
+    link_after(buf_head, buf);
+}
+void BufferPartition::insert_into_head(buffer_t* buf) {
+    link_after(buf_head, buf);
+}
+void BufferPartition::unlink(buffer_t* buf) {
     buf->prev->next = buf->next;
     buf->next->prev = buf->prev;
-    buf->next = buf_head->next;
-    buf->prev = buf_head;
-    buf_head->next->prev = buf;
-    buf_head->next = buf;
 }
-void BufferManager::insert_into_head(buffer_t* buf) {
-    buf->next = buf_head->next;
-    buf->prev = buf_head;
-    buf_head->next->prev = buf;
-    buf_head->next = buf;
+void BufferPartition::link_after(buffer_t* head, buffer_t* buf) {
+    buf->next = head->next;
+    buf->prev = head;
+    head->next->prev = buf;
+    head->next = buf;
 }
-int64_t BufferManager::convert_pair_to_key(int64_t table_id, pagenum_t pagenum) { return (table_id << 32LL) | pagenum; }
-
-// * BELOW FUNCTIONS ARE MODIFIED FOR PROJECT 5 *
+int BufferPartition::clean_window() {
+    return std::max(1, max_count * CLEANER_CLEAN_PERCENT / 100);
+}
+buffer_t* BufferPartition::find_list_victim(buffer_t* head, buffer_t* tail, buffer_t** dirty_victim) {
+    buffer_t* cur_buf = tail->prev;
+    int scanned = 0;
 
-void BufferManager::flush_buffer(buffer_t* buf) {
-    if(buf->is_dirty) {
-        file_write_page(buf->table_id, buf->pagenum, (page_t*)buf->frame);
-        buf->is_dirty = false;
+    // prefer a clean frame, give up on it once the cleaned window is passed
+    while(cur_buf != head) {
+        if(cur_buf->pin_count == 0) {
+            if(!cur_buf->is_dirty) return cur_buf;
+            if(*dirty_victim == nullptr) *dirty_victim = cur_buf;
+        }
+        if(*dirty_victim != nullptr && ++scanned >= clean_window()) break;
+        cur_buf = cur_buf->prev;
     }
+
+    return nullptr;
 }
-void BufferManager::flush_buffer(int64_t table_id, pagenum_t pagenum) {
-    if(!is_buffer_exist(table_id, pagenum)) return;
-    
-    buffer_t* cur_buf = find_buffer(table_id, pagenum);
-    if(cur_buf->is_dirty) {
-        file_write_page(table_id, pagenum, (page_t*)cur_buf->frame);
-        cur_buf->is_dirty = false;
+buffer_t* BufferPartition::find_victim() {
+    buffer_t* victim = nullptr;
+    buffer_t* dirty_victim = nullptr;
+
+    if(policy == BUFFER_POLICY_2Q) {
+        // probationary queue gives up frames first while it is over its share
+        bool probation_first = a1_count > a1_max_count();
+        if(probation_first) victim = find_list_victim(a1_head, a1_tail, &dirty_victim);
+        if(victim == nullptr) victim = find_list_victim(buf_head, buf_tail, &dirty_victim);
+        if(victim == nullptr && !probation_first) victim = find_list_victim(a1_head, a1_tail, &dirty_victim);
     }
+    else victim = find_list_victim(buf_head, buf_tail, &dirty_victim);
+    if(victim != nullptr) return victim;
+
+    if(dirty_victim != nullptr) {
+        buffer_manager.wake_cleaner();
+        return dirty_victim;
+    }
+
+    std::cerr << "ERROR : Eviction failed. No victim buffer found. (All pinned)" << std::endl;
+    exit(EXIT_FAILURE);
+
+    return nullptr;
 }
-bool BufferManager::is_buffer_exist(int64_t table_id, pagenum_t pagenum) {
-    int64_t key = convert_pair_to_key(table_id, pagenum);
-    return hash_pointer.find(key) != hash_pointer.end();
-}
-buffer_t* BufferManager::find_buffer(int64_t table_id, pagenum_t pagenum) {
-    int64_t key = convert_pair_to_key(table_id, pagenum);
-    return hash_pointer[key];
-}
-buffer_t* BufferManager::find_victim() {
-    buffer_t* cur_buf = buf_tail->prev;
+buffer_t* BufferPartition::find_clock_victim() {
+    buffer_t* dirty_victim = nullptr;
+    int scanned = 0;
 
-    while(cur_buf != buf_head) {
-        if(pthread_mutex_trylock(&cur_buf->page_latch) == 0) return cur_buf;
-        cur_buf = cur_buf->prev;
+    // two sweeps: the first one may only clear reference bits
+    for(int i = 0; i < 2 * max_count; ++i) {
+        buffer_t* cur_buf = buf_pool[clock_hand];
+        clock_hand = (clock_hand + 1) % max_count;
+
+        if(cur_buf->ref_bit) {
+            cur_buf->ref_bit = false;
+            continue;
+        }
+        if(cur_buf->pin_count == 0) {
+            if(!cur_buf->is_dirty) return cur_buf;
+            if(dirty_victim == nullptr) dirty_victim = cur_buf;
+        }
+        if(dirty_victim != nullptr && ++scanned >= clean_window()) break;
+    }
+
+    if(dirty_victim != nullptr) {
+        buffer_manager.wake_cleaner();
+        return dirty_victim;
     }
 
     std::cerr << "ERROR : Eviction failed. No victim buffer found. (All pinned)" << std::endl;
@@ -75,8 +249,103 @@ buffer_t* BufferManager::find_victim() {
     return nullptr;
 }
 
+buffer_t* BufferPartition::find_clean_victim() {
+    int window = clean_window();
+
+    if(policy == BUFFER_POLICY_CLOCK) {
+        for(int i = 0; i < window; ++i) {
+            buffer_t* cur_buf = buf_pool[(clock_hand + i) % max_count];
+            if(!cur_buf->ref_bit && !cur_buf->is_dirty && cur_buf->pin_count == 0) return cur_buf;
+        }
+        return nullptr;
+    }
+
+    // 2Q: read-ahead pages are probationary, they never push main queue frames out
+    if(policy == BUFFER_POLICY_2Q) return find_clean_in_list(a1_head, a1_tail);
+    return find_clean_in_list(buf_head, buf_tail);
+}
+buffer_t* BufferPartition::find_clean_in_list(buffer_t* head, buffer_t* tail) {
+    buffer_t* cur_buf = tail->prev;
+    for(int i = 0; i < clean_window() && cur_buf != head; ++i) {
+        if(!cur_buf->is_dirty && cur_buf->pin_count == 0) return cur_buf;
+        cur_buf = cur_buf->prev;
+    }
+    return nullptr;
+}
+bool BufferPartition::is_correlated(buffer_t* buf) {
+    /* re-reference by the same thread within a few page accesses belongs to
+     * the same operation (e.g. find_leaf then read of that leaf).
+     */
+    return buf->last_accessor == &thread_access_seq
+        && thread_access_seq - buf->last_access < CORRELATED_REFERENCE_GAP;
+}
+void BufferPartition::stamp_access(buffer_t* buf) {
+    buf->last_accessor = &thread_access_seq;
+    buf->last_access = ++thread_access_seq;
+}
+int BufferPartition::a1_max_count() {
+    return std::max(1, max_count * PROBATION_PERCENT / 100);
+}
+void BufferPartition::remember_ghost(int64_t key) {
+    a1_ghosts.push_front(key);
+    a1_ghost_index[key] = a1_ghosts.begin();
+    if((int)a1_ghosts.size() > max_count * GHOST_PERCENT / 100) {
+        a1_ghost_index.erase(a1_ghosts.back());
+        a1_ghosts.pop_back();
+    }
+}
+bool BufferPartition::forget_ghost(int64_t key) {
+    auto it = a1_ghost_index.find(key);
+    if(it == a1_ghost_index.end()) return false;
+    a1_ghosts.erase(it->second);
+    a1_ghost_index.erase(it);
+    return true;
+}
+buffer_t* BufferPartition::take_unused_frame() {
+    buffer_t* new_buf = buf_pool[cur_count++];
+    if(policy == BUFFER_POLICY_LRU) insert_into_head(new_buf);
+    return new_buf;
+}
+void BufferPartition::recycle_frame(buffer_t* buf) {
+    bool is_mapped = find_buffer(buf->table_id, buf->pagenum) == buf;
+    if(is_mapped) {
+        hash_pointer.erase(convert_pair_to_key(buf->table_id, buf->pagenum));
+        stats_of(buf->table_id).evictions[buf->page_type]++;
+    }
+    if(policy == BUFFER_POLICY_LRU) move_to_head(buf);
+    if(policy == BUFFER_POLICY_2Q) {
+        unlink(buf);
+        if(buf->in_probation) {
+            a1_count--;
+            // referenced again soon after leaving probation -> main queue
+            if(is_mapped) remember_ghost(convert_pair_to_key(buf->table_id, buf->pagenum));
+        }
+    }
+    buf->is_prefetched = false;
+}
+void BufferPartition::map_frame(buffer_t* buf, int64_t table_id, pagenum_t pagenum) {
+    int64_t key = convert_pair_to_key(table_id, pagenum);
+
+    buf->pin_count++;
+    stamp_access(buf);
+    set_buf(buf, table_id, pagenum);
+    hash_pointer.insert({key, buf});
+
+    if(policy == BUFFER_POLICY_2Q) {
+        buf->in_probation = !forget_ghost(key);
+        if(buf->in_probation) {
+            link_after(a1_head, buf);
+            a1_count++;
+        }
+        else link_after(buf_head, buf);
+    }
+}
+buffer_table_stats_t& BufferPartition::stats_of(int64_t table_id) {
+    return table_stats[table_id];
+}
+
 /* public */
-BufferManager::BufferManager() {
+BufferPartition::BufferPartition(int max_count, int policy, char* frames) {
     buf_head = new buffer_t();
     buf_tail = new buffer_t();
 
@@ -84,58 +353,756 @@ BufferManager::BufferManager() {
     buf_tail->prev = buf_head;
 
     buf_head->prev = buf_tail->next = nullptr;
-    max_count = cur_count = 0;
+
+    a1_head = new buffer_t();
+    a1_tail = new buffer_t();
+    a1_head->next = a1_tail;
+    a1_tail->prev = a1_head;
+    a1_head->prev = a1_tail->next = nullptr;
+    a1_count = 0;
+
+    this->cur_count = 0;
+    this->max_count = max_count;
+    this->policy = policy;
+    this->clock_hand = 0;
+    this->prefetch_pinned = 0;
+    this->prefetch_issued = 0;
+    this->prefetch_hits = 0;
+    frame_meta = new buffer_t[max_count];
+    buf_pool.resize(max_count);
+    for(int i = 0; i < max_count; ++i) {
+        frame_meta[i].frame = frames + (size_t)i * PAGE_SIZE;
+        buf_pool[i] = &frame_meta[i];
+    }
+
+    partition_latch = PTHREAD_MUTEX_INITIALIZER;
 }
 
-BufferManager::~BufferManager() {
-    std::cout << "total cnt : " << total_cnt << std::endl;
-    std::cout << "cache hit : " << cache_hit << std::endl;
+BufferPartition::~BufferPartition() {
+    for(int i = 0; i < max_count; ++i)
+        pthread_rwlock_destroy(&frame_meta[i].page_latch);
+    delete[] frame_meta;
     delete buf_head;
     delete buf_tail;
+    delete a1_head;
+    delete a1_tail;
+}
+
+int64_t BufferPartition::convert_pair_to_key(int64_t table_id, pagenum_t pagenum) { return (table_id << 32LL) | pagenum; }
+int BufferPartition::classify_page(buffer_t* buf) {
+    if(buf->pagenum == 0) return PAGE_TYPE_HEADER;
+    return page_io::is_leaf((page_t*)buf->frame) ? PAGE_TYPE_LEAF : PAGE_TYPE_INTERNAL;
+}
+
+bool BufferPartition::is_buffer_exist(int64_t table_id, pagenum_t pagenum) {
+    int64_t key = convert_pair_to_key(table_id, pagenum);
+    return hash_pointer.find(key) != hash_pointer.end();
+}
+buffer_t* BufferPartition::find_buffer(int64_t table_id, pagenum_t pagenum) {
+    int64_t key = convert_pair_to_key(table_id, pagenum);
+    auto it = hash_pointer.find(key);
+    return (it == hash_pointer.end()) ? nullptr : it->second;
+}
+
+void BufferPartition::touch_buffer(buffer_t* buf) {
+    stats_of(buf->table_id).hits[buf->page_type]++;
+    buf->pin_count++;
+    // a dropped page read before its last unpin was allocated again, it stays
+    buf->drop_pending = false;
+
+    // read-ahead isn't a reference, the first real one comes now
+    bool correlated = buf->is_prefetched || is_correlated(buf);
+    stamp_access(buf);
+    if(buf->is_prefetched) {
+        buf->is_prefetched = false;
+        prefetch_hits++;
+    }
+
+    if(policy == BUFFER_POLICY_CLOCK) buf->ref_bit = true;
+    else if(policy == BUFFER_POLICY_LRU || !buf->in_probation) move_to_head(buf);
+    // 2Q: probationary frames stay in FIFO order until an uncorrelated re-reference
+    else if(!correlated) {
+        unlink(buf);
+        a1_count--;
+        buf->in_probation = false;
+        link_after(buf_head, buf);
+    }
+}
+
+buffer_t* BufferPartition::begin_load(int64_t table_id, pagenum_t pagenum, buffer_t** dirty_victim) {
+    buffer_t* new_buf;
+
+    /* when partition is full */
+    if(cur_count == max_count) {
+        new_buf = (policy == BUFFER_POLICY_CLOCK) ? find_clock_victim() : find_victim();
+        // written back by the caller without this latch
+        if(new_buf->is_dirty) {
+            *dirty_victim = new_buf;
+            return nullptr;
+        }
+        recycle_frame(new_buf);
+    }
+    /* partition is not full */
+    else new_buf = take_unused_frame();
+    new_buf->ref_bit = true;
+
+    map_frame(new_buf, table_id, pagenum);
+    // unpinned frames are never latched, readers of the page wait here until it lands
+    pthread_rwlock_wrlock(&new_buf->page_latch);
+
+    return new_buf;
+}
+void BufferPartition::end_load(buffer_t* buf) {
+    buf->page_type = classify_page(buf);
+    stats_of(buf->table_id).misses[buf->page_type]++;
+}
+
+buffer_t* BufferPartition::reserve_prefetch_frame(int64_t table_id, pagenum_t pagenum) {
+    // leave most frames to foreground pins
+    if(prefetch_pinned >= max_count / 2) return nullptr;
+
+    buffer_t* new_buf;
+    if(cur_count == max_count) {
+        // never write back for a page that may not be used
+        new_buf = find_clean_victim();
+        if(new_buf == nullptr) return nullptr;
+        recycle_frame(new_buf);
+    }
+    else new_buf = take_unused_frame();
+    new_buf->ref_bit = false;
+
+    map_frame(new_buf, table_id, pagenum);
+    new_buf->is_prefetched = true;
+    // read-ahead only follows leaves, corrected once the page lands
+    new_buf->page_type = PAGE_TYPE_LEAF;
+    prefetch_pinned++;
+
+    return new_buf;
+}
+
+void BufferPartition::end_prefetch(buffer_t* buf) {
+    buf->page_type = classify_page(buf);
+    prefetch_issued++;
+    prefetch_pinned--;
+    buf->pin_count--;
+    finish_drop(buf);
+}
+
+void BufferPartition::collect_dirty(std::vector<buffer_t*>& batch) {
+    // nothing is evicted before the partition is full
+    if(cur_count < max_count) return;
+
+    if(policy == BUFFER_POLICY_CLOCK) {
+        for(int i = 0; i < clean_window() && (int)batch.size() < CLEANER_BATCH_SIZE; ++i) {
+            buffer_t* cur_buf = buf_pool[(clock_hand + i) % max_count];
+            if(cur_buf->is_dirty && cur_buf->pin_count == 0) {
+                cur_buf->pin_count++;
+                batch.push_back(cur_buf);
+            }
+        }
+        return;
+    }
+
+    if(policy == BUFFER_POLICY_2Q) collect_dirty_in_list(a1_head, a1_tail, batch);
+    collect_dirty_in_list(buf_head, buf_tail, batch);
+}
+void BufferPartition::collect_dirty_in_list(buffer_t* head, buffer_t* tail, std::vector<buffer_t*>& batch) {
+    buffer_t* cur_buf = tail->prev;
+    for(int i = 0; i < clean_window() && cur_buf != head && (int)batch.size() < CLEANER_BATCH_SIZE; ++i) {
+        if(cur_buf->is_dirty && cur_buf->pin_count == 0) {
+            cur_buf->pin_count++;
+            batch.push_back(cur_buf);
+        }
+        cur_buf = cur_buf->prev;
+    }
+}
+
+void BufferPartition::drop_buffer(int64_t table_id, pagenum_t pagenum) {
+    buffer_t* cur_buf = find_buffer(table_id, pagenum);
+    if(cur_buf == nullptr) return;
+
+    cur_buf->is_dirty = false;
+    cur_buf->rec_LSN = NO_REC_LSN;
+    // the page cleaner or a reader may still hold it, it goes with the last unpin
+    cur_buf->drop_pending = true;
+    finish_drop(cur_buf);
+}
+void BufferPartition::finish_drop(buffer_t* buf) {
+    if(!buf->drop_pending || buf->pin_count > 0) return;
+
+    buf->drop_pending = false;
+    hash_pointer.erase(convert_pair_to_key(buf->table_id, buf->pagenum));
+    set_buf(buf, -1, -1);
+}
+
+void BufferPartition::drop_table_tail(int64_t table_id, pagenum_t from) {
+    for(int i = 0; i < cur_count; ++i) {
+        buffer_t* cur_buf = buf_pool[i];
+        if(cur_buf->table_id == table_id && cur_buf->pagenum >= from) drop_buffer(table_id, cur_buf->pagenum);
+    }
+}
+
+void BufferPartition::collect_all_dirty(std::vector<buffer_t*>& frames) {
+    for(int i = 0; i < cur_count; ++i)
+        if(buf_pool[i]->is_dirty) frames.push_back(buf_pool[i]);
+}
+void BufferPartition::collect_dirty_pages(std::vector<dirty_page_t>& pages) {
+    for(int i = 0; i < cur_count; ++i) {
+        buffer_t* buf = buf_pool[i];
+        if(buf->is_dirty && buf->rec_LSN != NO_REC_LSN) pages.push_back({buf->table_id, buf->pagenum, buf->rec_LSN});
+    }
+}
+void BufferPartition::collect_dirty_before(uint64_t LSN, std::vector<buffer_t*>& batch) {
+    for(int i = 0; i < cur_count; ++i) {
+        buffer_t* buf = buf_pool[i];
+        if(buf->is_dirty && buf->pin_count == 0 && buf->rec_LSN < LSN) {
+            buf->pin_count++;
+            batch.push_back(buf);
+        }
+    }
+}
+void BufferPartition::collect_table_dirty(int64_t table_id, std::vector<buffer_t*>& batch) {
+    for(int i = 0; i < cur_count; ++i) {
+        buffer_t* buf = buf_pool[i];
+        if(buf->is_dirty && buf->pin_count == 0 && buf->table_id == table_id) {
+            buf->pin_count++;
+            batch.push_back(buf);
+        }
+    }
+}
+void BufferPartition::count_write_back(buffer_t* buf) {
+    buf->page_type = classify_page(buf);
+    stats_of(buf->table_id).write_backs[buf->page_type]++;
+}
+void BufferPartition::merge_stats(buffer_stats_t& stats) {
+    for(auto& table : table_stats) stats.tables[table.first].add(table.second);
+    stats.prefetch_issued += prefetch_issued;
+    stats.prefetch_hits += prefetch_hits;
+}
+void BufferPartition::reset_stats() {
+    table_stats.clear();
+    prefetch_issued = prefetch_hits = 0;
+}
+
+/************************************************************************/
+// * BUFFER MANAGER                                                     //
+/************************************************************************/
+
+/* private */
+BufferPartition* BufferManager::get_partition(int64_t table_id, pagenum_t pagenum) {
+    // fibonacci hashing spreads consecutive pages over partitions
+    uint64_t key = (uint64_t)BufferPartition::convert_pair_to_key(table_id, pagenum);
+    uint64_t hash = (key * 0x9E3779B97F4A7C15ULL) >> 32;
+    return partitions[hash % partitions.size()];
+}
+void BufferManager::lock_partition(BufferPartition* part) {
+    if(pthread_mutex_trylock(&part->partition_latch) == 0) {
+        thread_uncontended_latches.partition.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_mutex_lock(&part->partition_latch);
+    record_wait(partition_latch_waits, start);
+}
+void BufferManager::lock_page(buffer_t* buf, int latch_mode) {
+    bool shared = latch_mode == PAGE_LATCH_SHARED;
+    if((shared ? pthread_rwlock_tryrdlock(&buf->page_latch) : pthread_rwlock_trywrlock(&buf->page_latch)) == 0) {
+        thread_uncontended_latches.page.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(shared) pthread_rwlock_rdlock(&buf->page_latch);
+    else pthread_rwlock_wrlock(&buf->page_latch);
+    record_wait(page_latch_waits, start);
+}
+void BufferManager::record_wait(std::atomic<uint64_t>* histogram, const timespec& start) {
+    timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t wait_us = (end.tv_sec - start.tv_sec) * 1000000ULL + (end.tv_nsec - start.tv_nsec) / 1000;
+
+    // bucket i holds [2^(i-1), 2^i) us
+    int bucket = 1;
+    while(bucket < LATCH_WAIT_BUCKETS - 1 && wait_us >= (1ULL << bucket)) bucket++;
+    histogram[bucket]++;
 }
+pagenum_t BufferManager::take_free_page(int64_t table_id, page_t* header_page, pagenum_t hint) {
+    pagenum_t page_cnt = page_io::header::get_page_count(header_page);
+    uint64_t group_cnt = page_io::header::get_bitmap_count(header_page);
+    if(hint >= page_cnt) hint = 0;
 
-void BufferManager::init_buf(int max_count) { 
+    // start at the hint's group and go forward, pages near the hint first
+    for(uint64_t i = 0; i < group_cnt; ++i) {
+        uint64_t group = (hint / PAGES_PER_BITMAP + i) % group_cnt;
+        uint32_t from = (i == 0) ? hint % PAGES_PER_BITMAP : 0;
+        pagenum_t bitmap_page_num = page_io::header::get_bitmap_page(header_page, group);
+
+        buffer_t* bitmap_buf = buffer_read_page(table_id, bitmap_page_num);
+        int64_t idx = page_io::bitmap::find_free((page_t*)bitmap_buf->frame, from, page_io::header::get_group_size(header_page, group));
+        if(idx >= 0) {
+            page_io::bitmap::set_used((page_t*)bitmap_buf->frame, idx);
+            bitmap_buf->is_dirty = true;
+        }
+        unpin_buffer(table_id, bitmap_page_num);
+
+        if(idx >= 0) return group * PAGES_PER_BITMAP + idx;
+    }
+    return 0;
+}
+void BufferManager::dump_stats_if_due() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&stats_dump_latch);
+    int64_t elapsed_ms = (now.tv_sec - last_stats_dump.tv_sec) * 1000LL + (now.tv_nsec - last_stats_dump.tv_nsec) / 1000000LL;
+    bool is_due = stats_dump_interval_ms > 0 && elapsed_ms >= stats_dump_interval_ms;
+    if(is_due) last_stats_dump = now;
+    pthread_mutex_unlock(&stats_dump_latch);
+
+    if(is_due) dump_stats();
+}
+bool BufferManager::alloc_arena(size_t frame_count) {
+    arena_size = frame_count * PAGE_SIZE;
+    arena_huge = false;
+
+    if(use_huge_pages) {
+        // reserved huge pages first, then ask for transparent ones
+        size_t huge_size = (arena_size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        void* ptr = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(ptr != MAP_FAILED) {
+            arena = (char*)ptr;
+            arena_size = huge_size;
+            arena_huge = true;
+            return true;
+        }
+        arena_size = huge_size;
+    }
+
+    // anonymous mapping is page aligned, as O_DIRECT wants
+    void* ptr = mmap(NULL, arena_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(ptr == MAP_FAILED) {
+        arena = nullptr;
+        arena_size = 0;
+        return false;
+    }
+    arena = (char*)ptr;
+    if(use_huge_pages) arena_huge = madvise(arena, arena_size, MADV_HUGEPAGE) == 0;
+    return true;
+}
+void BufferManager::free_arena() {
+    if(arena == nullptr) return;
+    munmap(arena, arena_size);
+    arena = nullptr;
+    arena_size = 0;
+    arena_huge = false;
+}
+void* BufferManager::cleaner_main(void* arg) {
+    BufferManager* manager = (BufferManager*)arg;
+    int rounds = 0;
+
+    pthread_mutex_lock(&manager->cleaner_latch);
+    while(manager->cleaner_running) {
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += CLEANER_INTERVAL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&manager->cleaner_cond, &manager->cleaner_latch, &deadline);
+        if(!manager->cleaner_running) break;
+
+        pthread_mutex_unlock(&manager->cleaner_latch);
+        manager->clean_partitions();
+        manager->dump_stats_if_due();
+        // periodic checkpoint of table files (no-op unless DURABILITY_CHECKPOINT)
+        if(++rounds % CLEANER_SYNC_ROUNDS == 0) file_checkpoint_table_files();
+        pthread_mutex_lock(&manager->cleaner_latch);
+    }
+    pthread_mutex_unlock(&manager->cleaner_latch);
+
+    return NULL;
+}
+void BufferManager::clean_partitions() {
+    for(BufferPartition* part : partitions) {
+        std::vector<buffer_t*> batch;
+
+        pthread_mutex_lock(&part->partition_latch);
+        part->collect_dirty(batch);
+        pthread_mutex_unlock(&part->partition_latch);
+
+        if(!batch.empty()) write_batch(batch);
+    }
+}
+void BufferManager::write_batch(std::vector<buffer_t*>& batch) {
+    /* frames are pinned, so they stay mapped. a page latched exclusively is
+     * still being modified; skip it rather than wait (we may hold other
+     * latches of this batch and must not get into the B+ tree latch order).
+     */
+    std::vector<buffer_t*> latched;
+    for(buffer_t* buf : batch) {
+        if(pthread_rwlock_tryrdlock(&buf->page_latch) == 0) latched.push_back(buf);
+        else release_pin(get_partition(buf->table_id, buf->pagenum), buf);
+    }
+
+    // recovery holds the log latch while it latches pages; don't wait for it either
+    bool log_forced = false;
+    if(!latched.empty() && pthread_mutex_trylock(&log_buffer_manager_latch) == 0) {
+        // write-ahead: log records of these pages reach the disk first
+        log_buf_manager.flush_logs();
+        pthread_mutex_unlock(&log_buffer_manager_latch);
+        log_forced = true;
+    }
+
+    std::vector<buffer_t*> dirty;
+    for(buffer_t* buf : latched)
+        if(log_forced && buf->is_dirty) dirty.push_back(buf);
+    write_frames(dirty);
+
+    // a batch comes from one partition
+    if(!dirty.empty()) {
+        BufferPartition* part = get_partition(dirty[0]->table_id, dirty[0]->pagenum);
+        pthread_mutex_lock(&part->partition_latch);
+        for(buffer_t* buf : dirty) part->count_write_back(buf);
+        pthread_mutex_unlock(&part->partition_latch);
+    }
+
+    for(buffer_t* buf : latched) {
+        pthread_rwlock_unlock(&buf->page_latch);
+        release_pin(get_partition(buf->table_id, buf->pagenum), buf);
+    }
+}
+void BufferManager::write_frames(std::vector<buffer_t*>& frames) {
+    if(frames.empty()) return;
+
+    std::sort(frames.begin(), frames.end(), [](buffer_t* a, buffer_t* b) {
+        if(a->table_id != b->table_id) return a->table_id < b->table_id;
+        return a->pagenum < b->pagenum;
+    });
+
+    std::vector<file_io_req_t> reqs;
+    for(buffer_t* buf : frames)
+        reqs.push_back({buf->table_id, buf->pagenum, (page_t*)buf->frame});
+    file_write_pages(reqs);
+
+    for(buffer_t* buf : frames) {
+        buf->is_dirty = false;
+        buf->rec_LSN = NO_REC_LSN;
+    }
+}
+void* BufferManager::prefetcher_main(void* arg) {
+    BufferManager* manager = (BufferManager*)arg;
+
+    pthread_mutex_lock(&manager->prefetch_latch);
+    while(manager->prefetcher_running) {
+        while(manager->prefetcher_running && manager->prefetch_queue.empty())
+            pthread_cond_wait(&manager->prefetch_cond, &manager->prefetch_latch);
+        if(!manager->prefetcher_running) break;
+
+        std::vector<std::pair<int64_t, pagenum_t>> pages;
+        while(!manager->prefetch_queue.empty() && pages.size() < PREFETCH_MAX_PAGES) {
+            pages.push_back(manager->prefetch_queue.front());
+            manager->prefetch_queue.pop_front();
+        }
+
+        pthread_mutex_unlock(&manager->prefetch_latch);
+        manager->prefetch_pages(pages);
+        pthread_mutex_lock(&manager->prefetch_latch);
+    }
+    pthread_mutex_unlock(&manager->prefetch_latch);
+
+    return NULL;
+}
+void BufferManager::prefetch_pages(std::vector<std::pair<int64_t, pagenum_t>>& pages) {
+    std::vector<buffer_t*> frames;
+    std::vector<file_io_req_t> reqs;
+
+    for(auto& page : pages) {
+        BufferPartition* part = get_partition(page.first, page.second);
+
+        pthread_mutex_lock(&part->partition_latch);
+        buffer_t* buf = nullptr;
+        if(!part->is_buffer_exist(page.first, page.second))
+            buf = part->reserve_prefetch_frame(page.first, page.second);
+        // nobody else can hold the latch of a frame that just got mapped
+        if(buf != nullptr) pthread_rwlock_wrlock(&buf->page_latch);
+        pthread_mutex_unlock(&part->partition_latch);
+
+        if(buf == nullptr) continue;
+        frames.push_back(buf);
+        reqs.push_back({page.first, page.second, (page_t*)buf->frame});
+    }
+    if(frames.empty()) return;
+
+    // readers of these pages wait on the page latch until the batch lands
+    file_read_pages(reqs);
+
+    for(buffer_t* buf : frames) {
+        BufferPartition* part = get_partition(buf->table_id, buf->pagenum);
+        pthread_rwlock_unlock(&buf->page_latch);
+        pthread_mutex_lock(&part->partition_latch);
+        part->end_prefetch(buf);
+        pthread_mutex_unlock(&part->partition_latch);
+    }
+}
+void BufferManager::start_prefetcher() {
+    prefetcher_running = true;
+    pthread_create(&prefetcher_thread, NULL, prefetcher_main, this);
+}
+void BufferManager::stop_prefetcher() {
+    pthread_mutex_lock(&prefetch_latch);
+    if(!prefetcher_running) {
+        pthread_mutex_unlock(&prefetch_latch);
+        return;
+    }
+    prefetcher_running = false;
+    prefetch_queue.clear();
+    pthread_cond_broadcast(&prefetch_cond);
+    pthread_mutex_unlock(&prefetch_latch);
+
+    pthread_join(prefetcher_thread, NULL);
+}
+void BufferManager::start_cleaner() {
+    cleaner_running = true;
+    pthread_create(&cleaner_thread, NULL, cleaner_main, this);
+}
+void BufferManager::stop_cleaner() {
+    pthread_mutex_lock(&cleaner_latch);
+    if(!cleaner_running) {
+        pthread_mutex_unlock(&cleaner_latch);
+        return;
+    }
+    cleaner_running = false;
+    pthread_cond_broadcast(&cleaner_cond);
+    pthread_mutex_unlock(&cleaner_latch);
+
+    pthread_join(cleaner_thread, NULL);
+}
+
+/* public */
+BufferManager::BufferManager() {
+    max_count = 0;
+    arena = nullptr;
+    arena_size = 0;
+    use_huge_pages = false;
+    arena_huge = false;
+    cleaner_running = false;
+    cleaner_latch = PTHREAD_MUTEX_INITIALIZER;
+    cleaner_cond = PTHREAD_COND_INITIALIZER;
+    prefetcher_running = false;
+    prefetch_latch = PTHREAD_MUTEX_INITIALIZER;
+    prefetch_cond = PTHREAD_COND_INITIALIZER;
+    for(int i = 0; i < LATCH_WAIT_BUCKETS; ++i) page_latch_waits[i] = partition_latch_waits[i] = 0;
+    stats_dump_latch = PTHREAD_MUTEX_INITIALIZER;
+    stats_dump_interval_ms = 0;
+    clock_gettime(CLOCK_MONOTONIC, &last_stats_dump);
+}
+
+BufferManager::~BufferManager() {
+    stop_prefetcher();
+    stop_cleaner();
+    for(BufferPartition* part : partitions) delete part;
+    free_arena();
+}
+
+int BufferManager::init_buf(int max_count, int policy, int num_partitions) {
+    // a pool left by a run that never shut down is dropped unwritten, as a crash would
+    stop_prefetcher();
+    stop_cleaner();
     pthread_mutex_lock(&buffer_manager_latch);
+    for(BufferPartition* part : partitions) delete part;
+    partitions.clear();
+    free_arena();
+
+    if(num_partitions <= 0) {
+        num_partitions = std::min(DEFAULT_BUFFER_PARTITIONS, max_count / MIN_FRAMES_PER_PARTITION);
+        num_partitions = std::max(num_partitions, 1);
+    }
+
+    if(!alloc_arena(max_count)) {
+        pthread_mutex_unlock(&buffer_manager_latch);
+        return -1;
+    }
 
-    this->cur_count = 0;
     this->max_count = max_count;
-    buf_pool.resize(max_count);
-    for(int i = 0; i < max_count; ++i) 
-        buf_pool[i] = new buffer_t();
+    for(int i = 0; i < LATCH_WAIT_BUCKETS; ++i) page_latch_waits[i] = partition_latch_waits[i] = 0;
+    reset_uncontended_latches();
+    partitions.resize(num_partitions);
+    char* frames = arena;
+    for(int i = 0; i < num_partitions; ++i) {
+        // spread remainder frames over the first partitions
+        int part_count = max_count / num_partitions + (i < max_count % num_partitions);
+        partitions[i] = new BufferPartition(part_count, policy, frames);
+        frames += (size_t)part_count * PAGE_SIZE;
+    }
+    start_cleaner();
+    start_prefetcher();
+
+    pthread_mutex_unlock(&buffer_manager_latch);
+    return 0;
+}
+
+void BufferManager::buffer_prefetch(int64_t table_id, const std::vector<pagenum_t>& pagenums) {
+    pthread_mutex_lock(&prefetch_latch);
+    if(prefetcher_running) {
+        /* read-ahead still pending when the next one of the table comes is
+         * behind the reader already, it will read those pages by itself.
+         */
+        prefetch_queue.erase(std::remove_if(prefetch_queue.begin(), prefetch_queue.end(),
+            [table_id](const std::pair<int64_t, pagenum_t>& page) { return page.first == table_id; }),
+            prefetch_queue.end());
+        for(pagenum_t pagenum : pagenums) prefetch_queue.push_back({table_id, pagenum});
+        pthread_cond_signal(&prefetch_cond);
+    }
+    pthread_mutex_unlock(&prefetch_latch);
+}
 
+void BufferManager::set_huge_pages(bool enable) {
+    pthread_mutex_lock(&buffer_manager_latch);
+    use_huge_pages = enable;
     pthread_mutex_unlock(&buffer_manager_latch);
 }
 
+bool BufferManager::is_arena_huge() { return arena_huge; }
+
+buffer_stats_t BufferManager::get_stats() {
+    buffer_stats_t stats;
+    stats.frame_count = max_count;
+    stats.partition_count = partitions.size();
+    for(BufferPartition* part : partitions) {
+        pthread_mutex_lock(&part->partition_latch);
+        part->merge_stats(stats);
+        pthread_mutex_unlock(&part->partition_latch);
+    }
+    for(int i = 0; i < LATCH_WAIT_BUCKETS; ++i) {
+        stats.page_latch_waits[i] = page_latch_waits[i];
+        stats.partition_latch_waits[i] = partition_latch_waits[i];
+    }
+    // only waits go to the shared histograms, bucket 0 is kept per thread
+    sum_uncontended_latches(&stats.page_latch_waits[0], &stats.partition_latch_waits[0]);
+    return stats;
+}
+
+void BufferManager::reset_stats() {
+    for(BufferPartition* part : partitions) {
+        pthread_mutex_lock(&part->partition_latch);
+        part->reset_stats();
+        pthread_mutex_unlock(&part->partition_latch);
+    }
+    for(int i = 0; i < LATCH_WAIT_BUCKETS; ++i) page_latch_waits[i] = partition_latch_waits[i] = 0;
+    reset_uncontended_latches();
+}
+
+void BufferManager::set_stats_dump(int interval_ms, const std::string& path) {
+    pthread_mutex_lock(&stats_dump_latch);
+    stats_dump_interval_ms = interval_ms;
+    stats_dump_path = path;
+    clock_gettime(CLOCK_MONOTONIC, &last_stats_dump);
+    pthread_mutex_unlock(&stats_dump_latch);
+}
+
+void BufferManager::dump_stats() {
+    pthread_mutex_lock(&stats_dump_latch);
+    std::string path = stats_dump_path;
+    pthread_mutex_unlock(&stats_dump_latch);
+
+    buffer_stats_t stats = get_stats();
+    if(path.empty()) {
+        stats.print(std::cout);
+        return;
+    }
+    std::ofstream out(path, std::ios::app);
+    stats.print(out);
+}
+
+void BufferManager::wake_cleaner() {
+    pthread_mutex_lock(&cleaner_latch);
+    pthread_cond_signal(&cleaner_cond);
+    pthread_mutex_unlock(&cleaner_latch);
+}
+
 void BufferManager::unpin_buffer(int64_t table_id, pagenum_t pagenum) {
-    if(!is_buffer_exist(table_id, pagenum)) return;
-    buffer_t* cur_buf = find_buffer(table_id, pagenum);
-    pthread_mutex_unlock(&cur_buf->page_latch);
+    BufferPartition* part = get_partition(table_id, pagenum);
+
+    lock_partition(part);
+    buffer_t* cur_buf = part->find_buffer(table_id, pagenum);
+    // a modified page may have become a leaf / internal page
+    if(cur_buf != nullptr && cur_buf->is_dirty) cur_buf->page_type = BufferPartition::classify_page(cur_buf);
+    pthread_mutex_unlock(&part->partition_latch);
+
+    if(cur_buf == nullptr) return;
+    pthread_rwlock_unlock(&cur_buf->page_latch);
+    release_pin(part, cur_buf);
 }
+void BufferManager::force_log() {
+    // recovery reads pages with the log latch held, the error checking latch tells us
+    int ret = pthread_mutex_lock(&log_buffer_manager_latch);
+    log_buf_manager.flush_logs();
+    if(ret != EDEADLK) pthread_mutex_unlock(&log_buffer_manager_latch);
+}
+bool BufferManager::write_back_victim(BufferPartition* part, buffer_t* buf) {
+    // we may hold latches of other pages, never wait for this one
+    if(pthread_rwlock_tryrdlock(&buf->page_latch) != 0) return false;
+
+    if(buf->is_dirty) {
+        // write-ahead: log records of the page reach the disk first
+        force_log();
+        write_back_frame(part, buf);
+    }
+    pthread_rwlock_unlock(&buf->page_latch);
+    return true;
+}
+void BufferManager::write_back_frame(BufferPartition* part, buffer_t* buf) {
+    if(!buf->is_dirty) return;
+    std::vector<buffer_t*> frames = {buf};
+    write_frames(frames);
 
-int64_t BufferManager::buffer_open_table_file(const char* pathname) {
+    pthread_mutex_lock(&part->partition_latch);
+    part->count_write_back(buf);
+    pthread_mutex_unlock(&part->partition_latch);
+}
+void BufferManager::release_pin(BufferPartition* part, buffer_t* buf) {
+    buf->pin_count--;
+    if(!buf->drop_pending) return;
+
+    pthread_mutex_lock(&part->partition_latch);
+    part->finish_drop(buf);
+    pthread_mutex_unlock(&part->partition_latch);
+}
+
+int64_t BufferManager::buffer_open_table_file(const char* pathname, int open_mode) {
     pthread_mutex_lock(&buffer_manager_latch);
 
-    int64_t table_id = file_open_table_file(pathname);
+    int64_t table_id = file_open_table_file(pathname, open_mode);
 
     pthread_mutex_unlock(&buffer_manager_latch);
     return table_id;
 }
 
 void BufferManager::destroy_all() {
+    stop_prefetcher();
+    stop_cleaner();
     pthread_mutex_lock(&buffer_manager_latch);
 
-    for(int i = 0; i < max_count; ++i) {
-        if(buf_pool[i]->is_dirty) {
-            file_write_page(buf_pool[i]->table_id, buf_pool[i]->pagenum, (page_t*)buf_pool[i]->frame);
-            buf_pool[i]->is_dirty = false;
-        }
-        delete buf_pool[i];
+    std::vector<buffer_t*> frames;
+    for(BufferPartition* part : partitions) {
+        pthread_mutex_lock(&part->partition_latch);
+        part->collect_all_dirty(frames);
     }
-    cur_count = 0;
-    hash_pointer.clear();
-    buf_pool.clear();
-    buf_head->next = buf_tail;
-    buf_tail->prev = buf_head;
+    write_frames(frames);
+    for(buffer_t* buf : frames) get_partition(buf->table_id, buf->pagenum)->count_write_back(buf);
+    for(BufferPartition* part : partitions) pthread_mutex_unlock(&part->partition_latch);
+
+    // last report of this pool, its counters go with the partitions
+    pthread_mutex_lock(&stats_dump_latch);
+    bool dump_enabled = stats_dump_interval_ms > 0;
+    pthread_mutex_unlock(&stats_dump_latch);
+    if(dump_enabled) dump_stats();
+
+    for(BufferPartition* part : partitions) delete part;
+    partitions.clear();
+    free_arena();
+    file_checkpoint_table_files();
+    max_count = 0;
 
     pthread_mutex_unlock(&buffer_manager_latch);
 }
@@ -148,149 +1115,238 @@ void BufferManager::buffer_close_table_file() {
     pthread_mutex_unlock(&buffer_manager_latch);
 }
 
-buffer_t* BufferManager::buffer_read_page(int64_t table_id, pagenum_t pagenum) {
-    pthread_mutex_lock(&buffer_manager_latch);
-    
-    total_cnt++;
+buffer_t* BufferManager::buffer_read_page(int64_t table_id, pagenum_t pagenum, int latch_mode) {
+    BufferPartition* part = get_partition(table_id, pagenum);
 
-    /* cache miss */
-    if(!is_buffer_exist(table_id, pagenum)) {
-        /* when buffer is full */
-        if(cur_count == max_count) {
-            // * page latch aquired in here
-            buffer_t* victim = find_victim(); 
-            if(victim->is_dirty) flush_buffer(victim);
+    lock_partition(part);
+    while(true) {
+        buffer_t* cur_buf = part->find_buffer(table_id, pagenum);
+        /* cache hit */
+        if(cur_buf != nullptr) {
+            part->touch_buffer(cur_buf);
 
-            int64_t key = convert_pair_to_key(victim->table_id, victim->pagenum);
-            hash_pointer.erase(key);
+            /* pinned frame stays mapped to this page, so wait for the
+             * page latch without holding the partition latch.
+             */
+            pthread_mutex_unlock(&part->partition_latch);
 
-            // insert new buffer
-            buffer_t* new_buf = victim;
+            lock_page(cur_buf, latch_mode);
+            return cur_buf;
+        }
 
-            set_buf(new_buf, table_id, pagenum);
-            file_read_page(table_id, pagenum, (page_t*)new_buf->frame);
-            move_to_head(new_buf);
+        /* cache miss, hits on this partition don't wait for the read */
+        buffer_t* dirty_victim = nullptr;
+        cur_buf = part->begin_load(table_id, pagenum, &dirty_victim);
+        if(cur_buf != nullptr) {
+            pthread_mutex_unlock(&part->partition_latch);
+            file_read_page(table_id, pagenum, (page_t*)cur_buf->frame);
 
-            // insert into hash
-            int64_t new_key = convert_pair_to_key(table_id, pagenum);
-            hash_pointer.insert({new_key, new_buf});
+            pthread_mutex_lock(&part->partition_latch);
+            part->end_load(cur_buf);
+            pthread_mutex_unlock(&part->partition_latch);
 
-            pthread_mutex_unlock(&buffer_manager_latch);
-            return new_buf;
+            if(latch_mode == PAGE_LATCH_SHARED) {
+                pthread_rwlock_unlock(&cur_buf->page_latch);
+                lock_page(cur_buf, latch_mode);
+            }
+            return cur_buf;
         }
-        /* buffer is not full */
-        else {
-            buffer_t* new_buf = buf_pool[cur_count++];
 
-            pthread_mutex_lock(&new_buf->page_latch);
-            set_buf(new_buf, table_id, pagenum);
-            file_read_page(table_id, pagenum, (page_t*)new_buf->frame);
-            insert_into_head(new_buf);
+        // no clean frame in reach: write the victim back and look again, the page may be in by then
+        dirty_victim->pin_count++;
+        pthread_mutex_unlock(&part->partition_latch);
+        write_back_victim(part, dirty_victim);
+        release_pin(part, dirty_victim);
+        lock_partition(part);
+    }
+}
 
-            // insert into hash
-            int64_t new_key = convert_pair_to_key(table_id, pagenum);
-            hash_pointer.insert({new_key, new_buf});
+void BufferManager::buffer_write_page(int64_t table_id, pagenum_t pagenum, uint64_t rec_LSN) {
+    BufferPartition* part = get_partition(table_id, pagenum);
 
-            pthread_mutex_unlock(&buffer_manager_latch);
-            return new_buf;
-        }
+    lock_partition(part);
+    buffer_t* cur_buf = part->find_buffer(table_id, pagenum);
+    if(cur_buf != nullptr) {
+        cur_buf->is_dirty = true;
+        // log record of the change comes after this, at or past the current end
+        if(rec_LSN == NO_REC_LSN) rec_LSN = log_buf_manager.next_LSN;
+        cur_buf->rec_LSN = std::min(cur_buf->rec_LSN, rec_LSN);
     }
-    /* cache hit */
-    else {
-        cache_hit++;
-        buffer_t* cur_buf = find_buffer(table_id, pagenum);
-        pthread_mutex_lock(&cur_buf->page_latch);
-
-        // move to front
-        move_to_head(cur_buf);
+    pthread_mutex_unlock(&part->partition_latch);
+}
 
-        pthread_mutex_unlock(&buffer_manager_latch);
-        return cur_buf;
+void BufferManager::get_dirty_pages(std::vector<dirty_page_t>& pages) {
+    for(BufferPartition* part : partitions) {
+        lock_partition(part);
+        part->collect_dirty_pages(pages);
+        pthread_mutex_unlock(&part->partition_latch);
     }
+}
 
-    pthread_mutex_unlock(&buffer_manager_latch);
+void BufferManager::write_back_before(uint64_t LSN) {
+    for(BufferPartition* part : partitions) {
+        std::vector<buffer_t*> batch;
 
-    return nullptr;
-}
+        lock_partition(part);
+        part->collect_dirty_before(LSN, batch);
+        pthread_mutex_unlock(&part->partition_latch);
 
-void BufferManager::buffer_write_page(int64_t table_id, pagenum_t pagenum) {
-    if(!is_buffer_exist(table_id, pagenum)) return;
-    buffer_t* cur_buf = find_buffer(table_id, pagenum);
-    cur_buf->is_dirty = true;
+        if(!batch.empty()) write_batch(batch);
+    }
 }
 
-void BufferManager::buffer_free_page(int64_t table_id, pagenum_t pagenum) {
-    pthread_mutex_lock(&buffer_manager_latch);
+void BufferManager::buffer_flush_table(int64_t table_id) {
+    // write-ahead, and unlike the cleaner this waits for the log
+    pthread_mutex_lock(&log_buffer_manager_latch);
+    log_buf_manager.flush_logs();
+    pthread_mutex_unlock(&log_buffer_manager_latch);
+
+    for(BufferPartition* part : partitions) {
+        std::vector<buffer_t*> batch;
 
-    if(is_buffer_exist(table_id, pagenum)) {
-        buffer_t* cur_buf = find_buffer(table_id, pagenum);
-        cur_buf->is_dirty = false;
-        int64_t key = convert_pair_to_key(table_id, pagenum);
-        hash_pointer.erase(key);
+        lock_partition(part);
+        part->collect_table_dirty(table_id, batch);
+        pthread_mutex_unlock(&part->partition_latch);
+        if(batch.empty()) continue;
+
+        for(buffer_t* buf : batch) pthread_rwlock_rdlock(&buf->page_latch);
+        std::vector<buffer_t*> dirty;
+        for(buffer_t* buf : batch)
+            if(buf->is_dirty) dirty.push_back(buf);
+        write_frames(dirty);
+
+        pthread_mutex_lock(&part->partition_latch);
+        for(buffer_t* buf : dirty) part->count_write_back(buf);
+        pthread_mutex_unlock(&part->partition_latch);
+
+        for(buffer_t* buf : batch) {
+            pthread_rwlock_unlock(&buf->page_latch);
+            release_pin(part, buf);
+        }
     }
-   
-    if(!is_buffer_exist(table_id, 0)) {
-        file_free_page(table_id, pagenum);
+    file_checkpoint_table_files();
+}
 
-        pthread_mutex_unlock(&buffer_manager_latch);
-        return;
+void BufferManager::buffer_flush_pages(int64_t table_id, const std::vector<pagenum_t>& pagenums) {
+    force_log();
+    for(pagenum_t pagenum : pagenums) {
+        buffer_t* buf = buffer_read_page(table_id, pagenum, PAGE_LATCH_SHARED);
+        write_back_frame(get_partition(table_id, pagenum), buf);
+        unpin_buffer(table_id, pagenum);
     }
+    file_checkpoint_table_files();
+}
+
+void BufferManager::buffer_free_page(int64_t table_id, pagenum_t pagenum) {
+    pthread_mutex_lock(&buffer_manager_latch);
 
-    buffer_t* header_buf = find_buffer(table_id, 0);
-    pthread_mutex_lock(&header_buf->page_latch);
+    BufferPartition* part = get_partition(table_id, pagenum);
+    pthread_mutex_lock(&part->partition_latch);
+    part->drop_buffer(table_id, pagenum);
+    pthread_mutex_unlock(&part->partition_latch);
 
-    page_t free_page;
-    pagenum_t next_free_page_num = page_io::get_next_free_page((page_t*)header_buf->frame, 0);
-    page_io::set_free_page_next(&free_page, next_free_page_num);
-    file_write_page(table_id, pagenum, &free_page);
+    buffer_t* header_buf = buffer_read_page(table_id, 0);
+    pagenum_t bitmap_page_num = page_io::header::get_bitmap_page((page_t*)header_buf->frame, pagenum / PAGES_PER_BITMAP);
 
-    page_io::header::set_next_free_page((page_t*)header_buf->frame, pagenum);
-    header_buf->is_dirty = true;
+    // freed page itself is never written, its bit is all that changes
+    buffer_t* bitmap_buf = buffer_read_page(table_id, bitmap_page_num);
+    page_io::bitmap::set_free((page_t*)bitmap_buf->frame, pagenum % PAGES_PER_BITMAP);
+    bitmap_buf->is_dirty = true;
 
-    pthread_mutex_unlock(&header_buf->page_latch);
+    unpin_buffer(table_id, bitmap_page_num);
+    unpin_buffer(table_id, 0);
     pthread_mutex_unlock(&buffer_manager_latch);
 }
 
-pagenum_t BufferManager::buffer_alloc_page(int64_t table_id) {
+pagenum_t BufferManager::buffer_truncate_table(int64_t table_id) {
     pthread_mutex_lock(&buffer_manager_latch);
-    if(!is_buffer_exist(table_id, 0)) {
-        pagenum_t new_pagenum = file_alloc_page(table_id);
-        pthread_mutex_unlock(&buffer_manager_latch);
-        return new_pagenum;
-    }
-    
-    buffer_t* header_buf = find_buffer(table_id, 0);
-
-    pthread_mutex_lock(&header_buf->page_latch);
 
-    pagenum_t next_free_page_num = page_io::get_next_free_page((page_t*)header_buf->frame, 0);
-    if(next_free_page_num == 0) {
-        pagenum_t page_cnt = page_io::header::get_page_count((page_t*)header_buf->frame);
-        pagenum_t curr_cnt = page_cnt * 2;
+    buffer_t* header_buf = buffer_read_page(table_id, 0);
+    page_t* header_page = (page_t*)header_buf->frame;
+    pagenum_t page_cnt = page_io::header::get_page_count(header_page);
+    uint64_t group_cnt = page_io::header::get_bitmap_count(header_page);
 
-        page_io::set_free_page_next((page_t*)header_buf->frame, page_cnt);
+    std::set<pagenum_t> bitmap_pagenums;
+    for(uint64_t group = 0; group < group_cnt; ++group)
+        bitmap_pagenums.insert(page_io::header::get_bitmap_page(header_page, group));
 
-        for(pagenum_t i = page_cnt; i < curr_cnt; i++) {
-            page_t free_page;
-            pagenum_t next_free_page_num = (i + 1) % curr_cnt;
-            page_io::set_free_page_next(&free_page, next_free_page_num);
-            file_write_page(table_id, i, &free_page);
+    // file ends after the last page in use, bitmap pages aside
+    pagenum_t new_page_cnt = 1;
+    for(uint64_t group = group_cnt; group-- > 0 && new_page_cnt == 1;) {
+        pagenum_t bitmap_page_num = page_io::header::get_bitmap_page(header_page, group);
+        buffer_t* bitmap_buf = buffer_read_page(table_id, bitmap_page_num, PAGE_LATCH_SHARED);
+        for(int64_t idx = page_io::header::get_group_size(header_page, group) - 1; idx >= 0; --idx) {
+            pagenum_t pagenum = group * PAGES_PER_BITMAP + idx;
+            if(page_io::bitmap::is_used((page_t*)bitmap_buf->frame, idx) && bitmap_pagenums.count(pagenum) == 0) {
+                new_page_cnt = pagenum + 1;
+                break;
+            }
         }
+        unpin_buffer(table_id, bitmap_page_num);
+    }
 
-        pagenum_t root_page_num = page_io::header::get_root_page((page_t*)header_buf->frame);
-        page_io::header::set_header_page((page_t*)header_buf->frame, page_cnt, curr_cnt, root_page_num);
+    // groups left must keep their bitmap pages in the file
+    uint64_t new_group_cnt;
+    do {
+        new_group_cnt = (new_page_cnt + PAGES_PER_BITMAP - 1) / PAGES_PER_BITMAP;
+        for(uint64_t group = 0; group < new_group_cnt; ++group)
+            new_page_cnt = std::max(new_page_cnt, page_io::header::get_bitmap_page(header_page, group) + 1);
+    } while((new_page_cnt + PAGES_PER_BITMAP - 1) / PAGES_PER_BITMAP != new_group_cnt);
+
+    if(new_page_cnt >= page_cnt) {
+        unpin_buffer(table_id, 0);
+        pthread_mutex_unlock(&buffer_manager_latch);
+        return page_cnt;
     }
 
-    page_t free_page;
-    next_free_page_num = page_io::get_next_free_page((page_t*)header_buf->frame, 0);
-    file_read_page(table_id, next_free_page_num, &free_page);
+    // bitmap of a dropped group may sit in a group left (converted files)
+    for(uint64_t group = new_group_cnt; group < group_cnt; ++group) {
+        pagenum_t bitmap_page_num = page_io::header::get_bitmap_page(header_page, group);
+        if(bitmap_page_num >= new_page_cnt) continue;
+        pagenum_t owner_page_num = page_io::header::get_bitmap_page(header_page, bitmap_page_num / PAGES_PER_BITMAP);
+        buffer_t* owner_buf = buffer_read_page(table_id, owner_page_num);
+        page_io::bitmap::set_free((page_t*)owner_buf->frame, bitmap_page_num % PAGES_PER_BITMAP);
+        owner_buf->is_dirty = true;
+        unpin_buffer(table_id, owner_page_num);
+    }
+
+    for(BufferPartition* part : partitions) {
+        pthread_mutex_lock(&part->partition_latch);
+        part->drop_table_tail(table_id, new_page_cnt);
+        pthread_mutex_unlock(&part->partition_latch);
+    }
 
-    pagenum_t header_next_free_page_num = page_io::get_next_free_page(&free_page, next_free_page_num);
-    page_io::header::set_next_free_page((page_t*)header_buf->frame, header_next_free_page_num);
+    // header on disk never counts pages the file doesn't have
+    pagenum_t root_page = page_io::header::get_root_page(header_page);
+    page_io::header::set_header_page(header_page, 0, new_page_cnt, root_page);
+    page_io::header::set_bitmap_count(header_page, new_group_cnt);
     header_buf->is_dirty = true;
+    file_write_page(table_id, 0, header_page);
+    file_truncate_table(table_id, new_page_cnt);
 
-    pthread_mutex_unlock(&header_buf->page_latch);
+    unpin_buffer(table_id, 0);
     pthread_mutex_unlock(&buffer_manager_latch);
 
-    return next_free_page_num;
-}
\ No newline at end of file
+    return new_page_cnt;
+}
+pagenum_t BufferManager::buffer_alloc_page(int64_t table_id, pagenum_t hint) {
+    pthread_mutex_lock(&buffer_manager_latch);
+
+    buffer_t* header_buf = buffer_read_page(table_id, 0);
+    page_t* header_page = (page_t*)header_buf->frame;
+
+    pagenum_t new_page_num = take_free_page(table_id, header_page, hint);
+    if(new_page_num == 0) {
+        // every page is in use, continue in a new extent
+        pagenum_t page_cnt = page_io::header::get_page_count(header_page);
+        if(file_extend_table(table_id, header_page)) {
+            header_buf->is_dirty = true;
+            new_page_num = take_free_page(table_id, header_page, page_cnt);
+        }
+    }
+
+    unpin_buffer(table_id, 0);
+    pthread_mutex_unlock(&buffer_manager_latch);
+
+    return new_page_num;
+}
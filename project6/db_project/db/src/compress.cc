@@ -0,0 +1,347 @@
+#include "compress.h"
+#include "file.h"
+
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+/************************************************************************/
+// * LZ CODEC                                                           //
+/************************************************************************/
+
+/* Sequences of [token][literal length...][literals][offset][match length...],
+ * token holds literal length and match length - LZ_MIN_MATCH in 4 bits each,
+ * 15 continues in bytes of 255. The last sequence has literals only.
+ */
+static bool put_length(char* dest, int dest_cap, int* op, int len) {
+    for(; len >= 255; len -= 255) {
+        if(*op >= dest_cap) return false;
+        dest[(*op)++] = (char)255;
+    }
+    if(*op >= dest_cap) return false;
+    dest[(*op)++] = (char)len;
+    return true;
+}
+static bool put_sequence(const char* literals, int literal_len, int offset, int match_len, char* dest, int dest_cap, int* op) {
+    int match_code = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+    if(*op >= dest_cap) return false;
+    dest[(*op)++] = (char)((std::min(literal_len, 15) << 4) | std::min(match_code, 15));
+    if(literal_len >= 15 && !put_length(dest, dest_cap, op, literal_len - 15)) return false;
+
+    if(*op + literal_len > dest_cap) return false;
+    memcpy(dest + *op, literals, literal_len);
+    *op += literal_len;
+    if(match_len == 0) return true;
+
+    if(*op + 2 > dest_cap) return false;
+    dest[(*op)++] = (char)(offset & 0xff);
+    dest[(*op)++] = (char)(offset >> 8);
+    return match_code < 15 || put_length(dest, dest_cap, op, match_code - 15);
+}
+int lz::compress(const char* src, int src_len, char* dest, int dest_cap) {
+    int table[1 << LZ_HASH_BITS];
+    for(int& pos : table) pos = -1;
+
+    int ip = 0, anchor = 0, op = 0;
+    while(ip + LZ_MIN_MATCH <= src_len) {
+        uint32_t seq;
+        memcpy(&seq, src + ip, sizeof(seq));
+        uint32_t hash = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        int ref = table[hash];
+        table[hash] = ip;
+        if(ref < 0 || ip - ref > LZ_MAX_OFFSET || memcmp(src + ref, src + ip, LZ_MIN_MATCH) != 0) {
+            ip++;
+            continue;
+        }
+
+        int len = LZ_MIN_MATCH;
+        while(ip + len < src_len && src[ref + len] == src[ip + len]) len++;
+        if(!put_sequence(src + anchor, ip - anchor, ip - ref, len, dest, dest_cap, &op)) return 0;
+        ip += len;
+        anchor = ip;
+    }
+    if(!put_sequence(src + anchor, src_len - anchor, 0, 0, dest, dest_cap, &op)) return 0;
+    return op;
+}
+static bool get_length(const unsigned char* src, int src_len, int* ip, int* len) {
+    unsigned char byte;
+    do {
+        if(*ip >= src_len) return false;
+        byte = src[(*ip)++];
+        *len += byte;
+    } while(byte == 255);
+    return true;
+}
+bool lz::decompress(const char* src_, int src_len, char* dest, int dest_len) {
+    const unsigned char* src = (const unsigned char*)src_;
+    int ip = 0, op = 0;
+    while(ip < src_len) {
+        unsigned char token = src[ip++];
+        int literal_len = token >> 4;
+        if(literal_len == 15 && !get_length(src, src_len, &ip, &literal_len)) return false;
+        if(ip + literal_len > src_len || op + literal_len > dest_len) return false;
+        memcpy(dest + op, src + ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+        if(ip == src_len) break;
+
+        if(ip + 2 > src_len) return false;
+        int offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        int match_len = token & 15;
+        if(match_len == 15 && !get_length(src, src_len, &ip, &match_len)) return false;
+        match_len += LZ_MIN_MATCH;
+        if(offset == 0 || offset > op || op + match_len > dest_len) return false;
+        // byte by byte, a match may overlap its own output
+        for(int i = 0; i < match_len; ++i, ++op) dest[op] = dest[op - offset];
+    }
+    return op == dest_len;
+}
+
+/************************************************************************/
+// * COMPRESSION STATS                                                  //
+/************************************************************************/
+
+compression_stats_t::compression_stats_t() {
+    pages_written = raw_bytes = stored_bytes = 0;
+    pages_read = decompress_ns = 0;
+    stored_pages = 0;
+}
+double compression_stats_t::ratio() const {
+    return stored_bytes == 0 ? 0 : (double)raw_bytes / stored_bytes;
+}
+double compression_stats_t::decompress_ns_per_miss() const {
+    return pages_read == 0 ? 0 : (double)decompress_ns / pages_read;
+}
+void compression_stats_t::print(std::ostream& os) const {
+    os << "compression: " << stored_pages << " pages stored, ratio " << ratio()
+       << " (" << raw_bytes << " -> " << stored_bytes << " bytes in " << pages_written << " write backs), "
+       << decompress_ns_per_miss() << " ns decompressing per miss (" << pages_read << " misses)" << std::endl;
+}
+
+/************************************************************************/
+// * COMPRESSED EXTENTS                                                 //
+/************************************************************************/
+
+/* FNV-1a over the compressed bytes, a torn extent fails it */
+static uint32_t extent_checksum(const char* data, uint32_t len) {
+    uint32_t hash = 2166136261u;
+    for(uint32_t i = 0; i < len; ++i) hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+    return hash;
+}
+/* Header of an extent in (buf), false if there is none */
+static bool parse_extent_header(const char* buf, uint32_t* len, pagenum_t* pagenum, uint64_t* generation, uint32_t* checksum) {
+    uint32_t magic;
+    memcpy(&magic, buf, sizeof(magic));
+    memcpy(len, buf + 4, sizeof(*len));
+    memcpy(pagenum, buf + 8, sizeof(*pagenum));
+    memcpy(generation, buf + 16, sizeof(*generation));
+    memcpy(checksum, buf + 24, sizeof(*checksum));
+    return magic == EXTENT_MAGIC && *len > 0 && EXTENT_HEADER_SIZE + *len <= PAGE_SIZE;
+}
+static uint32_t sectors_of(uint32_t len) {
+    return (EXTENT_HEADER_SIZE + len + EXTENT_SECTOR_SIZE - 1) / EXTENT_SECTOR_SIZE;
+}
+static uint64_t elapsed_ns(const timespec& start) {
+    timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+}
+
+CompressedExtents::CompressedExtents() {
+    fd = -1;
+    pthread_mutex_init(&latch, NULL);
+    next_fit = 0;
+    generation = 0;
+}
+CompressedExtents::~CompressedExtents() {
+    close();
+    pthread_mutex_destroy(&latch);
+}
+
+uint64_t CompressedExtents::alloc_sectors(uint32_t count) {
+    uint64_t total = used_sectors.size();
+    uint64_t run = 0;
+    for(uint64_t i = 0; i < total; ++i) {
+        uint64_t sector = (next_fit + i) % total;
+        // a run never wraps around the end of file
+        if(sector == 0) run = 0;
+        run = used_sectors[sector] ? 0 : run + 1;
+        if(run < count) continue;
+
+        uint64_t start = sector + 1 - count;
+        for(uint64_t s = start; s <= sector; ++s) used_sectors[s] = true;
+        next_fit = sector + 1;
+        return start;
+    }
+
+    // reserved up front, appends don't change the file size one by one
+    uint64_t start = total;
+    fallocate(fd, 0, total * EXTENT_SECTOR_SIZE, (uint64_t)EXTENT_GROWTH_SECTORS * EXTENT_SECTOR_SIZE);
+    used_sectors.resize(total + std::max<uint64_t>(EXTENT_GROWTH_SECTORS, count), false);
+    for(uint64_t s = start; s < start + count; ++s) used_sectors[s] = true;
+    next_fit = start + count;
+    return start;
+}
+void CompressedExtents::free_sectors(const extent_t& extent) {
+    for(uint64_t s = extent.sector; s < extent.sector + extent.sector_cnt; ++s) used_sectors[s] = false;
+}
+void CompressedExtents::invalidate(const extent_t& extent) {
+    page_t sector;
+    memset(sector.data, 0, EXTENT_SECTOR_SIZE);
+    pwrite(fd, sector.data, EXTENT_SECTOR_SIZE, extent.sector * EXTENT_SECTOR_SIZE);
+}
+
+bool CompressedExtents::open(const std::string& pathname, int flags) {
+    std::string path = pathname + COMPRESSED_FILE_SUFFIX;
+    fd = open_table_fd(path.c_str(), flags | O_CREAT);
+    if(fd < 0) return false;
+
+    uint64_t total = file_io::get_file_size(fd) / EXTENT_SECTOR_SIZE;
+    used_sectors.assign(total, false);
+    extents.clear();
+
+    // newest valid copy of each page wins
+    std::vector<page_t> chunk(EXTENT_SCAN_SECTORS * EXTENT_SECTOR_SIZE / PAGE_SIZE);
+    page_t extent_buf;
+    for(uint64_t first = 0; first < total; first += EXTENT_SCAN_SECTORS) {
+        uint64_t cnt = std::min<uint64_t>(EXTENT_SCAN_SECTORS, total - first);
+        if(pread(fd, chunk.data(), cnt * EXTENT_SECTOR_SIZE, first * EXTENT_SECTOR_SIZE) != (ssize_t)(cnt * EXTENT_SECTOR_SIZE)) break;
+
+        for(uint64_t i = 0; i < cnt; ++i) {
+            const char* sector = (const char*)chunk.data() + i * EXTENT_SECTOR_SIZE;
+            uint32_t len, checksum;
+            pagenum_t pagenum;
+            uint64_t gen;
+            if(!parse_extent_header(sector, &len, &pagenum, &gen, &checksum)) continue;
+
+            extent_t extent = {first + i, sectors_of(len), gen};
+            if(extent.sector + extent.sector_cnt > total) continue;
+            auto it = extents.find(pagenum);
+            if(it != extents.end() && it->second.generation >= gen) continue;
+
+            if(pread(fd, extent_buf.data, extent.sector_cnt * EXTENT_SECTOR_SIZE, extent.sector * EXTENT_SECTOR_SIZE) != (ssize_t)(extent.sector_cnt * EXTENT_SECTOR_SIZE)) continue;
+            if(extent_checksum(extent_buf.data + EXTENT_HEADER_SIZE, len) != checksum) continue;
+
+            extents[pagenum] = extent;
+            generation = std::max(generation, gen);
+        }
+    }
+    for(auto& extent : extents) {
+        for(uint64_t s = extent.second.sector; s < extent.second.sector + extent.second.sector_cnt; ++s) used_sectors[s] = true;
+    }
+    stats.stored_pages = extents.size();
+    return true;
+}
+bool CompressedExtents::has_page(pagenum_t pagenum) {
+    pthread_mutex_lock(&latch);
+    bool stored = extents.find(pagenum) != extents.end();
+    pthread_mutex_unlock(&latch);
+    return stored;
+}
+bool CompressedExtents::read_page(pagenum_t pagenum, page_t* dest) {
+    pthread_mutex_lock(&latch);
+    auto it = extents.find(pagenum);
+    if(it == extents.end()) {
+        pthread_mutex_unlock(&latch);
+        return false;
+    }
+    extent_t extent = it->second;
+    pthread_mutex_unlock(&latch);
+
+    // sectors of a page are freed only by writes of the same page, a miss never races with them
+    page_t buf;
+    if(pread(fd, buf.data, extent.sector_cnt * EXTENT_SECTOR_SIZE, extent.sector * EXTENT_SECTOR_SIZE) != (ssize_t)(extent.sector_cnt * EXTENT_SECTOR_SIZE)) return false;
+    uint32_t len, checksum;
+    pagenum_t stored_pagenum;
+    uint64_t gen;
+    if(!parse_extent_header(buf.data, &len, &stored_pagenum, &gen, &checksum) || stored_pagenum != pagenum) return false;
+
+    timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(!lz::decompress(buf.data + EXTENT_HEADER_SIZE, len, dest->data, PAGE_SIZE)) return false;
+    uint64_t ns = elapsed_ns(start);
+
+    pthread_mutex_lock(&latch);
+    stats.pages_read++;
+    stats.decompress_ns += ns;
+    pthread_mutex_unlock(&latch);
+    return true;
+}
+bool CompressedExtents::write_page(pagenum_t pagenum, const page_t* src, bool* first_time) {
+    page_t buf;
+    // must save at least one sector to be worth a second file
+    int len = lz::compress(src->data, PAGE_SIZE, buf.data + EXTENT_HEADER_SIZE, PAGE_SIZE - EXTENT_HEADER_SIZE - EXTENT_SECTOR_SIZE);
+    if(len == 0) return false;
+
+    uint32_t sector_cnt = sectors_of(len);
+    uint32_t magic = EXTENT_MAGIC, length = len, checksum = extent_checksum(buf.data + EXTENT_HEADER_SIZE, len), pad = 0;
+    memset(buf.data + EXTENT_HEADER_SIZE + len, 0, sector_cnt * EXTENT_SECTOR_SIZE - EXTENT_HEADER_SIZE - len);
+
+    pthread_mutex_lock(&latch);
+    extent_t extent = {alloc_sectors(sector_cnt), sector_cnt, ++generation};
+    pthread_mutex_unlock(&latch);
+
+    memcpy(buf.data, &magic, sizeof(magic));
+    memcpy(buf.data + 4, &length, sizeof(length));
+    memcpy(buf.data + 8, &pagenum, sizeof(pagenum));
+    memcpy(buf.data + 16, &extent.generation, sizeof(extent.generation));
+    memcpy(buf.data + 24, &checksum, sizeof(checksum));
+    memcpy(buf.data + 28, &pad, sizeof(pad));
+    pwrite(fd, buf.data, sector_cnt * EXTENT_SECTOR_SIZE, extent.sector * EXTENT_SECTOR_SIZE);
+
+    pthread_mutex_lock(&latch);
+    auto it = extents.find(pagenum);
+    *first_time = it == extents.end();
+    // the old copy has a lower generation, reusing its sectors is safe once the new one is written
+    if(!*first_time) free_sectors(it->second);
+    extents[pagenum] = extent;
+    stats.pages_written++;
+    stats.raw_bytes += PAGE_SIZE;
+    stats.stored_bytes += sector_cnt * EXTENT_SECTOR_SIZE;
+    stats.stored_pages = extents.size();
+    pthread_mutex_unlock(&latch);
+    return true;
+}
+void CompressedExtents::drop_page(pagenum_t pagenum) {
+    pthread_mutex_lock(&latch);
+    auto it = extents.find(pagenum);
+    if(it != extents.end()) {
+        invalidate(it->second);
+        free_sectors(it->second);
+        extents.erase(it);
+        stats.stored_pages = extents.size();
+    }
+    pthread_mutex_unlock(&latch);
+}
+void CompressedExtents::drop_from(pagenum_t pagenum) {
+    pthread_mutex_lock(&latch);
+    for(auto it = extents.begin(); it != extents.end();) {
+        if(it->first < pagenum) {
+            ++it;
+            continue;
+        }
+        invalidate(it->second);
+        free_sectors(it->second);
+        it = extents.erase(it);
+    }
+    stats.stored_pages = extents.size();
+    pthread_mutex_unlock(&latch);
+}
+compression_stats_t CompressedExtents::get_stats() {
+    pthread_mutex_lock(&latch);
+    compression_stats_t snapshot = stats;
+    pthread_mutex_unlock(&latch);
+    return snapshot;
+}
+void CompressedExtents::sync() {
+    if(fd >= 0) fdatasync(fd);
+}
+void CompressedExtents::close() {
+    if(fd >= 0) ::close(fd);
+    fd = -1;
+    extents.clear();
+    used_sectors.clear();
+}
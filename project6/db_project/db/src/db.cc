@@ -1,7 +1,5 @@
 #include "db.h"
 
-#define MAX_TABLES 20
-
 extern BufferManager buffer_manager;
 extern LogBufferManager log_buf_manager;
 
@@ -10,32 +8,65 @@ extern LogBufferManager log_buf_manager;
  */
 std::set<std::string> opened_file_paths;
 
-int64_t open_table(const char* pathname) {
+int64_t open_table(const char* pathname, int open_mode) {
     std::string path(pathname);
     if(opened_file_paths.find(path) != opened_file_paths.end()) {
         // already opened.
-        return std::stoi(std::string(pathname).substr(4));
+        return table_manager.get_table_id(path);
     }
-    if(opened_file_paths.size() >= MAX_TABLES) return -1;
-    opened_file_paths.insert(path);
 
-    int64_t table_id = buffer_manager.buffer_open_table_file(pathname);
+    int64_t table_id = buffer_manager.buffer_open_table_file(pathname, open_mode);
     if(table_id < 0) return -1; // open failed.
+    opened_file_paths.insert(path);
+    init_table_latch(table_id);
     return table_id; // open success.
 }
 
+/* Root page of a table, from its header */
+static pagenum_t read_root(int64_t table_id) {
+    buffer_t* header = buffer_manager.buffer_read_page(table_id, 0, PAGE_LATCH_SHARED);
+    pagenum_t root = page_io::header::get_root_page((page_t*)header->frame);
+    buffer_manager.unpin_buffer(table_id, 0);
+    return root;
+}
+
 /** Insert key/value pair to data file.
  * If success, return 0 else return non-zero value.
  */
 int db_insert(int64_t table_id, int64_t key, const char* value, uint16_t val_size) {
     // valid size check
     if(val_size < 50 || val_size > 112) return -1;
+    if(file_is_mapped(table_id)) return -1;
 
-    buffer_t* header = buffer_manager.buffer_read_page(table_id, 0);
-    pagenum_t root = page_io::header::get_root_page((page_t*)header->frame);
-    buffer_manager.unpin_buffer(table_id, 0);
+    // most inserts fit in their leaf and run side by side
+    {
+        TableAccess access(table_id, TABLE_ACCESS_MODIFY);
+        if(insert_in_leaf(table_id, read_root(table_id), key, value, val_size) >= 0) return 0;
+    }
 
-    insert(table_id, root, key, value, val_size);
+    // the leaf splits, the tree is ours until it's done
+    TableAccess access(table_id, TABLE_ACCESS_RESHAPE);
+    insert(table_id, read_root(table_id), key, value, val_size);
+
+    return 0;
+}
+
+/* Root page of a mapped table */
+static pagenum_t mapped_root(int64_t table_id) {
+    const page_t* header = file_get_mapped_page(table_id, 0);
+    if(header == nullptr) return 0;
+    return page_io::header::get_root_page(header);
+}
+
+/* db_find of a mapped table, the value is the only copy */
+static int find_mapped_record(int64_t table_id, int64_t key, char* ret_val, uint16_t* val_size) {
+    auto location_pair = find_mapped(table_id, mapped_root(table_id), key);
+    if(location_pair == std::pair<pagenum_t, slotnum_t>({0, 0})) return -1;
+
+    const page_t* page = file_get_mapped_page(table_id, location_pair.first);
+    *val_size = page_io::leaf::get_record_size(page, location_pair.second);
+    slotnum_t offset = page_io::leaf::get_offset(page, location_pair.second);
+    page_io::leaf::get_record(page, offset, ret_val, *val_size);
 
     return 0;
 }
@@ -45,44 +76,191 @@ int db_insert(int64_t table_id, int64_t key, const char* value, uint16_t val_siz
  * If success, return 0 else return non-zero value.
  */
 int db_find(int64_t table_id, int64_t key, char* ret_val, uint16_t* val_size) {
-    buffer_t* header = buffer_manager.buffer_read_page(table_id, 0);
-    pagenum_t root = page_io::header::get_root_page((page_t*)header->frame);
-    buffer_manager.unpin_buffer(table_id, 0);
+    if(file_is_mapped(table_id)) return find_mapped_record(table_id, key, ret_val, val_size);
+    TableAccess access(table_id, TABLE_ACCESS_READ);
 
-    auto location_pair = find(table_id, root, key);
-    
-    if(location_pair == std::pair<pagenum_t, slotnum_t>({0, 0})) return -1;
-    
-    buffer_t* page = buffer_manager.buffer_read_page(table_id, location_pair.first);
-    *val_size = page_io::leaf::get_record_size((page_t*)page->frame, location_pair.second);
-    slotnum_t offset = page_io::leaf::get_offset((page_t*)page->frame, location_pair.second);
-    page_io::leaf::get_record((page_t*)page->frame, offset, ret_val, *val_size);
-    buffer_manager.unpin_buffer(table_id, location_pair.first);
+    return find_record(table_id, read_root(table_id), key, ret_val, val_size);
+}
+
+int db_delete(int64_t table_id, int64_t key) {
+    if(file_is_mapped(table_id)) return -1;
+
+    {
+        TableAccess access(table_id, TABLE_ACCESS_MODIFY);
+        if(delete_in_leaf(table_id, read_root(table_id), key) >= 0) return 0;
+    }
+
+    // the leaf underflows, merge or redistribute with the table to ourselves
+    TableAccess access(table_id, TABLE_ACCESS_MERGE);
+    master_delete(table_id, read_root(table_id), key);
 
     return 0;
 }
 
-int db_delete(int64_t table_id, int64_t key) {
+int db_bulk_load(int64_t table_id, const bulk_load_next_t& next, int fill_percent) {
+    // internal nodes below half full would break the deletion invariant
+    if(fill_percent < 50 || fill_percent > 100) return -1;
+    if(file_is_mapped(table_id)) return -1;
+    TableAccess access(table_id, TABLE_ACCESS_RESHAPE);
+
+    return bulk_load(table_id, next, fill_percent);
+}
+
+int db_vacuum(int64_t table_id, vacuum_stats_t* stats) {
+    if(file_is_mapped(table_id)) return -1;
+
+    vacuum_stats_t local_stats;
+    return vacuum_table(table_id, stats != nullptr ? stats : &local_stats);
+}
+
+int db_set_compression(int64_t table_id, int mode) {
+    if(mode != COMPRESSION_NONE && mode != COMPRESSION_LZ) return -1;
+    if(file_is_mapped(table_id)) return -1;
+    TableAccess access(table_id, TABLE_ACCESS_RESHAPE);
+
+    // companion file first, leaves written back under the new mode need it
+    if(!file_set_table_compression(table_id, mode)) return -1;
     buffer_t* header = buffer_manager.buffer_read_page(table_id, 0);
-    pagenum_t root = page_io::header::get_root_page((page_t*)header->frame);
+    buffer_manager.buffer_write_page(table_id, 0);
+    page_io::header::set_compression((page_t*)header->frame, mode);
     buffer_manager.unpin_buffer(table_id, 0);
+    return 0;
+}
+
+compression_stats_t db_get_compression_stats(int64_t table_id) {
+    return file_get_compression_stats(table_id);
+}
+
+/* Read-ahead state of a scan over the leaf chain */
+struct scan_ahead_t {
+    std::vector<std::pair<pagenum_t, int64_t>> leaves;  // upcoming leaves and their lowest keys
+    size_t next;        // leaves[next] is the expected right sibling
+    size_t issued;      // leaves[0, issued) are requested already
+    size_t window;      // read-ahead window, grows while the scan goes on
+    int64_t fence;      // first key past the known leaves
+    bool has_fence;
+};
+
+/* Step read-ahead to (next_leaf) and request leaves of the window that may hold keys <= end_key */
+static void scan_read_ahead(int64_t table_id, pagenum_t root, int64_t end_key, pagenum_t next_leaf, scan_ahead_t* ahead) {
+    // known leaves run out, continue under the next parent
+    while(ahead->leaves.size() <= ahead->next + ahead->window
+    && ahead->has_fence && ahead->fence <= end_key) {
+        std::vector<std::pair<pagenum_t, int64_t>> siblings;
+        int64_t low_key = ahead->fence;
+        pagenum_t leaf = find_leaf_siblings(table_id, root, low_key, &siblings, &ahead->fence, &ahead->has_fence);
+        ahead->leaves.push_back({leaf, low_key});
+        ahead->leaves.insert(ahead->leaves.end(), siblings.begin(), siblings.end());
+    }
+
+    // not the chain we know (e.g. tree changed), stop reading ahead
+    if(ahead->next >= ahead->leaves.size() || ahead->leaves[ahead->next].first != next_leaf) {
+        ahead->leaves.clear();
+        ahead->next = ahead->issued = 0;
+        ahead->has_fence = false;
+        return;
+    }
+    ahead->next++;
+
+    // issue in batches, once half of the window is consumed
+    if(ahead->issued > ahead->next + ahead->window / 2) return;
+
+    std::vector<pagenum_t> pages;
+    size_t target = std::min(ahead->next + ahead->window, ahead->leaves.size());
+    size_t i = std::max(ahead->issued, ahead->next);
+    for(; i < target && ahead->leaves[i].second <= end_key; ++i)
+        pages.push_back(ahead->leaves[i].first);
+    ahead->issued = std::max(ahead->issued, i);
+
+    if(!pages.empty()) {
+        buffer_manager.buffer_prefetch(table_id, pages);
+        ahead->window = std::min(ahead->window * 2, (size_t)PREFETCH_MAX_PAGES);
+    }
+}
+
+/* Ask the kernel for leaves of (leaves) that may hold keys <= end_key */
+static void advise_mapped_leaves(int64_t table_id, const std::vector<std::pair<pagenum_t, int64_t>>& leaves, int64_t end_key) {
+    std::vector<pagenum_t> pages;
+    for(auto& leaf : leaves) {
+        if(leaf.second > end_key) break;
+        pages.push_back(leaf.first);
+    }
+    if(!pages.empty()) file_advise_mapped_pages(table_id, pages);
+}
+
+/* db_scan of a mapped table.
+ * Leaves under the current parent are advised at once, the next parent's on reaching them.
+ */
+static int scan_mapped(int64_t table_id, int64_t begin_key, int64_t end_key,
+std::vector<int64_t>* keys, std::vector<char*>* values, std::vector<uint16_t>* val_sizes) {
+    pagenum_t root = mapped_root(table_id);
+
+    std::vector<std::pair<pagenum_t, int64_t>> leaves;
+    int64_t fence;
+    bool has_fence;
+    size_t next = 0;
+    pagenum_t node = find_leaf_mapped(table_id, root, begin_key, &leaves, &fence, &has_fence);
+
+    if(node == 0) return -1;
+    advise_mapped_leaves(table_id, leaves, end_key);
 
-    master_delete(table_id, root, key);
+    const page_t* page = file_get_mapped_page(table_id, node);
+
+    pagenum_t i = 0;
+    uint32_t num_keys = page_io::get_key_count(page);
+
+    while(i < num_keys && page_io::leaf::get_key(page, i) < begin_key)
+        i++;
+
+    if(i == num_keys) return -1;
+
+    while(node != 0) {
+        page = file_get_mapped_page(table_id, node);
+        if(page == nullptr) break;
+        num_keys = page_io::get_key_count(page);
+        for(; i < num_keys && page_io::leaf::get_key(page, i) <= end_key; ++i) {
+            keys->push_back(page_io::leaf::get_key(page, i));
+            uint16_t val_size = page_io::leaf::get_record_size(page, i);
+            slotnum_t offset = page_io::leaf::get_offset(page, i);
+            char* value = new char[val_size];
+            page_io::leaf::get_record(page, offset, value, val_size);
+            values->push_back(value);
+            val_sizes->push_back(val_size);
+        }
+        if(i < num_keys) break;
+
+        node = page_io::leaf::get_right_sibling(page);
+        i = 0;
+
+        if(next < leaves.size() && leaves[next].first == node) next++;
+        else if(node != 0 && has_fence && fence <= end_key) {
+            // known leaves run out, advise the ones under the next parent
+            find_leaf_mapped(table_id, root, fence, &leaves, &fence, &has_fence);
+            next = 0;
+            advise_mapped_leaves(table_id, leaves, end_key);
+        }
+    }
 
     return 0;
 }
 
 int db_scan(int64_t table_id, int64_t begin_key, int64_t end_key,
 std::vector<int64_t>* keys, std::vector<char*>* values, std::vector<uint16_t>* val_sizes) {
-    buffer_t* header = buffer_manager.buffer_read_page(table_id, 0);
+    if(file_is_mapped(table_id)) return scan_mapped(table_id, begin_key, end_key, keys, values, val_sizes);
+    TableAccess access(table_id, TABLE_ACCESS_READ);
+
+    buffer_t* header = buffer_manager.buffer_read_page(table_id, 0, PAGE_LATCH_SHARED);
     pagenum_t root = page_io::header::get_root_page((page_t*)header->frame);
     buffer_manager.unpin_buffer(table_id, 0);
 
-    pagenum_t node = find_leaf(table_id, root, begin_key);
+    scan_ahead_t ahead;
+    ahead.next = ahead.issued = 0;
+    ahead.window = PREFETCH_MIN_PAGES;
+    pagenum_t node = find_leaf_siblings(table_id, root, begin_key, &ahead.leaves, &ahead.fence, &ahead.has_fence);
 
     if(node == 0) return -1;
 
-    buffer_t* page = buffer_manager.buffer_read_page(table_id, node);
+    buffer_t* page = buffer_manager.buffer_read_page(table_id, node, PAGE_LATCH_SHARED);
 
     pagenum_t i = 0;
     uint32_t num_keys = page_io::get_key_count((page_t*)page->frame);
@@ -91,11 +269,11 @@ std::vector<int64_t>* keys, std::vector<char*>* values, std::vector<uint16_t>* v
     && page_io::leaf::get_key((page_t*)page->frame, i) < begin_key) 
         i++;
 
+    buffer_manager.unpin_buffer(table_id, node);
     if(i == num_keys) return -1;
 
-    buffer_manager.unpin_buffer(table_id, node);
     while(node != 0) {
-        page = buffer_manager.buffer_read_page(table_id, node);
+        page = buffer_manager.buffer_read_page(table_id, node, PAGE_LATCH_SHARED);
         num_keys = page_io::get_key_count((page_t*)page->frame);
         for(; i < num_keys && page_io::leaf::get_key((page_t*)page->frame, i) <= end_key; ++i) {
             keys->push_back(page_io::leaf::get_key((page_t*)page->frame, i));
@@ -106,8 +284,12 @@ std::vector<int64_t>* keys, std::vector<char*>* values, std::vector<uint16_t>* v
             values->push_back(value);
             val_sizes->push_back(val_size);
         }
+        bool scan_done = i < num_keys;
         pagenum_t new_node = page_io::leaf::get_right_sibling((page_t*)page->frame);
         buffer_manager.unpin_buffer(table_id, node);
+        if(scan_done) break;
+
+        if(new_node != 0) scan_read_ahead(table_id, root, end_key, new_node, &ahead);
         node = new_node;
         i = 0;
     }
@@ -115,14 +297,27 @@ std::vector<int64_t>* keys, std::vector<char*>* values, std::vector<uint16_t>* v
     return 0;
 }
 
-int init_db(int num_buf) {
+int init_db(int num_buf, int buf_policy) {
+    // checkpoints of a run that never shut down read the pool init_buf drops
+    log_buf_manager.stop_checkpointer();
     init_lock_table();
-    buffer_manager.init_buf(num_buf);
+    if(buffer_manager.init_buf(num_buf, buf_policy) != 0) return -1;
     trx_manager.init();
     return 0;
 }
 
+buffer_stats_t get_buffer_stats() {
+    return buffer_manager.get_stats();
+}
+
+int db_checkpoint() {
+    log_buf_manager.checkpoint();
+    return 0;
+}
+
 int shutdown_db() {
+    // checkpoints read the buffer pool
+    log_buf_manager.stop_checkpointer();
     buffer_manager.destroy_all();
     buffer_manager.buffer_close_table_file();
     log_buf_manager.end_log();
@@ -135,83 +330,46 @@ int shutdown_db() {
 /** Find a record containing the 'key'.
  * If a matching key exists, store its value in 'ret_val' and the corresponding size in 'val_size'.
  * If success, return 0 else return non-zero value.
- * * acquire S lock
+ * * acquire S lock, except on mapped tables which are never written
  */
 int db_find(int64_t table_id, int64_t key, char* ret_val, uint16_t* val_size, int trx_id) {
-    buffer_t* header = buffer_manager.buffer_read_page(table_id, 0);
-    pagenum_t root = page_io::header::get_root_page((page_t*)header->frame);
-    buffer_manager.unpin_buffer(table_id, 0);
-
-    auto location_pair = find(table_id, root, key);
-    
-    if(location_pair == std::pair<pagenum_t, slotnum_t>({0, 0})) {
-        return -1;
-    }
-    
-    pagenum_t leaf_page_num = location_pair.first;
-    slotnum_t record_id = location_pair.second;
+    if(file_is_mapped(table_id)) return find_mapped_record(table_id, key, ret_val, val_size);
 
-    int flag = trx_get_lock(table_id, leaf_page_num, record_id, trx_id, SHARED_LOCK);
+    // locks go by key, the record may move between here and the read.
+    // taken before the table access, merges wait for readers and never for a lock
+    int flag = trx_get_lock(table_id, key, trx_id, SHARED_LOCK);
     if(flag < 0) {
         trx_manager.abort_trx(trx_id);
         return -1;
     }
 
-    buffer_t* page = buffer_manager.buffer_read_page(table_id, leaf_page_num);
-
-    *val_size = page_io::leaf::get_record_size((page_t*)page->frame, record_id);
-    slotnum_t offset = page_io::leaf::get_offset((page_t*)page->frame, record_id);
-    page_io::leaf::get_record((page_t*)page->frame, offset, ret_val, *val_size);
-    buffer_manager.unpin_buffer(table_id, leaf_page_num);
-
-    return 0;
+    TableAccess access(table_id, TABLE_ACCESS_READ);
+    return find_record(table_id, read_root(table_id), key, ret_val, val_size);
 }
 
 int db_update(int64_t table_id, int64_t key, char* value, uint16_t new_val_size, uint16_t* old_val_size, int trx_id) {
-    buffer_t* header = buffer_manager.buffer_read_page(table_id, 0);
-    pagenum_t root = page_io::header::get_root_page((page_t*)header->frame);
-    buffer_manager.unpin_buffer(table_id, 0);
-    
-    auto location_pair = find(table_id, root, key);
-    pagenum_t page = location_pair.first;
-    slotnum_t record_id = location_pair.second;
+    if(file_is_mapped(table_id)) return -1;
 
-    if(location_pair == std::pair<pagenum_t, slotnum_t>({0, 0})) {
-        return -1;
-    }
-
-    int flag = trx_get_lock(table_id, page, record_id, trx_id, EXCLUSIVE_LOCK);
+    int flag = trx_get_lock(table_id, key, trx_id, EXCLUSIVE_LOCK);
     if(flag < 0) {
         trx_manager.abort_trx(trx_id);
         return -1;
     }
+    TableAccess access(table_id, TABLE_ACCESS_READ);
 
-    trx_manager.add_log_to_trx(table_id, page, record_id, trx_id);
-
-    buffer_t* cur_page = buffer_manager.buffer_read_page(table_id, page);
-    *old_val_size = page_io::leaf::get_record_size((page_t*)cur_page->frame, record_id);
-    slotnum_t offset = page_io::leaf::get_offset((page_t*)cur_page->frame, record_id);
-
-    buffer_manager.buffer_write_page(table_id, page);
-
-    char* buf = new char[*old_val_size];
-    page_io::leaf::get_record((page_t*)cur_page->frame, offset, buf, *old_val_size);
-    std::string old_val = std::string(buf, *old_val_size);
-    update_log_t* log = new update_log_t(trx_id, table_id, page, offset, *old_val_size, old_val, std::string(value, new_val_size));
-    log_buf_manager.add_log(log);
-    delete[] buf;
-
-    page_io::set_page_LSN((page_t*)cur_page->frame, log->LSN);
-    page_io::leaf::set_record((page_t*)cur_page->frame, offset, value, new_val_size);
-    buffer_manager.unpin_buffer(table_id, page);
+    std::string old_value;
+    if(trx_update_record(table_id, key, value, new_val_size, trx_id, &old_value) != 0) return -1;
+    *old_val_size = old_value.size();
+    trx_manager.add_log_to_trx(table_id, key, old_value, trx_id);
 
     return 0;
 }
 
 /* Project 6 APIs */
-int init_db(int buf_num, int flag, int log_num, char* log_path, char* logmsg_path) {
+int init_db(int buf_num, int flag, int log_num, char* log_path, char* logmsg_path, int buf_policy) {
+    log_buf_manager.stop_checkpointer();
     init_lock_table();
-    buffer_manager.init_buf(buf_num);
+    if(buffer_manager.init_buf(buf_num, buf_policy) != 0) return -1;
     trx_manager.init();
     log_buf_manager.init(buf_num, log_path, logmsg_path);
     log_buf_manager.recovery(flag, log_num);
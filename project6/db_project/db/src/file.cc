@@ -1,4 +1,33 @@
 #include "file.h"
+#include "uring.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <sys/mman.h>
+
+/* Durability mode of table files */
+int durability_mode = DURABILITY_CHECKPOINT;
+
+/* Pages added per file extension, 0 doubles the file */
+pagenum_t growth_increment = DEFAULT_GROWTH_PAGES;
+
+/* I/O backend of table files */
+int io_backend = IO_BACKEND_PREAD;
+
+/* Rings are per thread, set up on first use */
+thread_local IoUring thread_ring;
+thread_local bool thread_ring_tried = false;
+
+// Get ring of current thread, nullptr if pread backend should be used.
+// a ring that failed once is torn down and the thread stays on pread.
+IoUring* get_thread_ring() {
+    if(io_backend != IO_BACKEND_URING) return nullptr;
+    if(!thread_ring_tried) {
+        thread_ring_tried = true;
+        thread_ring.init();
+    }
+    return thread_ring.is_ready() ? &thread_ring : nullptr;
+}
 
 /* Table Manager Functions */
 
@@ -12,158 +41,737 @@ off_t file_io::get_file_size(int fd) {
 }
 // Read a page(pagenum) of file(fd) into (dest)
 void file_io::read_page(int fd, pagenum_t pagenum, void* dest) {
+    IoUring* ring = get_thread_ring();
+    if(ring != nullptr) {
+        std::vector<uring_req_t> reqs = {{fd, (off_t)(pagenum * PAGE_SIZE), dest, PAGE_SIZE, nullptr, 0}};
+        if(ring->read(reqs)) return;
+        ring->destroy();
+    }
     pread(fd, dest, PAGE_SIZE, pagenum * PAGE_SIZE);
 }
 // Write a src to page(pagenum) of file(fd)
 void file_io::write_page(int fd, pagenum_t pagenum, const page_t* src) {
-    pwrite(fd, src->data, PAGE_SIZE, pagenum * PAGE_SIZE);
-    sync();
+    IoUring* ring = get_thread_ring();
+    bool written = false;
+    if(ring != nullptr) {
+        std::vector<uring_req_t> reqs = {{fd, (off_t)(pagenum * PAGE_SIZE), (void*)src->data, PAGE_SIZE, nullptr, 0}};
+        written = ring->write(reqs);
+        if(!written) ring->destroy();
+    }
+    if(!written) pwrite(fd, src->data, PAGE_SIZE, pagenum * PAGE_SIZE);
+    if(durability_mode == DURABILITY_PER_WRITE) fdatasync(fd);
 }
 // Check validity of the magic number of a current file(fd)
 bool file_io::is_valid_magic_number(int fd) {
-    pagenum_t* buf = (pagenum_t*)malloc(PAGE_SIZE);
-    file_io::read_page(fd, 0, buf);
-    pagenum_t magic_number = buf[0];
-    free(buf);
-    return magic_number == MAGIC_NUMBER;
-}
-// Doubling size of the file(fd)
-void file_io::extend_file(int fd) {
     page_t header_page;
     file_io::read_page(fd, 0, &header_page);
+    pagenum_t magic_number;
+    memcpy(&magic_number, header_page.data, sizeof(pagenum_t));
+    return magic_number == MAGIC_NUMBER;
+}
+// Reserve pages [start_pagenum, start_pagenum + page_cnt) of file(fd) without writing them
+bool file_io::reserve_extent(int fd, pagenum_t start_pagenum, pagenum_t page_cnt) {
+    off_t offset = start_pagenum * PAGE_SIZE;
+    off_t len = page_cnt * PAGE_SIZE;
+    if(fallocate(fd, 0, offset, len) == 0) return true;
+    // no fallocate on this file system, a sparse tail reads as zeroes all the same
+    if(errno == EOPNOTSUPP || errno == ENOSYS) return ftruncate(fd, offset + len) == 0;
+    return false;
+}
+// Grow file(fd) of (header_page) by one extent, the new pages stay unused
+bool file_io::extend_file(int fd, page_t* header_page) {
+    pagenum_t page_cnt = page_io::header::get_page_count(header_page);
+    pagenum_t extent = (growth_increment == 0) ? page_cnt : growth_increment;
+    uint64_t group_cnt = (page_cnt + extent + PAGES_PER_BITMAP - 1) / PAGES_PER_BITMAP;
 
-    pagenum_t num_pages = page_io::header::get_page_count(&header_page);
-    pagenum_t root_page = page_io::header::get_root_page(&header_page);
+    // header has no room for more bitmap pages
+    if(group_cnt > MAX_BITMAP_PAGES) return false;
+    if(!file_io::reserve_extent(fd, page_cnt, extent)) return false;
 
-    page_io::header::set_header_page(&header_page, num_pages, 2 * num_pages, root_page);
-    file_io::write_page(fd, 0, &header_page);
-    file_io::make_free_pages(fd, num_pages, num_pages, 2 * num_pages);
+    // a new group keeps its bitmap in its own first page
+    for(uint64_t group = page_io::header::get_bitmap_count(header_page); group < group_cnt; ++group) {
+        page_t bitmap_page;
+        memset(bitmap_page.data, 0, PAGE_SIZE);
+        page_io::bitmap::set_used(&bitmap_page, 0);
+        file_io::write_page(fd, group * PAGES_PER_BITMAP, &bitmap_page);
+        page_io::header::add_bitmap_page(header_page, group * PAGES_PER_BITMAP);
+    }
+
+    pagenum_t root_page = page_io::header::get_root_page(header_page);
+    page_io::header::set_header_page(header_page, 0, page_cnt + extent, root_page);
+    return true;
 }
-// Make more free pages(new_page_cnt) of file(fd) from (start_page) where total number of pages is (total_cnt)
-void file_io::make_free_pages(int fd, pagenum_t start_pagenum, pagenum_t new_page_cnt, pagenum_t total_cnt) {
+// Build the free space map of a file that still links its free pages, once at open
+bool file_io::convert_free_list(int fd, page_t* header_page) {
+    pagenum_t page_cnt = page_io::header::get_page_count(header_page);
+    uint64_t group_cnt = (page_cnt + PAGES_PER_BITMAP - 1) / PAGES_PER_BITMAP;
+    if(group_cnt > MAX_BITMAP_PAGES) return false;
+
+    std::vector<page_t> bitmap_pages(group_cnt);
+    for(page_t& bitmap_page : bitmap_pages) memset(bitmap_page.data, 0, PAGE_SIZE);
+
+    // pages below the unused extent are in use unless linked in the free page list
+    pagenum_t first_unused_page = page_io::header::get_first_unused_page(header_page);
+    for(pagenum_t i = 0; i < first_unused_page; ++i)
+        page_io::bitmap::set_used(&bitmap_pages[i / PAGES_PER_BITMAP], i % PAGES_PER_BITMAP);
+
     page_t free_page;
-    for(pagenum_t i = start_pagenum; i < start_pagenum + new_page_cnt; i++) {
-        pagenum_t next_free_page = (i + 1) % total_cnt;
-        memcpy(free_page.data, &next_free_page, sizeof(pagenum_t));
-        file_io::write_page(fd, i, &free_page);
+    pagenum_t free_pagenum = page_io::get_next_free_page(header_page, 0);
+    for(pagenum_t i = 0; free_pagenum != 0 && free_pagenum < page_cnt && i < page_cnt; ++i) {
+        page_io::bitmap::set_free(&bitmap_pages[free_pagenum / PAGES_PER_BITMAP], free_pagenum % PAGES_PER_BITMAP);
+        file_io::read_page(fd, free_pagenum, &free_page);
+        free_pagenum = page_io::get_next_free_page(&free_page, free_pagenum);
     }
+
+    // each group keeps its bitmap in a free page of its own, or of any group if it is full
+    std::vector<pagenum_t> bitmap_pagenums(group_cnt);
+    for(uint64_t group = 0; group < group_cnt; ++group) {
+        int64_t idx = -1;
+        for(uint64_t i = 0; i < group_cnt && idx < 0; ++i) {
+            uint64_t owner = (group + i) % group_cnt;
+            idx = page_io::bitmap::find_free(&bitmap_pages[owner], 0, page_io::header::get_group_size(header_page, owner));
+            if(idx < 0) continue;
+            page_io::bitmap::set_used(&bitmap_pages[owner], idx);
+            bitmap_pagenums[group] = owner * PAGES_PER_BITMAP + idx;
+        }
+        if(idx < 0) return false;
+    }
+
+    for(uint64_t group = 0; group < group_cnt; ++group) {
+        file_io::write_page(fd, bitmap_pagenums[group], &bitmap_pages[group]);
+        page_io::header::add_bitmap_page(header_page, bitmap_pagenums[group]);
+    }
+    page_io::header::set_next_free_page(header_page, 0);
+    return true;
+}
+
+// Open table file, dropping O_DIRECT if the file system refuses it
+int open_table_fd(const char* pathname, int flags) {
+    int fd = open(pathname, flags, 0644);
+    if(fd < 0 && errno == EINVAL && (flags & O_DIRECT))
+        fd = open(pathname, flags & ~O_DIRECT, 0644);
+    return fd;
 }
 
 /* Table Manager */
-int64_t TableManager::get_table_id(int fd) {
-    return fd_to_table_id[fd];
+TableManager::TableManager() {
+    for(int i = 0; i < MAX_TABLE_CHUNKS; ++i) chunks[i] = nullptr;
+    catalog_path = DEFAULT_CATALOG_PATH;
+    catalog_loaded = false;
+    next_table_id = 1;
+    open_fd_count = 0;
+    max_open_files = DEFAULT_MAX_OPEN_FILES;
+    use_tick = 0;
+    pthread_mutex_init(&table_manager_latch, NULL);
+}
+// No latch: a table is opened before anyone reads it
+table_file_t* TableManager::get_table(int64_t table_id) {
+    if(table_id < 0 || table_id >= (int64_t)TABLE_CHUNK_SIZE * MAX_TABLE_CHUNKS) return nullptr;
+    table_file_t** chunk = chunks[table_id / TABLE_CHUNK_SIZE];
+    return chunk == nullptr ? nullptr : chunk[table_id % TABLE_CHUNK_SIZE];
+}
+void TableManager::load_catalog() {
+    if(catalog_loaded) return;
+    catalog_loaded = true;
+
+    FILE* catalog_file = fopen(catalog_path.c_str(), "r");
+    if(catalog_file == nullptr) return;
+    char line[4096 + 32];
+    while(fgets(line, sizeof(line), catalog_file) != nullptr) {
+        size_t len = strlen(line);
+        // torn by a crash, the table file was never created
+        if(len == 0 || line[len - 1] != '\n') break;
+        line[len - 1] = '\0';
+
+        char* sep = strchr(line, ' ');
+        if(sep == nullptr) continue;
+        int64_t table_id = strtoll(line, nullptr, 10);
+        if(table_id <= 0 || table_id >= (int64_t)TABLE_CHUNK_SIZE * MAX_TABLE_CHUNKS) continue;
+
+        std::string pathname(sep + 1);
+        catalog[pathname] = table_id;
+        if((int64_t)catalog_paths.size() <= table_id) catalog_paths.resize(table_id + 1);
+        catalog_paths[table_id] = pathname;
+        next_table_id = std::max(next_table_id, table_id + 1);
+    }
+    fclose(catalog_file);
 }
-/* Implemented For Project 6 */   
 int64_t TableManager::get_table_id(std::string pathname) {
-    int64_t table_id = std::stoi(pathname.substr(4));
+    pthread_mutex_lock(&table_manager_latch);
+    load_catalog();
+    auto it = catalog.find(pathname);
+    if(it != catalog.end()) {
+        pthread_mutex_unlock(&table_manager_latch);
+        return it->second;
+    }
+
+    int64_t table_id = next_table_id;
+    // tables of older versions were named DATA<table id>, their log records still use it
+    if(pathname.size() > 4 && pathname.compare(0, 4, "DATA") == 0 && pathname.find_first_not_of("0123456789", 4) == std::string::npos) {
+        int64_t legacy_id = strtoll(pathname.c_str() + 4, nullptr, 10);
+        if(legacy_id > 0 && ((int64_t)catalog_paths.size() <= legacy_id || catalog_paths[legacy_id].empty())) table_id = legacy_id;
+    }
+    if(table_id >= (int64_t)TABLE_CHUNK_SIZE * MAX_TABLE_CHUNKS) {
+        pthread_mutex_unlock(&table_manager_latch);
+        return -1;
+    }
+
+    // on disk before the table file is, so no page is ever written under an id that gets lost
+    std::string line = std::to_string(table_id) + " " + pathname + "\n";
+    int fd = open(catalog_path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    bool persisted = fd >= 0 && write(fd, line.c_str(), line.size()) == (ssize_t)line.size() && fdatasync(fd) == 0;
+    if(fd >= 0) close(fd);
+    if(!persisted) {
+        pthread_mutex_unlock(&table_manager_latch);
+        return -1;
+    }
+
+    catalog[pathname] = table_id;
+    if((int64_t)catalog_paths.size() <= table_id) catalog_paths.resize(table_id + 1);
+    catalog_paths[table_id] = pathname;
+    next_table_id = std::max(next_table_id, table_id + 1);
+    pthread_mutex_unlock(&table_manager_latch);
     return table_id;
 }
+std::string TableManager::get_pathname(int64_t table_id) {
+    pthread_mutex_lock(&table_manager_latch);
+    load_catalog();
+    std::string pathname = (table_id > 0 && table_id < (int64_t)catalog_paths.size()) ? catalog_paths[table_id] : "";
+    pthread_mutex_unlock(&table_manager_latch);
+    return pathname;
+}
+void TableManager::make_room_for_fd() {
+    while(open_fd_count >= max_open_files) {
+        table_file_t* victim = nullptr;
+        for(table_file_t* table : opened_tables)
+            if(table->fd >= 0 && table->users == 0 && (victim == nullptr || table->last_used < victim->last_used)) victim = table;
+        // every fd is in use, go over the limit until some are released
+        if(victim == nullptr) return;
+
+        // checkpoints sync opened files only
+        if(victim->written && durability_mode == DURABILITY_CHECKPOINT) fdatasync(victim->fd);
+        close(victim->fd);
+        victim->fd = -1;
+        victim->written = false;
+        open_fd_count--;
+    }
+}
+void TableManager::insert_table(int64_t table_id, int fd, int flags, std::string pathname) {
+    pthread_mutex_lock(&table_manager_latch);
+    if(get_table(table_id) != nullptr) {
+        close(fd);
+        pthread_mutex_unlock(&table_manager_latch);
+        return;
+    }
+    table_file_t**& chunk = chunks[table_id / TABLE_CHUNK_SIZE];
+    if(chunk == nullptr) chunk = new table_file_t*[TABLE_CHUNK_SIZE]();
+
+    make_room_for_fd();
+    table_file_t* table = new table_file_t{table_id, pathname, flags, fd, 0, true, ++use_tick, {nullptr, 0}, COMPRESSION_NONE, nullptr};
+    opened_tables.push_back(table);
+    open_fd_count++;
+    chunk[table_id % TABLE_CHUNK_SIZE] = table;
+    pthread_mutex_unlock(&table_manager_latch);
+}
+bool TableManager::is_opened(int64_t table_id) {
+    return get_table(table_id) != nullptr;
+}
+int TableManager::acquire_fd(int64_t table_id) {
+    table_file_t* table = get_table(table_id);
+    if(table == nullptr) return -1;
+
+    pthread_mutex_lock(&table_manager_latch);
+    table->last_used = ++use_tick;
+    if(table->fd < 0) {
+        make_room_for_fd();
+        table->fd = open_table_fd(table->pathname.c_str(), table->flags);
+        if(table->fd < 0) {
+            pthread_mutex_unlock(&table_manager_latch);
+            return -1;
+        }
+        open_fd_count++;
+    }
+    table->users++;
+    int fd = table->fd;
+    pthread_mutex_unlock(&table_manager_latch);
+    return fd;
+}
+void TableManager::release_fd(int64_t table_id, bool written) {
+    table_file_t* table = get_table(table_id);
+    if(table == nullptr) return;
+
+    pthread_mutex_lock(&table_manager_latch);
+    table->users--;
+    if(written) table->written = true;
+    pthread_mutex_unlock(&table_manager_latch);
+}
 int TableManager::get_fd(int64_t table_id) {
-    return table_id_to_fd[table_id];
+    int fd = acquire_fd(table_id);
+    release_fd(table_id);
+    return fd;
+}
+void TableManager::sync_files() {
+    std::vector<table_file_t*> tables;
+    pthread_mutex_lock(&table_manager_latch);
+    for(table_file_t* table : opened_tables) {
+        if(table->fd < 0 || !table->written) continue;
+        table->users++;
+        table->written = false;
+        tables.push_back(table);
+    }
+    pthread_mutex_unlock(&table_manager_latch);
+
+    // pinned, so the fd cache leaves them open while they are synced
+    for(table_file_t* table : tables) {
+        fdatasync(table->fd);
+        if(table->extents != nullptr) table->extents->sync();
+    }
+
+    pthread_mutex_lock(&table_manager_latch);
+    for(table_file_t* table : tables) table->users--;
+    pthread_mutex_unlock(&table_manager_latch);
+}
+void TableManager::insert_mapping(int64_t table_id, table_mapping_t mapping) {
+    pthread_mutex_lock(&table_manager_latch);
+    table_file_t* table = get_table(table_id);
+    if(table != nullptr) table->mapping = mapping;
+    pthread_mutex_unlock(&table_manager_latch);
 }
-/* Implemented For Project 6 */   
-void TableManager::insert_table(int fd, std::string pathname) {
-    int64_t table_id = std::stoi(pathname.substr(4));
-    fd_to_table_id.insert({fd, table_id});
-    table_id_to_fd.insert({table_id, fd});
-    opened_files.push_back(fd);
+// No latch, like get_table: a table is opened before anyone reads it
+const table_mapping_t* TableManager::get_mapping(int64_t table_id) {
+    table_file_t* table = get_table(table_id);
+    return (table == nullptr || table->mapping.base == nullptr) ? nullptr : &table->mapping;
 }
-void TableManager::insert_table(int fd) {
-    fd_to_table_id.insert({fd, next_table_id});
-    table_id_to_fd.insert({next_table_id, fd});
-    opened_files.push_back(fd);
-    next_table_id++;
+bool TableManager::set_compression(int64_t table_id, int mode) {
+    pthread_mutex_lock(&table_manager_latch);
+    table_file_t* table = get_table(table_id);
+    if(table == nullptr || table->mapping.base != nullptr) {
+        pthread_mutex_unlock(&table_manager_latch);
+        return false;
+    }
+    if(mode != COMPRESSION_NONE && table->extents == nullptr) {
+        CompressedExtents* extents = new CompressedExtents();
+        if(!extents->open(table->pathname, table->flags)) {
+            delete extents;
+            pthread_mutex_unlock(&table_manager_latch);
+            return false;
+        }
+        table->extents = extents;
+    }
+    table->compression = mode;
+    pthread_mutex_unlock(&table_manager_latch);
+    return true;
+}
+// No latch, like get_table: read on every write back
+int TableManager::get_compression(int64_t table_id) {
+    table_file_t* table = get_table(table_id);
+    return table == nullptr ? COMPRESSION_NONE : table->compression;
+}
+// No latch, extents are created once and freed only by close_all
+CompressedExtents* TableManager::get_extents(int64_t table_id) {
+    table_file_t* table = get_table(table_id);
+    return table == nullptr ? nullptr : table->extents;
+}
+void TableManager::set_catalog_path(const std::string& path) {
+    pthread_mutex_lock(&table_manager_latch);
+    catalog_path = path;
+    catalog.clear();
+    catalog_paths.clear();
+    catalog_loaded = false;
+    next_table_id = 1;
+    pthread_mutex_unlock(&table_manager_latch);
+}
+void TableManager::set_max_open_files(int count) {
+    pthread_mutex_lock(&table_manager_latch);
+    max_open_files = std::max(count, 1);
+    make_room_for_fd();
+    pthread_mutex_unlock(&table_manager_latch);
 }
 void TableManager::close_all() {
-    for(int& fd : opened_files) close(fd);
-    fd_to_table_id.clear();
-    table_id_to_fd.clear();
-    opened_files.clear();
-    next_table_id = 0;
+    pthread_mutex_lock(&table_manager_latch);
+    for(table_file_t* table : opened_tables) {
+        if(table->mapping.base != nullptr) munmap((void*)table->mapping.base, table->mapping.page_cnt * PAGE_SIZE);
+        if(table->fd >= 0) close(table->fd);
+        delete table->extents;
+        delete table;
+    }
+    for(int i = 0; i < MAX_TABLE_CHUNKS; ++i) {
+        delete[] chunks[i];
+        chunks[i] = nullptr;
+    }
+    opened_tables.clear();
+    open_fd_count = 0;
+    // reloaded by the next open, the catalog path may change in between
+    catalog.clear();
+    catalog_paths.clear();
+    catalog_loaded = false;
+    next_table_id = 1;
+    pthread_mutex_unlock(&table_manager_latch);
 }
 
 /* Global Table Manager */
 TableManager table_manager;
 
+// Open existing database file read-only and map it whole
+static int64_t file_map_table_file(const char* pathname) {
+    int64_t table_id = table_manager.get_table_id(std::string(pathname));
+    if(table_id < 0) return -1;
+    int fd = open(pathname, O_RDONLY);
+    if(fd < 0) return -1;
+    if(!file_io::is_valid_magic_number(fd)) {
+        close(fd);
+        return -1;
+    }
+
+    // compressed leaves are not in the file, they can't be read in place
+    page_t header_page;
+    file_io::read_page(fd, 0, &header_page);
+    std::string lz_path = std::string(pathname) + COMPRESSED_FILE_SUFFIX;
+    if(page_io::header::get_compression(&header_page) != COMPRESSION_NONE || access(lz_path.c_str(), F_OK) == 0) {
+        close(fd);
+        return -1;
+    }
+
+    pagenum_t page_cnt = file_io::get_file_size(fd) / PAGE_SIZE;
+    void* base = mmap(NULL, page_cnt * PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if(base == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    // point lookups jump around, kernel read-ahead would only waste memory
+    madvise(base, page_cnt * PAGE_SIZE, MADV_RANDOM);
+
+    table_manager.insert_table(table_id, fd, O_RDONLY, std::string(pathname));
+    table_manager.insert_mapping(table_id, {(const char*)base, page_cnt});
+
+    return table_id;
+}
+
 // Open existing database file or create one if it doesn't exist
-int64_t file_open_table_file(const char* pathname) {
-    int fd = open(pathname, O_RDWR | O_SYNC);
+int64_t file_open_table_file(const char* pathname, int open_mode) {
+    if(open_mode == TABLE_OPEN_MMAP_READONLY) return file_map_table_file(pathname);
+
+    int flags = O_RDWR;
+    if(open_mode == TABLE_OPEN_DIRECT) flags |= O_DIRECT;
+
+    int64_t table_id = table_manager.get_table_id(std::string(pathname));
+    if(table_id < 0) return -1;
+
+    int fd = open_table_fd(pathname, flags);
 
     // If file doesn't exist, create one
     if(fd < 0) {
-        fd = open(pathname, O_RDWR | O_CREAT | O_SYNC, 0644);
+        fd = open_table_fd(pathname, flags | O_CREAT);
+        if(fd < 0) return -1;
         pagenum_t page_cnt = INITIAL_DB_FILE_SIZE / PAGE_SIZE;
-        
+
+        // every page but the header and the first bitmap is free
         page_t header_page;
-        page_io::header::set_header_page(&header_page, 1, page_cnt, 0);
+        memset(header_page.data, 0, PAGE_SIZE);
+        page_io::header::set_header_page(&header_page, 0, page_cnt, 0);
+        page_io::header::add_bitmap_page(&header_page, 1);
+
+        page_t bitmap_page;
+        memset(bitmap_page.data, 0, PAGE_SIZE);
+        page_io::bitmap::set_used(&bitmap_page, 0);
+        page_io::bitmap::set_used(&bitmap_page, 1);
+
+        file_io::reserve_extent(fd, 0, page_cnt);
+        file_io::write_page(fd, 1, &bitmap_page);
         file_io::write_page(fd, 0, &header_page);
+    }
 
-        file_io::make_free_pages(fd, 1, page_cnt - 1, page_cnt);
+    if(!file_io::is_valid_magic_number(fd)) {
+        close(fd);
+        return -1;
     }
 
-    if(!file_io::is_valid_magic_number(fd)) return -1;
+    // files from before the free space map
+    page_t header_page;
+    file_io::read_page(fd, 0, &header_page);
+    if(page_io::header::get_bitmap_count(&header_page) == 0) {
+        if(!file_io::convert_free_list(fd, &header_page)) {
+            close(fd);
+            return -1;
+        }
+        file_io::write_page(fd, 0, &header_page);
+    }
 
-    table_manager.insert_table(fd, std::string(pathname));
-    int64_t table_id = table_manager.get_table_id(std::string(pathname));
+    table_manager.insert_table(table_id, fd, flags, std::string(pathname));
 
+    // leaves stored compressed before stay readable after compression is turned off
+    int compression = page_io::header::get_compression(&header_page);
+    std::string lz_path = std::string(pathname) + COMPRESSED_FILE_SUFFIX;
+    if(compression != COMPRESSION_NONE || access(lz_path.c_str(), F_OK) == 0) {
+        if(!table_manager.set_compression(table_id, compression)) return -1;
+    }
     return table_id;
 }
 
-// Allocate an on-disk page from the free page list
-pagenum_t file_alloc_page(int64_t table_id) {
-    int fd = table_manager.get_fd(table_id);
+// Allocate an on-disk page, the free one nearest after (hint) first
+pagenum_t file_alloc_page(int64_t table_id, pagenum_t hint) {
+    int fd = table_manager.acquire_fd(table_id);
+    if(fd < 0) return 0;
 
     page_t header_page;
     file_io::read_page(fd, 0, &header_page);
-    pagenum_t next_free_page = page_io::get_next_free_page(&header_page, 0);
 
-    if(next_free_page == 0) {
-        file_io::extend_file(fd);
-        file_io::read_page(fd, 0, &header_page);
-        next_free_page = page_io::get_next_free_page(&header_page, 0);
-    }
+    page_t bitmap_page;
+    pagenum_t page_cnt = page_io::header::get_page_count(&header_page);
+    uint64_t group_cnt = page_io::header::get_bitmap_count(&header_page);
+    if(hint >= page_cnt) hint = 0;
+    for(uint64_t i = 0; i < group_cnt; ++i) {
+        uint64_t group = (hint / PAGES_PER_BITMAP + i) % group_cnt;
+        uint32_t from = (i == 0) ? hint % PAGES_PER_BITMAP : 0;
+        pagenum_t bitmap_pagenum = page_io::header::get_bitmap_page(&header_page, group);
 
-    page_t free_page;
-    file_io::read_page(fd, next_free_page, &free_page);
-    pagenum_t new_next_free_page = page_io::get_next_free_page(&free_page, next_free_page);
+        file_io::read_page(fd, bitmap_pagenum, &bitmap_page);
+        int64_t idx = page_io::bitmap::find_free(&bitmap_page, from, page_io::header::get_group_size(&header_page, group));
+        if(idx < 0) continue;
 
-    file_io::read_page(fd, 0, &header_page);
-    pagenum_t page_cnt = page_io::header::get_page_count(&header_page);
-    pagenum_t root_page = page_io::header::get_root_page(&header_page);
-    page_io::header::set_header_page(&header_page, new_next_free_page, page_cnt, root_page);
-    file_io::write_page(fd, 0, &header_page);
+        page_io::bitmap::set_used(&bitmap_page, idx);
+        file_io::write_page(fd, bitmap_pagenum, &bitmap_page);
+        table_manager.release_fd(table_id, true);
+        return group * PAGES_PER_BITMAP + idx;
+    }
 
-    return next_free_page;
+    // every page is in use, continue in a new extent
+    bool extended = file_io::extend_file(fd, &header_page);
+    if(extended) file_io::write_page(fd, 0, &header_page);
+    table_manager.release_fd(table_id, true);
+    return extended ? file_alloc_page(table_id, page_cnt) : 0;
 }
 
-// Free an on-disk page to the free page list
+// Free an on-disk page
 void file_free_page(int64_t table_id, pagenum_t pagenum) {
-    int fd = table_manager.get_fd(table_id);
+    int fd = table_manager.acquire_fd(table_id);
+    if(fd < 0) return;
 
     page_t header_page;
     file_io::read_page(fd, 0, &header_page);
+    pagenum_t bitmap_pagenum = page_io::header::get_bitmap_page(&header_page, pagenum / PAGES_PER_BITMAP);
 
-    pagenum_t next_free_page = page_io::get_next_free_page(&header_page, 0);
-    pagenum_t page_cnt = page_io::header::get_page_count(&header_page);
-    pagenum_t root_page = page_io::header::get_root_page(&header_page);
-    page_io::header::set_header_page(&header_page, pagenum, page_cnt, root_page);
-    file_io::write_page(fd, 0, &header_page);
+    page_t bitmap_page;
+    file_io::read_page(fd, bitmap_pagenum, &bitmap_page);
+    page_io::bitmap::set_free(&bitmap_page, pagenum % PAGES_PER_BITMAP);
+    file_io::write_page(fd, bitmap_pagenum, &bitmap_page);
+    table_manager.release_fd(table_id, true);
+}
+
+// Cut table file to its first (page_cnt) pages, the header is updated by the caller
+bool file_truncate_table(int64_t table_id, pagenum_t page_cnt) {
+    int fd = table_manager.acquire_fd(table_id);
+    if(fd < 0) return false;
+    bool truncated = ftruncate(fd, page_cnt * PAGE_SIZE) == 0;
+    CompressedExtents* extents = table_manager.get_extents(table_id);
+    if(truncated && extents != nullptr) extents->drop_from(page_cnt);
+    table_manager.release_fd(table_id, true);
+    return truncated;
+}
+
+// Page of a mapped table, read in place
+const page_t* file_get_mapped_page(int64_t table_id, pagenum_t pagenum) {
+    const table_mapping_t* mapping = table_manager.get_mapping(table_id);
+    if(mapping == nullptr || pagenum >= mapping->page_cnt) return nullptr;
+    return (const page_t*)(mapping->base + pagenum * PAGE_SIZE);
+}
 
-    page_t freed_page;
-    memcpy(freed_page.data, &next_free_page, sizeof(pagenum_t));
-    file_io::write_page(fd, pagenum, &freed_page);
+// Check table is mapped
+bool file_is_mapped(int64_t table_id) {
+    return table_manager.get_mapping(table_id) != nullptr;
+}
+
+// Tell the kernel pages of a mapped table are read soon, runs of pages in one call
+void file_advise_mapped_pages(int64_t table_id, const std::vector<pagenum_t>& pagenums) {
+    const table_mapping_t* mapping = table_manager.get_mapping(table_id);
+    if(mapping == nullptr) return;
+
+    std::vector<pagenum_t> sorted(pagenums);
+    std::sort(sorted.begin(), sorted.end());
+    for(size_t i = 0; i < sorted.size();) {
+        size_t j = i + 1;
+        while(j < sorted.size() && sorted[j] <= sorted[j - 1] + 1) j++;
+        if(sorted[j - 1] < mapping->page_cnt)
+            madvise((void*)(mapping->base + sorted[i] * PAGE_SIZE), (sorted[j - 1] - sorted[i] + 1) * PAGE_SIZE, MADV_WILLNEED);
+        i = j;
+    }
+}
+
+// Grow table file by one extent, (header_page) is updated and written back by the caller
+bool file_extend_table(int64_t table_id, page_t* header_page) {
+    int fd = table_manager.acquire_fd(table_id);
+    if(fd < 0) return false;
+    bool extended = file_io::extend_file(fd, header_page);
+    table_manager.release_fd(table_id, true);
+    return extended;
+}
+
+// Store a leaf of a compressed table in its companion file, false if it goes in place.
+// The slot in the table file is punched out the first time, it is never read again.
+static bool write_compressed_page(int fd, int64_t table_id, pagenum_t pagenum, const page_t* src) {
+    if(table_manager.get_compression(table_id) == COMPRESSION_NONE || pagenum == 0 || !page_io::is_leaf(src)) return false;
+    CompressedExtents* extents = table_manager.get_extents(table_id);
+    bool first_time;
+    if(extents == nullptr || !extents->write_page(pagenum, src, &first_time)) return false;
+    if(first_time) fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, pagenum * PAGE_SIZE, PAGE_SIZE);
+    return true;
+}
+
+// Page written in place, a compressed copy of it is stale from now on
+static void drop_compressed_page(int64_t table_id, pagenum_t pagenum) {
+    CompressedExtents* extents = table_manager.get_extents(table_id);
+    if(extents != nullptr) extents->drop_page(pagenum);
 }
 
 // Read an on-disk page into the in-memory page structure(dest)
 void file_read_page(int64_t table_id, pagenum_t pagenum, struct page_t* dest) {
-    int fd = table_manager.get_fd(table_id);
+    CompressedExtents* extents = table_manager.get_extents(table_id);
+    if(extents != nullptr && extents->read_page(pagenum, dest)) return;
+
+    int fd = table_manager.acquire_fd(table_id);
     file_io::read_page(fd, pagenum, dest);
+    table_manager.release_fd(table_id);
 }
 
 // Write an in-memory page(src) to the on-disk page
 void file_write_page(int64_t table_id, pagenum_t pagenum, const struct page_t* src) {
-    int fd = table_manager.get_fd(table_id);
-    file_io::write_page(fd, pagenum, src);
+    int fd = table_manager.acquire_fd(table_id);
+    if(!write_compressed_page(fd, table_id, pagenum, src)) {
+        file_io::write_page(fd, pagenum, src);
+        drop_compressed_page(table_id, pagenum);
+    }
+    table_manager.release_fd(table_id, true);
+}
+
+// Read pages in one batch
+void file_read_pages(std::vector<file_io_req_t>& all_reqs) {
+    // compressed pages are read one by one, the rest in one batch
+    std::vector<file_io_req_t> reqs;
+    for(file_io_req_t& req : all_reqs) {
+        CompressedExtents* extents = table_manager.get_extents(req.table_id);
+        if(extents == nullptr || !extents->read_page(req.pagenum, req.page)) reqs.push_back(req);
+    }
+
+    // fds stay pinned until the whole batch is read
+    std::vector<int> fds;
+    for(file_io_req_t& req : reqs) fds.push_back(table_manager.acquire_fd(req.table_id));
+
+    IoUring* ring = get_thread_ring();
+    bool done = false;
+    if(ring != nullptr) {
+        std::vector<uring_req_t> uring_reqs;
+        for(size_t i = 0; i < reqs.size(); ++i)
+            uring_reqs.push_back({fds[i], (off_t)(reqs[i].pagenum * PAGE_SIZE), reqs[i].page->data, PAGE_SIZE, nullptr, 0});
+        done = ring->read(uring_reqs);
+        if(!done) ring->destroy();
+    }
+    if(!done)
+        for(size_t i = 0; i < reqs.size(); ++i)
+            pread(fds[i], reqs[i].page->data, PAGE_SIZE, reqs[i].pagenum * PAGE_SIZE);
+
+    for(file_io_req_t& req : reqs) table_manager.release_fd(req.table_id);
+}
+
+// Write pages in one batch, (reqs) is sorted and runs of adjacent pages go in one vectored write
+void file_write_pages(std::vector<file_io_req_t>& reqs) {
+    std::sort(reqs.begin(), reqs.end(), [](const file_io_req_t& a, const file_io_req_t& b) {
+        if(a.table_id != b.table_id) return a.table_id < b.table_id;
+        return a.pagenum < b.pagenum;
+    });
+
+    // one pin per table, held until the writes are done
+    std::vector<std::pair<int64_t, int>> tables;
+    std::vector<file_io_req_t> in_place;
+    for(file_io_req_t& req : reqs) {
+        if(tables.empty() || tables.back().first != req.table_id)
+            tables.push_back({req.table_id, table_manager.acquire_fd(req.table_id)});
+        if(!write_compressed_page(tables.back().second, req.table_id, req.pagenum, req.page)) in_place.push_back(req);
+    }
+
+    std::vector<iovec> iovs(in_place.size());
+    std::vector<uring_req_t> runs;
+    size_t table_idx = 0;
+    for(size_t i = 0; i < in_place.size();) {
+        while(tables[table_idx].first != in_place[i].table_id) table_idx++;
+        int fd = tables[table_idx].second;
+
+        size_t j = i;
+        do {
+            iovs[j].iov_base = in_place[j].page->data;
+            iovs[j].iov_len = PAGE_SIZE;
+            j++;
+        } while(j < in_place.size() && j - i < WRITE_RUN_MAX_PAGES
+        && in_place[j].table_id == in_place[i].table_id && in_place[j].pagenum == in_place[j - 1].pagenum + 1);
+
+        runs.push_back({fd, (off_t)(in_place[i].pagenum * PAGE_SIZE), nullptr, (j - i) * PAGE_SIZE, &iovs[i], (int)(j - i)});
+        i = j;
+    }
+
+    IoUring* ring = get_thread_ring();
+    if(ring == nullptr || !ring->write(runs)) {
+        if(ring != nullptr) ring->destroy();
+        for(uring_req_t& run : runs) pwritev(run.fd, run.iov, run.iovcnt, run.offset);
+    }
+    for(file_io_req_t& req : in_place) drop_compressed_page(req.table_id, req.pagenum);
+
+    // one sync per table instead of one per page
+    if(durability_mode == DURABILITY_PER_WRITE)
+        for(auto& table : tables) fdatasync(table.second);
+    for(auto& table : tables) table_manager.release_fd(table.first, true);
+}
+
+// Choose I/O backend, returns the backend actually in use
+int file_init_io_backend(int backend) {
+    io_backend = IO_BACKEND_PREAD;
+    if(backend == IO_BACKEND_URING) {
+        // probe with a ring of our own, the kernel may not support it
+        IoUring probe;
+        if(probe.init(1)) io_backend = IO_BACKEND_URING;
+    }
+    return io_backend;
+}
+
+// Set growth increment of table files in pages, 0 doubles the file every time
+void file_set_growth_increment(pagenum_t page_cnt) {
+    growth_increment = page_cnt;
+}
+
+// Set durability mode (DURABILITY_NONE / DURABILITY_CHECKPOINT / DURABILITY_PER_WRITE)
+void file_set_durability_mode(int mode) {
+    durability_mode = mode;
+}
+
+// Set compression mode of a table
+bool file_set_table_compression(int64_t table_id, int mode) {
+    if(mode != COMPRESSION_NONE && mode != COMPRESSION_LZ) return false;
+    return table_manager.set_compression(table_id, mode);
+}
+
+// Compression counters of a table since it was opened
+compression_stats_t file_get_compression_stats(int64_t table_id) {
+    CompressedExtents* extents = table_manager.get_extents(table_id);
+    return extents == nullptr ? compression_stats_t() : extents->get_stats();
+}
+
+// Sync opened table files if the durability mode asks for it at checkpoints
+void file_checkpoint_table_files() {
+    if(durability_mode != DURABILITY_CHECKPOINT) return;
+    table_manager.sync_files();
+}
+
+// Set path of the table catalog, before the first table is opened
+void file_set_catalog_path(const char* path) {
+    table_manager.set_catalog_path(std::string(path));
+}
+
+// Set max number of table files kept open, the rest are reopened on demand
+void file_set_max_open_files(int count) {
+    table_manager.set_max_open_files(count);
+}
+
+// Pathname of (table_id) in the table catalog
+std::string file_get_table_path(int64_t table_id) {
+    return table_manager.get_pathname(table_id);
 }
 
 // Close the database file
@@ -0,0 +1,117 @@
+#include "key_search.h"
+
+#include <immintrin.h>
+
+/* Count of (n) keys <= (key), keys are (stride) bytes apart from (base) */
+typedef int (*count_le_t)(const char* base, int stride, int n, int64_t key);
+
+static int count_le_scalar(const char* base, int stride, int n, int64_t key) {
+    int count = 0;
+    for(int i = 0; i < n; ++i) {
+        int64_t k;
+        memcpy(&k, base + i * stride, sizeof(int64_t));
+        count += (k <= key);
+    }
+    return count;
+}
+
+/* Only whole groups of keys are loaded, lanes past the last key may be past the page */
+__attribute__((target("sse4.2")))
+static int count_le_sse42(const char* base, int stride, int n, int64_t key) {
+    __m128i key_vec = _mm_set1_epi64x(key);
+    int greater = 0;
+    int i = 0;
+    for(; i + 2 <= n; i += 2) {
+        __m128i keys = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(base + i * stride)),
+                                          _mm_loadl_epi64((const __m128i*)(base + (i + 1) * stride)));
+        greater += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(keys, key_vec))));
+    }
+    return i - greater + count_le_scalar(base + i * stride, stride, n - i, key);
+}
+
+/* Four keys per compare, lane order doesn't matter for a count */
+__attribute__((target("avx2")))
+static inline __m256i load_keys_avx2(const char* base, int stride) {
+    if(stride == 16) {
+        // internal pages: key, child, key, child. unpack keeps the keys of two loads
+        __m256i lo = _mm256_loadu_si256((const __m256i*)base);
+        __m256i hi = _mm256_loadu_si256((const __m256i*)(base + 32));
+        return _mm256_unpacklo_epi64(lo, hi);
+    }
+    if(stride == SLOT_SIZE) {
+        // leaf slots: keys at bytes 0, 12, 24 of one load and 24 of a second one 12 bytes on
+        __m256i lo = _mm256_loadu_si256((const __m256i*)base);
+        __m256i hi = _mm256_loadu_si256((const __m256i*)(base + SLOT_SIZE));
+        __m256i packed = _mm256_permutevar8x32_epi32(lo, _mm256_set_epi32(7, 6, 7, 6, 4, 3, 1, 0));
+        return _mm256_blend_epi32(packed, hi, 0xc0);
+    }
+    __m256i offsets = _mm256_set_epi64x(3 * stride, 2 * stride, stride, 0);
+    return _mm256_i64gather_epi64((const long long*)base, offsets, 1);
+}
+
+/* Loads end at most 8 bytes past the last key, still inside the page */
+__attribute__((target("avx2")))
+static int count_le_avx2(const char* base, int stride, int n, int64_t key) {
+    __m256i key_vec = _mm256_set1_epi64x(key);
+    int greater = 0;
+    int i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m256i keys = load_keys_avx2(base + i * stride, stride);
+        greater += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(keys, key_vec))));
+    }
+    return i - greater + count_le_sse42(base + i * stride, stride, n - i, key);
+}
+
+static int best_kernel() {
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) return KEY_SEARCH_AVX2;
+    if(__builtin_cpu_supports("sse4.2")) return KEY_SEARCH_SSE42;
+    return KEY_SEARCH_SCALAR;
+}
+static count_le_t kernel_fn(int kernel) {
+    if(kernel == KEY_SEARCH_AVX2) return count_le_avx2;
+    if(kernel == KEY_SEARCH_SSE42) return count_le_sse42;
+    return count_le_scalar;
+}
+
+/* Picked before main, the search never branches on it */
+static int kernel_in_use = best_kernel();
+static count_le_t count_le = kernel_fn(kernel_in_use);
+
+/* Number of the (n) sorted keys <= (key) */
+static int upper_bound(const char* base, int stride, int n, int64_t key) {
+    // the answer stays in [lo, lo + n], the step compiles to a conditional move
+    int lo = 0;
+    while(n > KEY_SEARCH_WINDOW) {
+        int half = n / 2;
+        int64_t k;
+        memcpy(&k, base + (lo + half) * stride, sizeof(int64_t));
+        lo = (k <= key) ? lo + half : lo;
+        n -= half;
+    }
+    return lo + count_le(base + lo * stride, stride, n, key);
+}
+
+slotnum_t key_search::internal_child_idx(const page_t* internal_page, int64_t key) {
+    const char* keys = internal_page->data + INTERNAL_PAGE_OFFSET + sizeof(pagenum_t);
+    return upper_bound(keys, 2 * sizeof(pagenum_t), page_io::get_key_count(internal_page), key);
+}
+slotnum_t key_search::leaf_upper_bound(const page_t* leaf_page, int64_t key) {
+    const char* keys = leaf_page->data + LEAF_PAGE_SLOT_OFFSET;
+    return upper_bound(keys, SLOT_SIZE, page_io::get_key_count(leaf_page), key);
+}
+slotnum_t key_search::leaf_find_slot(const page_t* leaf_page, int64_t key) {
+    slotnum_t idx = leaf_upper_bound(leaf_page, key);
+    if(idx == 0 || page_io::leaf::get_key(leaf_page, idx - 1) != key) return -1;
+    return idx - 1;
+}
+int key_search::set_kernel(int kernel) {
+    int best = best_kernel();
+    if(kernel == KEY_SEARCH_AUTO || kernel > best) kernel = best;
+    kernel_in_use = kernel;
+    count_le = kernel_fn(kernel);
+    return kernel_in_use;
+}
+int key_search::get_kernel() {
+    return kernel_in_use;
+}
@@ -5,7 +5,8 @@
 typedef struct lock_t lock_t;
 typedef struct lock_table_entry_t lock_table_entry_t;
 
-std::unordered_map<int64_t, lock_table_entry_t*> lock_table;
+// ordered by (table_id, key), vacuum asks for key ranges
+std::map<std::pair<int64_t, int64_t>, lock_table_entry_t*> lock_table;
 
 pthread_mutex_t lock_table_latch;
 
@@ -40,8 +41,9 @@ void unlink_and_wake_threads(lock_t* lock_obj) {
 
     lock_t* cur_lock_obj = lock_obj->sentinel->head->next;
     if(cur_lock_obj == lock_obj) cur_lock_obj = cur_lock_obj->next;
-    lock_t* tail = lock_obj->sentinel->tail;
-    pagenum_t record_id = lock_obj->record_id;
+    lock_table_entry_t* entry = lock_obj->sentinel;
+    lock_t* tail = entry->tail;
+    int64_t record_id = lock_obj->record_id;
     int owner_trx_id = lock_obj->owner_trx_id;
 
     lock_obj->prev->next = lock_obj->next;
@@ -49,6 +51,14 @@ void unlink_and_wake_threads(lock_t* lock_obj) {
 
     delete lock_obj;
 
+    // keys come and go, an entry lives as long as its locks
+    if(entry->head->next == tail) {
+        lock_table.erase({entry->table_id, entry->key});
+        delete entry;
+        pthread_mutex_unlock(&lock_table_latch);
+        return;
+    }
+
     while(cur_lock_obj != tail) {
         if(cur_lock_obj->record_id != record_id
         || cur_lock_obj->owner_trx_id == owner_trx_id) {
@@ -98,15 +108,15 @@ int init_lock_table() {
     return 0;
 }
 
-lock_t* lock_acquire(int64_t table_id, pagenum_t page_id, int64_t key, int trx_id, int lock_mode) {
-    int64_t combined_key = (table_id << 32) | page_id;
+lock_t* lock_acquire(int64_t table_id, int64_t key, int trx_id, int lock_mode) {
+    std::pair<int64_t, int64_t> combined_key = {table_id, key};
 
     lock_t* ret_obj = nullptr;
     pthread_mutex_lock(&lock_table_latch);
 
     // * CASE : there is a NO combined_key entry in lock table.
     if(lock_table.find(combined_key) == lock_table.end()) {
-        lock_table.insert({combined_key, new lock_table_entry_t(table_id, page_id)});
+        lock_table.insert({combined_key, new lock_table_entry_t(table_id, key)});
 
         lock_t* lock_obj = new lock_t(key, trx_id, lock_mode);
         lock_obj->sentinel = lock_table[combined_key];
@@ -209,3 +219,13 @@ int lock_release(lock_t* lock_obj) {
     unlink_and_wake_threads(lock_obj);
     return 0;
 }
+
+// Check any transaction holds or waits for a record lock on keys [low_key, high_key]
+bool lock_is_range_locked(int64_t table_id, int64_t low_key, int64_t high_key) {
+    pthread_mutex_lock(&lock_table_latch);
+    auto it = lock_table.lower_bound({table_id, low_key});
+    bool locked = it != lock_table.end() && it->first <= std::make_pair(table_id, high_key);
+    pthread_mutex_unlock(&lock_table_latch);
+
+    return locked;
+}
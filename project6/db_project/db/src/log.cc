@@ -12,12 +12,12 @@ LogBufferManager log_buf_manager;
 pthread_mutex_t log_buffer_manager_latch;
 
 /* Base Log Definition */
-void log_t::write_log(int fd) {
-    write(fd, &log_size, sizeof(log_size));
-    write(fd, &LSN, sizeof(LSN));
-    write(fd, &prev_LSN, sizeof(prev_LSN));
-    write(fd, &trx_id, sizeof(trx_id));
-    write(fd, &log_type, sizeof(log_type));
+void log_t::write_log(std::string& out) {
+    out.append((const char*)&log_size, sizeof(log_size));
+    out.append((const char*)&LSN, sizeof(LSN));
+    out.append((const char*)&prev_LSN, sizeof(prev_LSN));
+    out.append((const char*)&trx_id, sizeof(trx_id));
+    out.append((const char*)&log_type, sizeof(log_type));
 }
 
 /* Begin Log Definition */
@@ -35,9 +35,8 @@ begin_log_t::begin_log_t(int trx_id) {
     this->trx_id = trx_id;
     log_type = BEGIN_LOG;
 }
-void begin_log_t::write_log(int fd) {
-    log_t::write_log(fd);
-    sync();
+void begin_log_t::write_log(std::string& out) {
+    log_t::write_log(out);
 }   
 
 /* Commit Log Definition */
@@ -55,9 +54,8 @@ commit_log_t::commit_log_t(int trx_id) {
     this->trx_id = trx_id;
     log_type = COMMIT_LOG;
 }
-void commit_log_t::write_log(int fd) {
-    log_t::write_log(fd);
-    sync(); 
+void commit_log_t::write_log(std::string& out) {
+    log_t::write_log(out);
 }
 
 /* Rollback Log Definition */
@@ -75,9 +73,8 @@ rollback_log_t::rollback_log_t(int trx_id) {
     this->trx_id = trx_id;
     log_type = ROLLBACK_LOG;
 }
-void rollback_log_t::write_log(int fd) {
-    log_t::write_log(fd);
-    sync();
+void rollback_log_t::write_log(std::string& out) {
+    log_t::write_log(out);
 }
 
 /* Update Log Definition */
@@ -107,15 +104,14 @@ update_log_t::update_log_t(int trx_id, uint64_t table_id, uint64_t page_id, slot
     this->old_image = old_image;
     this->new_image = new_image;
 }
-void update_log_t::write_log(int fd) {
-    log_t::write_log(fd);
-    write(fd, &table_id, sizeof(table_id));
-    write(fd, &page_id, sizeof(page_id));
-    write(fd, &offset, sizeof(offset));
-    write(fd, &data_length, sizeof(data_length));
-    write(fd, (const char*)old_image.c_str(), old_image.length());
-    write(fd, (const char*)new_image.c_str(), new_image.length());
-    sync();
+void update_log_t::write_log(std::string& out) {
+    log_t::write_log(out);
+    out.append((const char*)&table_id, sizeof(table_id));
+    out.append((const char*)&page_id, sizeof(page_id));
+    out.append((const char*)&offset, sizeof(offset));
+    out.append((const char*)&data_length, sizeof(data_length));
+    out.append(old_image);
+    out.append(new_image);
 }
 void update_log_t::add_old_image(std::string old_img) {
     old_image = old_img;
@@ -155,16 +151,15 @@ compensate_log_t::compensate_log_t(int trx_id, uint64_t table_id, uint64_t page_
     this->old_image = old_image;
     this->new_image = new_image;
 }
-void compensate_log_t::write_log(int fd) {
-    log_t::write_log(fd);
-    write(fd, &table_id, sizeof(table_id));
-    write(fd, &page_id, sizeof(page_id));
-    write(fd, &offset, sizeof(offset));
-    write(fd, &data_length, sizeof(data_length));
-    write(fd, (const char*)old_image.c_str(), old_image.length());
-    write(fd, (const char*)new_image.c_str(), new_image.length());
-    write(fd, &next_undo_LSN, sizeof(next_undo_LSN));
-    sync();
+void compensate_log_t::write_log(std::string& out) {
+    log_t::write_log(out);
+    out.append((const char*)&table_id, sizeof(table_id));
+    out.append((const char*)&page_id, sizeof(page_id));
+    out.append((const char*)&offset, sizeof(offset));
+    out.append((const char*)&data_length, sizeof(data_length));
+    out.append(old_image);
+    out.append(new_image);
+    out.append((const char*)&next_undo_LSN, sizeof(next_undo_LSN));
 }
 void compensate_log_t::add_old_image(std::string old_img) {
     old_image = old_img;
@@ -175,16 +170,82 @@ void compensate_log_t::add_new_image(std::string new_img) {
     log_size += new_image.length();
 }
 
+/* Begin Checkpoint Log Definition */
+begin_checkpoint_log_t::begin_checkpoint_log_t() {
+    log_size = DEFAULT_LOG_SIZE;
+    LSN = -1;
+    prev_LSN = 0;
+    trx_id = 0;
+    log_type = BEGIN_CHECKPOINT_LOG;
+}
+void begin_checkpoint_log_t::write_log(std::string& out) {
+    log_t::write_log(out);
+}
+
+/* End Checkpoint Log Definition */
+end_checkpoint_log_t::end_checkpoint_log_t() {
+    log_size = DEFAULT_END_CHECKPOINT_LOG_SIZE;
+    LSN = -1;
+    prev_LSN = 0;
+    trx_id = 0;
+    log_type = END_CHECKPOINT_LOG;
+}
+end_checkpoint_log_t::end_checkpoint_log_t(const std::vector<std::pair<int, uint64_t>>& active_trx, const std::vector<dirty_page_t>& dirty_pages) {
+    log_size = DEFAULT_END_CHECKPOINT_LOG_SIZE
+    + active_trx.size() * CHECKPOINT_TRX_ENTRY_SIZE + dirty_pages.size() * CHECKPOINT_PAGE_ENTRY_SIZE;
+    LSN = -1;
+    prev_LSN = 0;
+    trx_id = 0;
+    log_type = END_CHECKPOINT_LOG;
+    this->active_trx = active_trx;
+    this->dirty_pages = dirty_pages;
+}
+void end_checkpoint_log_t::write_log(std::string& out) {
+    log_t::write_log(out);
+    uint32_t trx_cnt = active_trx.size();
+    uint32_t page_cnt = dirty_pages.size();
+    out.append((const char*)&trx_cnt, sizeof(trx_cnt));
+    out.append((const char*)&page_cnt, sizeof(page_cnt));
+    for(const auto& trx : active_trx) {
+        uint32_t id = trx.first;
+        out.append((const char*)&id, sizeof(id));
+        out.append((const char*)&trx.second, sizeof(trx.second));
+    }
+    for(const dirty_page_t& page : dirty_pages) {
+        uint64_t table_id = page.table_id;
+        out.append((const char*)&table_id, sizeof(table_id));
+        out.append((const char*)&page.pagenum, sizeof(page.pagenum));
+        out.append((const char*)&page.rec_LSN, sizeof(page.rec_LSN));
+    }
+}
+
 /************************************************************************/
 // * LOG BUFFER MANAGER                                                 //
 /************************************************************************/
 
 /* Log Buffer Manager Definition */
 LogBufferManager::LogBufferManager() {
+    // error checking, a page evicted during recovery forces the log under the latch recovery holds
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ERRORCHECK);
+    pthread_mutex_init(&log_buffer_manager_latch, &attr);
+    pthread_mutexattr_destroy(&attr);
     next_LSN = 0;
     max_size = 0;
     log_path = nullptr;
     logmsg_path = nullptr;
+    log_opened = false;
+    master_fd = -1;
+    redo_LSN = 0;
+    checkpointer_running = false;
+    pthread_mutex_init(&checkpointer_latch, NULL);
+    pthread_cond_init(&checkpointer_cond, NULL);
+    checkpoint_interval_ms = CHECKPOINT_INTERVAL_MS;
+    last_checkpoint_end = 0;
+    segment_size = default_segment_size = LOG_SEGMENT_SIZE;
+    first_segment = 0;
+    last_segment = 0;
 }
 void LogBufferManager::init(int buf_size, char* log_path, char* logmsg_path) {
     max_size = buf_size;
@@ -193,41 +254,58 @@ void LogBufferManager::init(int buf_size, char* log_path, char* logmsg_path) {
     strcpy(this->log_path, log_path);
     strcpy(this->logmsg_path, logmsg_path);
 
-    log_file_fd = open(log_path, O_RDWR | O_CREAT | O_SYNC | O_APPEND, 0644);
+    open_segments();
+    log_opened = true;
     logmsg_file = fopen(logmsg_path, "a+");
+
+    std::string master_path = std::string(log_path) + CHECKPOINT_MASTER_SUFFIX;
+    master_fd = open(master_path.c_str(), O_RDWR | O_CREAT, 0644);
 }
-void LogBufferManager::add_log(log_t* log) {
+uint64_t LogBufferManager::add_log(log_t* log) {
     pthread_mutex_lock(&log_buffer_manager_latch);
-
-    if(log_buf.size() == max_size) 
-        flush_logs();
-
-    log->LSN = next_LSN;
-    log->prev_LSN = trx_last_LSN[log->trx_id];
-    trx_last_LSN[log->trx_id] = log->LSN;
-    next_LSN += log->log_size;
-
-    log_buf.push_back(log);
-
+    uint64_t LSN = add_log_no_latch(log);
     pthread_mutex_unlock(&log_buffer_manager_latch);
+    return LSN;
 }
-void LogBufferManager::add_log_no_latch(log_t* log) {
+uint64_t LogBufferManager::add_log_no_latch(log_t* log) {
     if(log_buf.size() == max_size) 
         flush_logs();
 
     log->LSN = next_LSN;
-    log->prev_LSN = trx_last_LSN[log->trx_id];
-    trx_last_LSN[log->trx_id] = log->LSN;
+    // checkpoint records belong to no transaction
+    if(log->log_type != BEGIN_CHECKPOINT_LOG && log->log_type != END_CHECKPOINT_LOG) {
+        log->prev_LSN = trx_last_LSN[log->trx_id];
+        trx_last_LSN[log->trx_id] = log->LSN;
+        trx_first_LSN.emplace(log->trx_id, log->LSN);
+    }
+    // trx_last_LSN keeps running transactions only, checkpoints record it as is
+    if(log->log_type == COMMIT_LOG || log->log_type == ROLLBACK_LOG) {
+        trx_last_LSN.erase(log->trx_id);
+        trx_first_LSN.erase(log->trx_id);
+    }
+    uint64_t LSN = log->LSN;
     next_LSN += log->log_size;
 
     log_buf.push_back(log);
+    return LSN;
 }
 void LogBufferManager::flush_logs() {
+    if(log_buf.empty()) return;
+
+    // records in the buffer are contiguous from the first LSN
+    uint64_t start_LSN = log_buf.front()->LSN;
+    std::string out;
     for(int i = 0; i < log_buf.size(); i++) {
-        log_buf[i]->write_log(log_file_fd);
+        log_buf[i]->write_log(out);
         delete log_buf[i];
     }
     log_buf = {};
+
+    write_log_bytes(out.data(), out.size(), start_LSN);
+
+    // one data sync per group of records and segment, segments never grow so no metadata goes with it
+    for(uint64_t segno = start_LSN / segment_size; segno <= (start_LSN + out.size() - 1) / segment_size; ++segno)
+        fdatasync(get_segment_fd(segno, true));
 }
 begin_log_t LogBufferManager::make_begin_log(char* buf) {
     begin_log_t log;
@@ -297,6 +375,222 @@ compensate_log_t LogBufferManager::make_compensate_log(char* buf) {
     return log;
 }
 
+end_checkpoint_log_t LogBufferManager::make_end_checkpoint_log(char* buf) {
+    end_checkpoint_log_t log;
+    memcpy(&log.log_size, buf, sizeof(log.log_size));
+    memcpy(&log.LSN, buf + sizeof(log.log_size), sizeof(log.LSN));
+    memcpy(&log.prev_LSN, buf + sizeof(log.log_size) + sizeof(log.LSN), sizeof(log.prev_LSN));
+    memcpy(&log.trx_id, buf + sizeof(log.log_size) + sizeof(log.LSN) + sizeof(log.prev_LSN), sizeof(log.trx_id));
+    memcpy(&log.log_type, buf + sizeof(log.log_size) + sizeof(log.LSN) + sizeof(log.prev_LSN) + sizeof(log.trx_id), sizeof(log.log_type));
+
+    uint32_t trx_cnt, page_cnt;
+    char* cur = buf + DEFAULT_LOG_SIZE;
+    memcpy(&trx_cnt, cur, sizeof(trx_cnt)); cur += sizeof(trx_cnt);
+    memcpy(&page_cnt, cur, sizeof(page_cnt)); cur += sizeof(page_cnt);
+    for(uint32_t i = 0; i < trx_cnt; ++i) {
+        uint32_t trx_id;
+        uint64_t last_LSN;
+        memcpy(&trx_id, cur, sizeof(trx_id)); cur += sizeof(trx_id);
+        memcpy(&last_LSN, cur, sizeof(last_LSN)); cur += sizeof(last_LSN);
+        log.active_trx.push_back({trx_id, last_LSN});
+    }
+    for(uint32_t i = 0; i < page_cnt; ++i) {
+        dirty_page_t page;
+        memcpy(&page.table_id, cur, sizeof(page.table_id)); cur += sizeof(page.table_id);
+        memcpy(&page.pagenum, cur, sizeof(page.pagenum)); cur += sizeof(page.pagenum);
+        memcpy(&page.rec_LSN, cur, sizeof(page.rec_LSN)); cur += sizeof(page.rec_LSN);
+        log.dirty_pages.push_back(page);
+    }
+    return log;
+}
+
+/************************************************************************/
+// * LOG SEGMENTS                                                       //
+/************************************************************************/
+
+/* Split log path into its directory and file name */
+static void split_log_path(const char* log_path, std::string& dir, std::string& name) {
+    std::string path(log_path);
+    size_t slash = path.rfind('/');
+    dir = (slash == std::string::npos) ? "." : path.substr(0, slash + 1);
+    name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+}
+
+std::string LogBufferManager::segment_path(uint64_t segno) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%0*lu", LOG_SEGMENT_DIGITS, segno);
+    return std::string(log_path) + suffix;
+}
+/* Make renames and new segments durable */
+void LogBufferManager::sync_log_dir() {
+    std::string dir, name;
+    split_log_path(log_path, dir, name);
+    int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if(dir_fd < 0) return;
+    fsync(dir_fd);
+    close(dir_fd);
+}
+int LogBufferManager::get_segment_fd(uint64_t segno, bool create) {
+    auto it = segment_fds.find(segno);
+    if(it != segment_fds.end()) return it->second;
+
+    std::string path = segment_path(segno);
+    int fd = open(path.c_str(), O_RDWR);
+    if(fd < 0) {
+        if(!create) return -1;
+
+        // zeroes are written, not fallocated, so appends convert no unwritten extents either.
+        // filled under a temporary name, a torn segment is never taken for a log one
+        std::string tmp_path = path + ".tmp";
+        fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) return -1;
+        char* zero = new char[LOG_SEGMENT_FILL_CHUNK]();
+        for(uint64_t offset = 0; offset < segment_size; offset += LOG_SEGMENT_FILL_CHUNK)
+            pwrite(fd, zero, std::min<uint64_t>(LOG_SEGMENT_FILL_CHUNK, segment_size - offset), offset);
+        delete[] zero;
+        fsync(fd);
+        rename(tmp_path.c_str(), path.c_str());
+        sync_log_dir();
+        last_segment = std::max(last_segment, segno);
+    }
+    segment_fds[segno] = fd;
+    return fd;
+}
+void LogBufferManager::open_segments() {
+    std::string dir, name;
+    split_log_path(log_path, dir, name);
+    std::string prefix = name + ".";
+
+    bool found = false;
+    segment_size = default_segment_size;
+    first_segment = last_segment = 0;
+    DIR* log_dir = opendir(dir.c_str());
+    if(log_dir != nullptr) {
+        struct dirent* entry;
+        while((entry = readdir(log_dir)) != nullptr) {
+            std::string file_name(entry->d_name);
+            if(file_name.size() <= prefix.size() || file_name.compare(0, prefix.size(), prefix) != 0) continue;
+            std::string number = file_name.substr(prefix.size());
+            if(number.find_first_not_of("0123456789") != std::string::npos) continue;
+
+            uint64_t segno = strtoull(number.c_str(), nullptr, 10);
+            first_segment = found ? std::min(first_segment, segno) : segno;
+            last_segment = found ? std::max(last_segment, segno) : segno;
+            found = true;
+        }
+        closedir(log_dir);
+    }
+
+    struct stat st;
+    // segments are filled when created, any of them tells how the log was split
+    if(found && stat(segment_path(first_segment).c_str(), &st) == 0 && st.st_size > 0)
+        segment_size = st.st_size;
+
+    // one append only file of older versions, LSNs stay file offsets
+    if(!found && stat(log_path, &st) == 0 && S_ISREG(st.st_mode)) {
+        int fd = open(log_path, O_RDONLY);
+        char* chunk = new char[LOG_SEGMENT_FILL_CHUNK];
+        uint64_t offset = 0;
+        ssize_t len;
+        while(fd >= 0 && (len = pread(fd, chunk, LOG_SEGMENT_FILL_CHUNK, offset)) > 0) {
+            write_log_bytes(chunk, len, offset);
+            offset += len;
+        }
+        delete[] chunk;
+        if(fd >= 0) close(fd);
+        for(const auto& segment : segment_fds) fdatasync(segment.second);
+        unlink(log_path);
+        sync_log_dir();
+    }
+}
+/* Records may cross segment boundaries */
+void LogBufferManager::write_log_bytes(const char* src, uint64_t size, uint64_t LSN) {
+    while(size > 0) {
+        uint64_t offset = LSN % segment_size;
+        uint64_t len = std::min(size, segment_size - offset);
+        pwrite(get_segment_fd(LSN / segment_size, true), src, len, offset);
+        src += len, LSN += len, size -= len;
+    }
+}
+bool LogBufferManager::read_log_bytes(char* dest, uint64_t size, uint64_t LSN) {
+    while(size > 0) {
+        uint64_t offset = LSN % segment_size;
+        uint64_t len = std::min(size, segment_size - offset);
+        int fd = get_segment_fd(LSN / segment_size, false);
+        if(fd < 0 || pread(fd, dest, len, offset) != (ssize_t)len) return false;
+        dest += len, LSN += len, size -= len;
+    }
+    return true;
+}
+char* LogBufferManager::read_log_record(uint64_t LSN, uint32_t* log_size, uint32_t* log_type) {
+    char header[DEFAULT_LOG_SIZE];
+    if(!read_log_bytes(header, DEFAULT_LOG_SIZE, LSN)) return nullptr;
+
+    uint64_t record_LSN;
+    memcpy(log_size, header, sizeof(uint32_t));
+    memcpy(&record_LSN, header + sizeof(uint32_t), sizeof(uint64_t));
+    memcpy(log_type, header + sizeof(uint32_t) * 2 + sizeof(uint64_t) * 2, sizeof(uint32_t));
+    // zero filled tail, or a reused segment whose old records carry other LSNs
+    if(record_LSN != LSN || *log_size < DEFAULT_LOG_SIZE || *log_type > END_CHECKPOINT_LOG) return nullptr;
+
+    char* buf = new char[*log_size];
+    if(!read_log_bytes(buf, *log_size, LSN)) {
+        delete[] buf;
+        return nullptr;
+    }
+    return buf;
+}
+void LogBufferManager::recycle_segments(uint64_t keep_LSN) {
+    uint64_t keep_segment = keep_LSN / segment_size;
+    uint64_t cur_segment = next_LSN / segment_size;
+    if(first_segment >= keep_segment) return;
+
+    std::string dir, name;
+    split_log_path(log_path, dir, name);
+    for(; first_segment < keep_segment; ++first_segment) {
+        auto it = segment_fds.find(first_segment);
+        if(it != segment_fds.end()) {
+            close(it->second);
+            segment_fds.erase(it);
+        }
+
+        std::string path = segment_path(first_segment);
+        if(!archive_dir.empty()) {
+            std::string archive_path = archive_dir + "/" + name + path.substr(path.size() - LOG_SEGMENT_DIGITS - 1);
+            rename(path.c_str(), archive_path.c_str());
+        }
+        // renamed ahead of the log, appends overwrite it without allocating
+        else if(last_segment < cur_segment + LOG_SEGMENT_SPARES) {
+            if(rename(path.c_str(), segment_path(last_segment + 1).c_str()) == 0) ++last_segment;
+        }
+        else unlink(path.c_str());
+    }
+    sync_log_dir();
+}
+
+/* Master record points at the begin record of a checkpoint whose end record is on disk */
+uint64_t LogBufferManager::read_master_record() {
+    uint64_t begin_LSN;
+    if(master_fd < 0 || pread(master_fd, &begin_LSN, sizeof(begin_LSN), 0) != sizeof(begin_LSN)) return 0;
+
+    uint32_t log_size, log_type;
+    char* buf = read_log_record(begin_LSN, &log_size, &log_type);
+    if(buf == nullptr) return 0;
+    delete[] buf;
+    return (log_type == BEGIN_CHECKPOINT_LOG) ? begin_LSN : 0;
+}
+void LogBufferManager::write_master_record(uint64_t begin_LSN) {
+    if(master_fd < 0) return;
+    pwrite(master_fd, &begin_LSN, sizeof(begin_LSN), 0);
+    fdatasync(master_fd);
+}
+/* Add page to the dirty page table of analysis, keeping the oldest recLSN */
+void LogBufferManager::note_dirty_page(int64_t table_id, pagenum_t pagenum, uint64_t rec_LSN) {
+    auto it = dirty_pages.find({table_id, pagenum});
+    if(it == dirty_pages.end()) dirty_pages[{table_id, pagenum}] = rec_LSN;
+    else it->second = std::min(it->second, rec_LSN);
+}
+
 /**
  * @brief read log to analyze it has been crashed or not
  * @return int (0 : not crashed, 1 : crashed)
@@ -304,20 +598,19 @@ compensate_log_t LogBufferManager::make_compensate_log(char* buf) {
 int LogBufferManager::analyze_log() {
     fprintf(logmsg_file, "[ANALYSIS] Analysis pass start\n");
 
-    off_t cur_offset = 0;
-    off_t end_offset = lseek(log_file_fd, 0, SEEK_END);
-    lseek(log_file_fd, 0, SEEK_SET);
+    uint64_t cur_offset = read_master_record();
+    if(cur_offset != 0) fprintf(logmsg_file, "[ANALYSIS] Start from checkpoint LSN %lu\n", cur_offset);
+    else cur_offset = first_segment * segment_size;
 
     std::set<int> trx_set;
+    dirty_pages.clear();
 
-    while(cur_offset != end_offset) {
+    while(true) {
         uint32_t log_size;
         uint32_t log_type;
-        pread(log_file_fd, &log_size, sizeof(log_size), cur_offset);
-        pread(log_file_fd, &log_type, sizeof(log_type), cur_offset + sizeof(uint32_t) * 2 + sizeof(uint64_t) * 2);
-
-        char* tmp_buf = new char[log_size];
-        pread(log_file_fd, tmp_buf, log_size, cur_offset);
+        char* tmp_buf = read_log_record(cur_offset, &log_size, &log_type);
+        // end of log
+        if(tmp_buf == nullptr) break;
 
         /* IN ANLYZE LOG, WE ONLY CONSIDER BEGIN, COMMIT, ROLLBACK LOG */
 
@@ -332,24 +625,37 @@ int LogBufferManager::analyze_log() {
             commit_log_t commit_log = make_commit_log(tmp_buf);
             trx_set.erase(commit_log.trx_id);
             win_trx.insert(commit_log.trx_id);
-            trx_last_LSN[commit_log.trx_id] = commit_log.LSN;
+            trx_last_LSN.erase(commit_log.trx_id);
         }
         // trx abort
         else if(log_type == ROLLBACK_LOG) {
             rollback_log_t rollback_log = make_rollback_log(tmp_buf);
             trx_set.erase(rollback_log.trx_id);
             win_trx.insert(rollback_log.trx_id);
-            trx_last_LSN[rollback_log.trx_id] = rollback_log.LSN;
+            trx_last_LSN.erase(rollback_log.trx_id);
         }
         // update
         else if(log_type == UPDATE_LOG) {
             update_log_t update_log = make_update_log(tmp_buf);
             trx_last_LSN[update_log.trx_id] = update_log.LSN;
+            note_dirty_page(update_log.table_id, update_log.page_id, update_log.LSN);
         }
         // compensate
         else if(log_type == COMPENSATE_LOG) {
             compensate_log_t compensate_log = make_compensate_log(tmp_buf);
             trx_last_LSN[compensate_log.trx_id] = compensate_log.LSN;
+            note_dirty_page(compensate_log.table_id, compensate_log.page_id, compensate_log.LSN);
+        }
+        // checkpoint tables, taken while the records since its begin were written
+        else if(log_type == END_CHECKPOINT_LOG) {
+            end_checkpoint_log_t checkpoint_log = make_end_checkpoint_log(tmp_buf);
+            for(const auto& trx : checkpoint_log.active_trx) {
+                if(win_trx.find(trx.first) != win_trx.end()) continue;
+                trx_set.insert(trx.first);
+                trx_last_LSN[trx.first] = std::max(trx_last_LSN[trx.first], trx.second);
+            }
+            for(const dirty_page_t& page : checkpoint_log.dirty_pages)
+                note_dirty_page(page.table_id, page.pagenum, page.rec_LSN);
         }
 
         delete[] tmp_buf;
@@ -359,6 +665,11 @@ int LogBufferManager::analyze_log() {
 
     next_LSN = cur_offset;
 
+    // changes older than every recLSN are on disk already
+    redo_LSN = cur_offset;
+    for(const auto& page : dirty_pages) 
+        redo_LSN = std::min(redo_LSN, page.second);
+
     for(const int& trx_id : trx_set) 
         lose_trx.insert(trx_id);
 
@@ -372,28 +683,31 @@ int LogBufferManager::analyze_log() {
 
     return (trx_set.empty()) ? 0 : 1;
 }
+/* Open table of a log record by its catalog path, false if it is gone */
+static bool open_logged_table(int64_t table_id) {
+    if(table_manager.is_opened(table_id)) return true;
+    std::string table_name = file_get_table_path(table_id);
+    // tables of older versions are named by their id and may have no catalog entry
+    if(table_name.empty()) table_name = "DATA" + std::to_string(table_id);
+    return open_table(table_name.c_str()) == table_id;
+}
 /* this implementation is currently no consider-redo version. */
 int LogBufferManager::redo_pass(int flag, int log_num) {
     int cur_log_cnt = 0;    
 
-    std::set<int> table_set;
-
     fprintf(logmsg_file, "[REDO] Redo pass start\n");
 
-    off_t cur_offset = 0;
-    off_t end_offset = lseek(log_file_fd, 0, SEEK_END);
-    lseek(log_file_fd, 0, SEEK_SET);
+    // analysis found the end of log
+    uint64_t cur_offset = redo_LSN;
+    uint64_t end_offset = next_LSN;
 
     while(cur_offset != end_offset) {
         if(flag == 1 && cur_log_cnt >= log_num) return 1;
 
         uint32_t log_size;
         uint32_t log_type;
-        pread(log_file_fd, &log_size, sizeof(log_size), cur_offset);
-        pread(log_file_fd, &log_type, sizeof(log_type), cur_offset + sizeof(uint32_t) * 2 + sizeof(uint64_t) * 2);
-
-        char* tmp_buf = new char[log_size];
-        pread(log_file_fd, tmp_buf, log_size, cur_offset);
+        char* tmp_buf = read_log_record(cur_offset, &log_size, &log_type);
+        if(tmp_buf == nullptr) break;
 
         if(log_type == BEGIN_LOG || log_type == COMMIT_LOG || log_type == ROLLBACK_LOG) {
             cur_log_cnt++;
@@ -418,10 +732,20 @@ int LogBufferManager::redo_pass(int flag, int log_num) {
             cur_log_cnt++;
             update_log_t update_log = make_update_log(tmp_buf);
 
-            if(table_set.find(update_log.table_id) == table_set.end()) {
-                std::string table_name = "DATA" + std::to_string(update_log.table_id);
-                open_table((const char*)table_name.c_str());
-                table_set.insert(update_log.table_id);
+            // page not in the dirty page table or cleaned after this change
+            auto dirty = dirty_pages.find({update_log.table_id, update_log.page_id});
+            if(dirty == dirty_pages.end() || dirty->second > update_log.LSN) {
+                fprintf(logmsg_file, "LSN %lu [CONSIDER-REDO] Transaction id %d\n", update_log.LSN, update_log.trx_id);
+                cur_offset += log_size;
+                delete[] tmp_buf;
+                continue;
+            }
+
+            if(!open_logged_table(update_log.table_id)) {
+                fprintf(logmsg_file, "LSN %lu [CONSIDER-REDO] Transaction id %d, table %lu is missing\n", update_log.LSN, update_log.trx_id, update_log.table_id);
+                cur_offset += log_size;
+                delete[] tmp_buf;
+                continue;
             }
 
             buffer_t* buf = buffer_manager.buffer_read_page(update_log.table_id, update_log.page_id);
@@ -437,7 +761,7 @@ int LogBufferManager::redo_pass(int flag, int log_num) {
                 continue;
             }
 
-            buffer_manager.buffer_write_page(update_log.table_id, update_log.page_id);
+            buffer_manager.buffer_write_page(update_log.table_id, update_log.page_id, update_log.LSN);
             page_io::set_page_LSN((page_t*)buf->frame, update_log.LSN);
             page_io::leaf::set_record((page_t*)buf->frame, update_log.offset, update_log.new_image.c_str(), update_log.new_image.size());
             buffer_manager.unpin_buffer(update_log.table_id, update_log.page_id);
@@ -447,6 +771,22 @@ int LogBufferManager::redo_pass(int flag, int log_num) {
         else if(log_type == COMPENSATE_LOG) {
             cur_log_cnt++;
             compensate_log_t compensate_log = make_compensate_log(tmp_buf);
+
+            auto dirty = dirty_pages.find({compensate_log.table_id, compensate_log.page_id});
+            if(dirty == dirty_pages.end() || dirty->second > compensate_log.LSN) {
+                fprintf(logmsg_file, "LSN %lu [CONSIDER-REDO] Transaction id %d\n", compensate_log.LSN, compensate_log.trx_id);
+                cur_offset += log_size;
+                delete[] tmp_buf;
+                continue;
+            }
+
+            if(!open_logged_table(compensate_log.table_id)) {
+                fprintf(logmsg_file, "LSN %lu [CONSIDER-REDO] Transaction id %d, table %lu is missing\n", compensate_log.LSN, compensate_log.trx_id, compensate_log.table_id);
+                cur_offset += log_size;
+                delete[] tmp_buf;
+                continue;
+            }
+
             buffer_t* buf = buffer_manager.buffer_read_page(compensate_log.table_id, compensate_log.page_id);
 
             uint64_t page_LSN = page_io::get_page_LSN((page_t*)buf->frame);
@@ -459,7 +799,7 @@ int LogBufferManager::redo_pass(int flag, int log_num) {
                 continue;
             }
 
-            buffer_manager.buffer_write_page(compensate_log.table_id, compensate_log.page_id);
+            buffer_manager.buffer_write_page(compensate_log.table_id, compensate_log.page_id, compensate_log.LSN);
             page_io::set_page_LSN((page_t*)buf->frame, compensate_log.LSN);
             page_io::leaf::set_record((page_t*)buf->frame, compensate_log.offset, compensate_log.new_image.c_str(), compensate_log.new_image.size());
             buffer_manager.unpin_buffer(compensate_log.table_id, compensate_log.page_id);
@@ -490,16 +830,24 @@ int LogBufferManager::undo_pass(int flag, int log_num) {
 
         uint32_t log_type;
         uint32_t log_size;
-        pread(log_file_fd, &log_size, sizeof(uint32_t), cur_LSN);
-        pread(log_file_fd, &log_type, sizeof(uint32_t), cur_LSN + sizeof(uint32_t) * 2 + sizeof(uint64_t) * 2);
-
-        char* tmp_buf = new char[log_size];
-        pread(log_file_fd, tmp_buf, log_size, cur_LSN);
+        char* tmp_buf = read_log_record(cur_LSN, &log_size, &log_type);
+        // segments a loser needs are kept, a missing record is a damaged log
+        if(tmp_buf == nullptr) {
+            fprintf(logmsg_file, "[UNDO] No log record at LSN %lu\n", cur_LSN);
+            break;
+        }
 
         if(log_type == UPDATE_LOG) {
             cur_log_cnt++;
 
             update_log_t update_log = make_update_log(tmp_buf);
+            // redo skips tables of pages that were clean, undo may be the first to need them
+            if(!open_logged_table(update_log.table_id)) {
+                fprintf(logmsg_file, "LSN %lu [UPDATE] Transaction id %d, table %lu is missing\n", update_log.LSN, update_log.trx_id, update_log.table_id);
+                trx_last_LSN[update_log.trx_id] = update_log.prev_LSN;
+                delete[] tmp_buf;
+                continue;
+            }
             buffer_t* buf = buffer_manager.buffer_read_page(update_log.table_id, update_log.page_id);
 
             uint64_t page_LSN = page_io::get_page_LSN((page_t*)buf->frame);
@@ -518,9 +866,9 @@ int LogBufferManager::undo_pass(int flag, int log_num) {
                     update_log.old_image,
                     update_log.prev_LSN
                 );
-                log_buf_manager.add_log_no_latch(compensate_log);
+                uint64_t LSN = log_buf_manager.add_log_no_latch(compensate_log);
 
-                page_io::set_page_LSN((page_t*)buf->frame, compensate_log->LSN);
+                page_io::set_page_LSN((page_t*)buf->frame, LSN);
                 page_io::leaf::set_record((page_t*)buf->frame, update_log.offset, update_log.old_image.c_str(), update_log.old_image.size());
             }
 
@@ -578,24 +926,20 @@ void LogBufferManager::recovery(int flag, int log_num) {
     pthread_mutex_lock(&log_buffer_manager_latch);
 
     int flag_ = analyze_log();
-    if(flag_ == 0) {
-        // If no loser trx, truncate log file.
-        ftruncate(log_file_fd, 0);
-        next_LSN = 0;
-        pthread_mutex_unlock(&log_buffer_manager_latch);
-        return;
-    }
 
+    // committed changes may miss the table files even without losers
     int redo_flag = redo_pass(flag, log_num);
     if(redo_flag == 1) {
         pthread_mutex_unlock(&log_buffer_manager_latch);
         return;
     }
 
-    int undo_flag = undo_pass(flag, log_num);
-    if(undo_flag == 1) {
-        pthread_mutex_unlock(&log_buffer_manager_latch);
-        return;
+    if(flag_ == 1) {
+        int undo_flag = undo_pass(flag, log_num);
+        if(undo_flag == 1) {
+            pthread_mutex_unlock(&log_buffer_manager_latch);
+            return;
+        }
     }
     
     // force flush
@@ -603,19 +947,135 @@ void LogBufferManager::recovery(int flag, int log_num) {
     fflush(logmsg_file);
 
     win_trx = {}, lose_trx = {};
+    dirty_pages.clear();
+    pthread_mutex_unlock(&log_buffer_manager_latch);
+
+    // the next restart begins here, segments before the pages redo dirtied are recycled
+    checkpoint();
+    start_checkpointer();
+}
+
+/************************************************************************/
+// * CHECKPOINT                                                         //
+/************************************************************************/
 
+/* Fuzzy checkpoint: pages and transactions keep changing while the tables are taken,
+ * analysis replays the records since the begin record over them.
+ */
+void LogBufferManager::checkpoint() {
+    pthread_mutex_lock(&log_buffer_manager_latch);
+    if(!log_opened) {
+        pthread_mutex_unlock(&log_buffer_manager_latch);
+        return;
+    }
+    begin_checkpoint_log_t* begin_log = new begin_checkpoint_log_t();
+    uint64_t begin_LSN = add_log_no_latch(begin_log);
+    uint64_t segment_start = begin_LSN - begin_LSN % segment_size;
+    pthread_mutex_unlock(&log_buffer_manager_latch);
+
+    // hot pages never get evicted, their recLSNs would keep old segments forever
+    buffer_manager.write_back_before(segment_start);
+    std::vector<dirty_page_t> dirty_page_table;
+    buffer_manager.get_dirty_pages(dirty_page_table);
+    // pages written back before the snapshot are left out, they must be on disk
+    file_checkpoint_table_files();
+
+    pthread_mutex_lock(&log_buffer_manager_latch);
+    std::vector<std::pair<int, uint64_t>> active_trx(trx_last_LSN.begin(), trx_last_LSN.end());
+    add_log_no_latch(new end_checkpoint_log_t(active_trx, dirty_page_table));
+    flush_logs();
+    write_master_record(begin_LSN);
+    last_checkpoint_end = next_LSN;
+
+    // restart reads from the begin record, redo from the oldest recLSN, undo back to the oldest first LSN
+    uint64_t keep_LSN = begin_LSN;
+    for(const dirty_page_t& page : dirty_page_table) keep_LSN = std::min(keep_LSN, page.rec_LSN);
+    for(const auto& trx : trx_first_LSN) keep_LSN = std::min(keep_LSN, trx.second);
+    recycle_segments(keep_LSN);
     pthread_mutex_unlock(&log_buffer_manager_latch);
 }
+void LogBufferManager::set_checkpoint_interval(int interval_ms) {
+    pthread_mutex_lock(&checkpointer_latch);
+    checkpoint_interval_ms = std::max(interval_ms, 0);
+    pthread_cond_signal(&checkpointer_cond);
+    pthread_mutex_unlock(&checkpointer_latch);
+}
+void LogBufferManager::set_segment_size(uint64_t size) {
+    pthread_mutex_lock(&log_buffer_manager_latch);
+    default_segment_size = std::max<uint64_t>(size, LOG_SEGMENT_FILL_CHUNK);
+    pthread_mutex_unlock(&log_buffer_manager_latch);
+}
+void LogBufferManager::set_archive_dir(const char* dir) {
+    pthread_mutex_lock(&log_buffer_manager_latch);
+    archive_dir = (dir == nullptr) ? "" : dir;
+    pthread_mutex_unlock(&log_buffer_manager_latch);
+}
+void* LogBufferManager::checkpointer_main(void* arg) {
+    LogBufferManager* manager = (LogBufferManager*)arg;
+
+    pthread_mutex_lock(&manager->checkpointer_latch);
+    while(manager->checkpointer_running) {
+        if(manager->checkpoint_interval_ms == 0) {
+            pthread_cond_wait(&manager->checkpointer_cond, &manager->checkpointer_latch);
+            continue;
+        }
+        timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += manager->checkpoint_interval_ms / 1000;
+        deadline.tv_nsec += (manager->checkpoint_interval_ms % 1000) * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        if(pthread_cond_timedwait(&manager->checkpointer_cond, &manager->checkpointer_latch, &deadline) != ETIMEDOUT) continue;
+
+        pthread_mutex_unlock(&manager->checkpointer_latch);
+        // nothing logged since the last one
+        if(manager->next_LSN != manager->last_checkpoint_end) manager->checkpoint();
+        pthread_mutex_lock(&manager->checkpointer_latch);
+    }
+    pthread_mutex_unlock(&manager->checkpointer_latch);
+
+    return NULL;
+}
+void LogBufferManager::start_checkpointer() {
+    pthread_mutex_lock(&checkpointer_latch);
+    if(!checkpointer_running) {
+        checkpointer_running = true;
+        pthread_create(&checkpointer_thread, NULL, checkpointer_main, this);
+    }
+    pthread_mutex_unlock(&checkpointer_latch);
+}
+void LogBufferManager::stop_checkpointer() {
+    pthread_mutex_lock(&checkpointer_latch);
+    if(!checkpointer_running) {
+        pthread_mutex_unlock(&checkpointer_latch);
+        return;
+    }
+    checkpointer_running = false;
+    pthread_cond_signal(&checkpointer_cond);
+    pthread_mutex_unlock(&checkpointer_latch);
+
+    pthread_join(checkpointer_thread, NULL);
+}
+
 void LogBufferManager::end_log() {
+    stop_checkpointer();
+    // pages are written back by now, restart has nothing to redo
+    if(log_opened) checkpoint();
     pthread_mutex_lock(&log_buffer_manager_latch);
     flush_logs();
     fflush(logmsg_file);
 
     win_trx = {}, lose_trx = {};
     trx_last_LSN = {};
+    trx_first_LSN = {};
 
     fclose(logmsg_file); logmsg_file = nullptr;
-    close(log_file_fd);
+    for(const auto& segment : segment_fds) close(segment.second);
+    segment_fds.clear();
+    log_opened = false;
+    if(master_fd >= 0) close(master_fd);
+    master_fd = -1;
+    last_checkpoint_end = 0;
     
     max_size = 0;
     log_path = nullptr;
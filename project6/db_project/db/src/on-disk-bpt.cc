@@ -1,16 +1,5 @@
 #include "on-disk-bpt.h"
 
-struct comparison_struct {
-    slot_t slot;
-    std::string record;
-
-    bool operator<(const comparison_struct& other) const {
-        int64_t key1 = slot_io::get_key(&slot);
-        int64_t key2 = slot_io::get_key(&other.slot);
-        return key1 < key2;
-    }
-};
-
 slotnum_t cut_leaf(std::vector<slot_t>& slots) {
     slotnum_t num_slots = slots.size();
     slotnum_t cut = 0;
@@ -46,11 +35,7 @@ pagenum_t get_left_idx(int64_t table_id, pagenum_t parent, pagenum_t left) {
     return left_idx;
 }
 
-pagenum_t get_neighbor_idx(int64_t table_id, pagenum_t node) {
-    buffer_t* node_page = buffer_manager.buffer_read_page(table_id, node);
-    pagenum_t parent = page_io::get_parent_page((page_t*)node_page->frame);
-    buffer_manager.unpin_buffer(table_id, node);
-
+pagenum_t get_neighbor_idx(int64_t table_id, pagenum_t parent, pagenum_t node) {
     buffer_t* parent_page = buffer_manager.buffer_read_page(table_id, parent);
 
     uint64_t num_keys = page_io::get_key_count((page_t*)parent_page->frame);
@@ -66,13 +51,62 @@ pagenum_t get_neighbor_idx(int64_t table_id, pagenum_t node) {
     exit(EXIT_FAILURE);
 }
 
-pagenum_t find_leaf(int64_t table_id, pagenum_t root, int64_t key) {
+/* Follow right links from page (c), pinned with (latch_mode), while (key) is past its high key.
+ * A split moved the key there after the parent pointed here. The page returned is pinned instead.
+ */
+static buffer_t* move_right(int64_t table_id, pagenum_t* c, buffer_t* page, int64_t key, int latch_mode) {
+    while(page_io::is_past_high_key((page_t*)page->frame, key)) {
+        pagenum_t right = page_io::get_right_link((page_t*)page->frame);
+        buffer_manager.unpin_buffer(table_id, *c);
+        *c = right;
+        page = buffer_manager.buffer_read_page(table_id, *c, latch_mode);
+    }
+    return page;
+}
+
+pagenum_t find_leaf(int64_t table_id, pagenum_t root, int64_t key, tree_path_t* path) {
+    if(path != nullptr) path->clear();
+    if(root == 0) return 0;
+
+    pagenum_t c = root;
+
+    while(true) {
+        buffer_t* temp_page = buffer_manager.buffer_read_page(table_id, c, PAGE_LATCH_SHARED);
+        temp_page = move_right(table_id, &c, temp_page, key, PAGE_LATCH_SHARED);
+
+        if(page_io::is_leaf((page_t*)temp_page->frame)) {
+            buffer_manager.unpin_buffer(table_id, c);
+            break;
+        }
+        if(path != nullptr) path->push_back(c);
+
+        slotnum_t i = key_search::internal_child_idx((page_t*)temp_page->frame, key);
+
+        pagenum_t new_c = page_io::internal::get_child((page_t*)temp_page->frame, i);
+        buffer_manager.unpin_buffer(table_id, c);
+        c = new_c;
+    }
+
+    return c;
+}
+
+/* Find leaf of (key) like find_leaf, also collect leaves right of it under the same parent
+ * as (leaf, lowest key) pairs into (siblings) for read-ahead.
+ * (fence) is the first key past that parent's subtree, if (has_fence).
+ */
+pagenum_t find_leaf_siblings(int64_t table_id, pagenum_t root, int64_t key,
+std::vector<std::pair<pagenum_t, int64_t>>* siblings, int64_t* fence, bool* has_fence) {
+    siblings->clear();
+    *has_fence = false;
     if(root == 0) return 0;
 
     pagenum_t c = root;
+    bool cur_has_fence = false;
+    int64_t cur_fence = 0;
 
     while(true) {
-        buffer_t* temp_page = buffer_manager.buffer_read_page(table_id, c);
+        buffer_t* temp_page = buffer_manager.buffer_read_page(table_id, c, PAGE_LATCH_SHARED);
+        temp_page = move_right(table_id, &c, temp_page, key, PAGE_LATCH_SHARED);
 
         if(page_io::is_leaf((page_t*)temp_page->frame)) {
             buffer_manager.unpin_buffer(table_id, c);
@@ -80,11 +114,19 @@ pagenum_t find_leaf(int64_t table_id, pagenum_t root, int64_t key) {
         }
 
         pagenum_t num_keys = page_io::get_key_count((page_t*)temp_page->frame);
-        slotnum_t i = 0;
-        while(i < num_keys) {
-            int64_t temp_key = page_io::internal::get_key((page_t*)temp_page->frame, i);
-            if(key >= temp_key) i++;
-            else break;
+        slotnum_t i = key_search::internal_child_idx((page_t*)temp_page->frame, key);
+
+        // children are leaves if this turns out to be the last level
+        siblings->clear();
+        for(pagenum_t j = i + 1; j <= num_keys; ++j)
+            siblings->push_back({page_io::internal::get_child((page_t*)temp_page->frame, j),
+                                 page_io::internal::get_key((page_t*)temp_page->frame, j - 1)});
+        *has_fence = cur_has_fence;
+        *fence = cur_fence;
+
+        if(i < num_keys) {
+            cur_has_fence = true;
+            cur_fence = page_io::internal::get_key((page_t*)temp_page->frame, i);
         }
 
         pagenum_t new_c = page_io::internal::get_child((page_t*)temp_page->frame, i);
@@ -103,26 +145,107 @@ std::pair<pagenum_t, slotnum_t> find(int64_t table_id, pagenum_t root, int64_t k
     
     if(c == 0) return std::pair<pagenum_t, slotnum_t>({0, 0});
     
-    buffer_t* leaf_page = buffer_manager.buffer_read_page(table_id, c);
-    pagenum_t num_keys = page_io::get_key_count((page_t*)leaf_page->frame);
-    for(slotnum_t i = 0; i < num_keys; ++i) {
-        int64_t temp_key = page_io::leaf::get_key((page_t*)leaf_page->frame, i);
-        if(temp_key == key) {
-            buffer_manager.unpin_buffer(table_id, c);
-            leaf_n = c;
-            slot_n = i;
-            return std::pair<pagenum_t, slotnum_t>({leaf_n, slot_n});
+    buffer_t* leaf_page = buffer_manager.buffer_read_page(table_id, c, PAGE_LATCH_SHARED);
+    leaf_page = move_right(table_id, &c, leaf_page, key, PAGE_LATCH_SHARED);
+    slotnum_t i = key_search::leaf_find_slot((page_t*)leaf_page->frame, key);
+    buffer_manager.unpin_buffer(table_id, c);
+
+    if(i < 0) return std::pair<pagenum_t, slotnum_t>({0, 0});
+    leaf_n = c;
+    slot_n = i;
+    return std::pair<pagenum_t, slotnum_t>({leaf_n, slot_n});
+}
+
+int find_record(int64_t table_id, pagenum_t root, int64_t key, char* value, uint16_t* size) {
+    pagenum_t c = find_leaf(table_id, root, key);
+    if(c == 0) return -1;
+
+    buffer_t* leaf_page = buffer_manager.buffer_read_page(table_id, c, PAGE_LATCH_SHARED);
+    leaf_page = move_right(table_id, &c, leaf_page, key, PAGE_LATCH_SHARED);
+    slotnum_t i = key_search::leaf_find_slot((page_t*)leaf_page->frame, key);
+    if(i >= 0) {
+        *size = page_io::leaf::get_record_size((page_t*)leaf_page->frame, i);
+        page_io::leaf::get_record((page_t*)leaf_page->frame, page_io::leaf::get_offset((page_t*)leaf_page->frame, i), value, *size);
+    }
+    buffer_manager.unpin_buffer(table_id, c);
+
+    return i >= 0 ? 0 : -1;
+}
+
+pagenum_t latch_record(int64_t table_id, pagenum_t root, int64_t key, buffer_t** leaf_page, slotnum_t* slot) {
+    pagenum_t c = find_leaf(table_id, root, key);
+    if(c == 0) return 0;
+
+    buffer_t* page = buffer_manager.buffer_read_page(table_id, c);
+    page = move_right(table_id, &c, page, key, PAGE_LATCH_EXCLUSIVE);
+    slotnum_t i = key_search::leaf_find_slot((page_t*)page->frame, key);
+    if(i < 0) {
+        buffer_manager.unpin_buffer(table_id, c);
+        return 0;
+    }
+
+    *leaf_page = page;
+    *slot = i;
+    return c;
+}
+
+/* find_leaf_siblings for tables opened with TABLE_OPEN_MMAP_READONLY.
+ * Pages are read in place from the mapping, no buffer frames and no latches.
+ * (siblings) may be nullptr for point lookups.
+ */
+pagenum_t find_leaf_mapped(int64_t table_id, pagenum_t root, int64_t key,
+std::vector<std::pair<pagenum_t, int64_t>>* siblings, int64_t* fence, bool* has_fence) {
+    if(siblings != nullptr) {
+        siblings->clear();
+        *has_fence = false;
+    }
+    if(root == 0) return 0;
+
+    pagenum_t c = root;
+    bool cur_has_fence = false;
+    int64_t cur_fence = 0;
+
+    while(true) {
+        const page_t* temp_page = file_get_mapped_page(table_id, c);
+        if(temp_page == nullptr) return 0;
+        if(page_io::is_leaf(temp_page)) break;
+
+        pagenum_t num_keys = page_io::get_key_count(temp_page);
+        slotnum_t i = key_search::internal_child_idx(temp_page, key);
+
+        if(siblings != nullptr) {
+            siblings->clear();
+            for(pagenum_t j = i + 1; j <= num_keys; ++j)
+                siblings->push_back({page_io::internal::get_child(temp_page, j),
+                                     page_io::internal::get_key(temp_page, j - 1)});
+            *has_fence = cur_has_fence;
+            *fence = cur_fence;
+
+            if(i < num_keys) {
+                cur_has_fence = true;
+                cur_fence = page_io::internal::get_key(temp_page, i);
+            }
         }
+
+        c = page_io::internal::get_child(temp_page, i);
     }
 
-    buffer_manager.unpin_buffer(table_id, c);
+    return c;
+}
 
-    return std::pair<pagenum_t, slotnum_t>({0, 0});
+std::pair<pagenum_t, slotnum_t> find_mapped(int64_t table_id, pagenum_t root, int64_t key) {
+    pagenum_t c = find_leaf_mapped(table_id, root, key, nullptr, nullptr, nullptr);
+    if(c == 0) return std::pair<pagenum_t, slotnum_t>({0, 0});
+
+    const page_t* leaf_page = file_get_mapped_page(table_id, c);
+    slotnum_t i = key_search::leaf_find_slot(leaf_page, key);
+    if(i < 0) return std::pair<pagenum_t, slotnum_t>({0, 0});
+    return std::pair<pagenum_t, slotnum_t>({c, i});
 }
 
-/* Make a leaf node page */
-pagenum_t make_leaf(int64_t table_id) {
-    pagenum_t leaf_page_num = buffer_manager.buffer_alloc_page(table_id);
+/* Make a leaf node page, placed near page (near) if there is room */
+pagenum_t make_leaf(int64_t table_id, pagenum_t near) {
+    pagenum_t leaf_page_num = buffer_manager.buffer_alloc_page(table_id, near);
 
     buffer_t* leaf_page = buffer_manager.buffer_read_page(table_id, leaf_page_num);
     buffer_manager.buffer_write_page(table_id, leaf_page_num);
@@ -132,8 +255,8 @@ pagenum_t make_leaf(int64_t table_id) {
     return leaf_page_num;
 }
 
-pagenum_t make_internal_node(int64_t table_id) {
-    pagenum_t internal_page_num = buffer_manager.buffer_alloc_page(table_id);
+pagenum_t make_internal_node(int64_t table_id, pagenum_t near) {
+    pagenum_t internal_page_num = buffer_manager.buffer_alloc_page(table_id, near);
 
     buffer_t* internal_page = buffer_manager.buffer_read_page(table_id, internal_page_num);
     buffer_manager.buffer_write_page(table_id, internal_page_num);
@@ -143,46 +266,14 @@ pagenum_t make_internal_node(int64_t table_id) {
     return internal_page_num;
 }
 
-/* Insert key and value into leaf node */
+/* Insert key and value into leaf node, the caller checked there is room */
 pagenum_t insert_into_leaf(int64_t table_id, pagenum_t leaf, int64_t key, const char* value, uint16_t size) {
     buffer_t* leaf_page = buffer_manager.buffer_read_page(table_id, leaf);
 
-    uint32_t num_keys = page_io::get_key_count((page_t*)leaf_page->frame);
-
-    std::vector<comparison_struct> slots(num_keys + 1);
-
-    for(pagenum_t i = 0; i < num_keys; ++i) {
-        slot_io::read_slot((page_t*)leaf_page->frame, i, &slots[i].slot);
-        slotnum_t offset = slot_io::get_offset(&slots[i].slot);
-        slotnum_t cur_size = slot_io::get_record_size(&slots[i].slot);
-        char* temp_record = new char[cur_size];
-        page_io::leaf::get_record((page_t*)leaf_page->frame, offset, temp_record, cur_size);
-        slots[i].record = std::string(temp_record, cur_size);
-        delete[] temp_record;
-    }
-    slot_io::set_new_slot(&slots.back().slot, key, size, 0);
-    slots.back().record = std::string(value, size);
-
-    std::sort(slots.begin(), slots.end());
+    slotnum_t insertion_point = key_search::leaf_upper_bound((page_t*)leaf_page->frame, key);
 
     buffer_manager.buffer_write_page(table_id, leaf);
-    page_io::leaf::set_free_space((page_t*)leaf_page->frame, INITIAL_FREE_SPACE);
-    slotnum_t offset = PAGE_SIZE;
-    for(pagenum_t i = 0; i < num_keys + 1; ++i) {
-        // Set slot
-        slotnum_t cur_size = slot_io::get_record_size(&slots[i].slot);
-        offset -= cur_size;
-        slot_io::set_offset(&slots[i].slot, offset);
-        page_io::leaf::set_slot((page_t*)leaf_page->frame, i, &slots[i].slot);
-
-        // Set record
-        page_io::leaf::set_record((page_t*)leaf_page->frame, offset, slots[i].record.c_str(), cur_size);
-
-        // Set free space
-        page_io::leaf::update_free_space((page_t*)leaf_page->frame, cur_size + SLOT_SIZE);
-    }
-
-    page_io::set_key_count((page_t*)leaf_page->frame, num_keys + 1);
+    page_io::leaf::insert_slot((page_t*)leaf_page->frame, insertion_point, key, value, size);
 
     buffer_manager.unpin_buffer(table_id, leaf);
 
@@ -198,102 +289,83 @@ pagenum_t start_new_tree(int64_t table_id, int64_t key, const char* value, uint1
     page_io::header::set_root_page((page_t*)header->frame, root);
     buffer_manager.unpin_buffer(table_id, 0);
 
-    slotnum_t offset = (slotnum_t)(PAGE_SIZE - size);
-    
     buffer_t* root_page = buffer_manager.buffer_read_page(table_id, root);
 
     buffer_manager.buffer_write_page(table_id, root);
-    slot_t slot;
-    slot_io::set_new_slot(&slot, key, (slotnum_t)size, offset);
-    page_io::leaf::set_slot((page_t*)root_page->frame, 0, &slot);
-    page_io::leaf::set_record((page_t*)root_page->frame, offset, value, size);
-    page_io::leaf::update_free_space((page_t*)root_page->frame, size + SLOT_SIZE);
-    page_io::set_key_count((page_t*)root_page->frame, 1);
+    page_io::leaf::insert_slot((page_t*)root_page->frame, 0, key, value, size);
     buffer_manager.unpin_buffer(table_id, root);
     
     return root;
 }
 
-pagenum_t insert_into_leaf_after_splitting(int64_t table_id, pagenum_t root, pagenum_t leaf, int64_t key, const char* value, uint16_t size) {
-    int insertion_point = 0;
+/* Split pinned (leaf) with (key) and value in it, the upper half goes to a new leaf.
+ * Returns the new leaf and its first key in (new_key), the parent isn't touched.
+ */
+static pagenum_t split_leaf(int64_t table_id, pagenum_t leaf, buffer_t* leaf_page, int64_t key, const char* value, uint16_t size, int64_t* new_key) {
+    // records are copied back from this image, the new one sits at (insertion_point)
+    page_t old_page;
+    memcpy(old_page.data, leaf_page->frame, PAGE_SIZE);
 
-    buffer_t* leaf_page = buffer_manager.buffer_read_page(table_id, leaf);
-    uint32_t num_keys = page_io::get_key_count((page_t*)leaf_page->frame);
+    uint32_t num_keys = page_io::get_key_count(&old_page);
+    slotnum_t insertion_point = key_search::leaf_upper_bound(&old_page, key);
 
-    while(insertion_point < num_keys
-    && page_io::leaf::get_key((page_t*)leaf_page->frame, insertion_point) < key) {
-        insertion_point++;
-    }
-    
     std::vector<slot_t> temp_slots(num_keys + 1);
-    std::vector<std::string> temp_records(num_keys + 1);
     for(slotnum_t i = 0, j = 0; i < num_keys; ++i, ++j) {
         if(j == insertion_point) j++;
-        slot_t& temp_slot = temp_slots[j];
-        slot_io::read_slot((page_t*)leaf_page->frame, i, &temp_slot);
-
-        slotnum_t offset = slot_io::get_offset(&temp_slot);
-        uint16_t record_size = slot_io::get_record_size(&temp_slot);
-        char* temp_record = new char[record_size];
-        page_io::leaf::get_record((page_t*)leaf_page->frame, offset, temp_record, record_size);
-        temp_records[j] = std::string(temp_record, record_size);
-        delete[] temp_record;
+        slot_io::read_slot(&old_page, i, &temp_slots[j]);
     }
-    slot_t& new_slot = temp_slots[insertion_point];
-    slot_io::set_new_slot(&new_slot, key, size, (slotnum_t)(PAGE_SIZE - size));
-    temp_records[insertion_point] = std::string(value, size);
+    slot_io::set_new_slot(&temp_slots[insertion_point], key, size, 0);
 
     slotnum_t split = cut_leaf(temp_slots);
 
-    slotnum_t offset = PAGE_SIZE;
-    
+    auto record_of = [&](slotnum_t i) -> const char* {
+        if(i == insertion_point) return value;
+        return old_page.data + slot_io::get_offset(&temp_slots[i]);
+    };
+
     buffer_manager.buffer_write_page(table_id, leaf);
     page_io::leaf::set_free_space((page_t*)leaf_page->frame, INITIAL_FREE_SPACE);
+    page_io::leaf::set_record_start((page_t*)leaf_page->frame, PAGE_SIZE);
+    page_io::set_key_count((page_t*)leaf_page->frame, 0);
     for(slotnum_t i = 0; i < split; ++i) {
         slot_t& temp_slot = temp_slots[i];
-        uint16_t record_size = slot_io::get_record_size(&temp_slot);
-        offset -= record_size;
-        slot_io::set_offset(&temp_slot, offset);
-        page_io::leaf::set_slot((page_t*)leaf_page->frame, i, &temp_slot);
-        page_io::leaf::set_record((page_t*)leaf_page->frame, offset, temp_records[i].c_str(), record_size);
-        page_io::leaf::update_free_space((page_t*)leaf_page->frame, record_size + SLOT_SIZE);
+        page_io::leaf::insert_slot((page_t*)leaf_page->frame, i, slot_io::get_key(&temp_slot), record_of(i), slot_io::get_record_size(&temp_slot));
     }
-    page_io::set_key_count((page_t*)leaf_page->frame, split);
 
-    pagenum_t new_leaf = make_leaf(table_id);
+    // right half right after the left one keeps leaf chain scans sequential
+    pagenum_t new_leaf = make_leaf(table_id, leaf);
     buffer_t* new_leaf_page = buffer_manager.buffer_read_page(table_id, new_leaf);
 
     buffer_manager.buffer_write_page(table_id, new_leaf);
-    offset = PAGE_SIZE;
     for(slotnum_t i = split, j = 0; i < num_keys + 1; ++i, ++j) {
         slot_t& temp_slot = temp_slots[i];
-        uint16_t record_size = slot_io::get_record_size(&temp_slot);
-        offset -= record_size;
-        slot_io::set_offset(&temp_slot, offset);
-        page_io::leaf::set_slot((page_t*)new_leaf_page->frame, j, &temp_slot);
-        page_io::leaf::set_record((page_t*)new_leaf_page->frame, offset, temp_records[i].c_str(), record_size);
-        page_io::leaf::update_free_space((page_t*)new_leaf_page->frame, record_size + SLOT_SIZE);
+        page_io::leaf::insert_slot((page_t*)new_leaf_page->frame, j, slot_io::get_key(&temp_slot), record_of(i), slot_io::get_record_size(&temp_slot));
     }
-    page_io::set_key_count((page_t*)new_leaf_page->frame, num_keys + 1 - split);
 
-    /* Set right sibling */
+    *new_key = page_io::leaf::get_key((page_t*)new_leaf_page->frame, 0);
+
+    /* Set right sibling, the new leaf takes over the high key */
     pagenum_t right_sibling = page_io::leaf::get_right_sibling((page_t*)leaf_page->frame);
-    page_io::leaf::set_right_sibling((page_t*)leaf_page->frame, new_leaf);
     page_io::leaf::set_right_sibling((page_t*)new_leaf_page->frame, right_sibling);
+    page_io::set_high_key((page_t*)new_leaf_page->frame, page_io::get_high_key((page_t*)leaf_page->frame));
+    page_io::leaf::set_right_sibling((page_t*)leaf_page->frame, new_leaf);
+    page_io::set_high_key((page_t*)leaf_page->frame, *new_key);
 
-    /* Set parent */
-    pagenum_t parent = page_io::get_parent_page((page_t*)leaf_page->frame);
-    page_io::set_parent_page((page_t*)new_leaf_page->frame, parent);
+    buffer_manager.unpin_buffer(table_id, new_leaf);
 
-    int64_t new_key = page_io::leaf::get_key((page_t*)new_leaf_page->frame, 0);
+    return new_leaf;
+}
 
+pagenum_t insert_into_leaf_after_splitting(int64_t table_id, pagenum_t root, pagenum_t leaf, int64_t key, const char* value, uint16_t size, tree_path_t* path) {
+    buffer_t* leaf_page = buffer_manager.buffer_read_page(table_id, leaf);
+    int64_t new_key;
+    pagenum_t new_leaf = split_leaf(table_id, leaf, leaf_page, key, value, size, &new_key);
     buffer_manager.unpin_buffer(table_id, leaf);
-    buffer_manager.unpin_buffer(table_id, new_leaf);
 
-    return insert_into_parent(table_id, root, leaf, new_key, new_leaf);
+    return insert_into_parent(table_id, root, leaf, new_key, new_leaf, path);
 }
 
-pagenum_t insert_into_node_after_splitting(int64_t table_id, pagenum_t root, pagenum_t old_node, pagenum_t left_index, int64_t key, pagenum_t right) {
+pagenum_t insert_into_node_after_splitting(int64_t table_id, pagenum_t root, pagenum_t old_node, pagenum_t left_index, int64_t key, pagenum_t right, tree_path_t* path) {
     buffer_t* old_node_page = buffer_manager.buffer_read_page(table_id, old_node);
     uint32_t num_keys = page_io::get_key_count((page_t*)old_node_page->frame);
 
@@ -314,7 +386,7 @@ pagenum_t insert_into_node_after_splitting(int64_t table_id, pagenum_t root, pag
     temp_keys[left_index] = key;
 
     slotnum_t split = cut_internal();
-    pagenum_t new_node = make_internal_node(table_id);
+    pagenum_t new_node = make_internal_node(table_id, old_node);
     buffer_t* new_node_page = buffer_manager.buffer_read_page(table_id, new_node);
 
     buffer_manager.buffer_write_page(table_id, old_node);
@@ -335,26 +407,19 @@ pagenum_t insert_into_node_after_splitting(int64_t table_id, pagenum_t root, pag
     page_io::internal::set_child((page_t*)new_node_page->frame, j, temp_childs[i]);
     page_io::set_key_count((page_t*)new_node_page->frame, INTERNAL_ORDER - split);
 
-    pagenum_t parent = page_io::get_parent_page((page_t*)old_node_page->frame);
-    page_io::set_parent_page((page_t*)new_node_page->frame, parent);
-    num_keys = page_io::get_key_count((page_t*)new_node_page->frame);
-
-    for(pagenum_t i = 0; i <= num_keys; ++i) {
-        pagenum_t child = page_io::internal::get_child((page_t*)new_node_page->frame, i);
-        buffer_t* child_page = buffer_manager.buffer_read_page(table_id, child);
-        buffer_manager.buffer_write_page(table_id, child);
-        page_io::set_parent_page((page_t*)child_page->frame, new_node);
-        buffer_manager.unpin_buffer(table_id, child);
-    }
+    page_io::set_right_link((page_t*)new_node_page->frame, page_io::get_right_link((page_t*)old_node_page->frame));
+    page_io::set_high_key((page_t*)new_node_page->frame, page_io::get_high_key((page_t*)old_node_page->frame));
+    page_io::set_right_link((page_t*)old_node_page->frame, new_node);
+    page_io::set_high_key((page_t*)old_node_page->frame, prime_key);
 
     buffer_manager.unpin_buffer(table_id, old_node);
     buffer_manager.unpin_buffer(table_id, new_node);
 
-    return insert_into_parent(table_id, root, old_node, prime_key, new_node);
+    return insert_into_parent(table_id, root, old_node, prime_key, new_node, path);
 }
 
 pagenum_t insert_into_new_root(int64_t table_id, pagenum_t left, int64_t key, pagenum_t right) {
-    pagenum_t root = make_internal_node(table_id);
+    pagenum_t root = make_internal_node(table_id, left);
 
     buffer_t* header_page = buffer_manager.buffer_read_page(table_id, 0);
     buffer_manager.buffer_write_page(table_id, 0);
@@ -367,32 +432,21 @@ pagenum_t insert_into_new_root(int64_t table_id, pagenum_t left, int64_t key, pa
     page_io::internal::set_child((page_t*)root_page->frame, 1, right);
     page_io::set_key_count((page_t*)root_page->frame, 1);
 
-    buffer_t* left_page = buffer_manager.buffer_read_page(table_id, left);
-    buffer_manager.buffer_write_page(table_id, left);
-    page_io::set_parent_page((page_t*)left_page->frame, root);
-
-    buffer_t* right_page = buffer_manager.buffer_read_page(table_id, right);
-    buffer_manager.buffer_write_page(table_id, right);
-    page_io::set_parent_page((page_t*)right_page->frame, root);
-
     buffer_manager.unpin_buffer(table_id, 0);
     buffer_manager.unpin_buffer(table_id, root);
-    buffer_manager.unpin_buffer(table_id, left);
-    buffer_manager.unpin_buffer(table_id, right);
 
     return root;
 }
 
-pagenum_t insert_into_parent(int64_t table_id, pagenum_t root, pagenum_t left, int64_t key, pagenum_t right) {
-    buffer_t* left_page = buffer_manager.buffer_read_page(table_id, left);
-    pagenum_t parent = page_io::get_parent_page((page_t*)left_page->frame);
-    buffer_manager.unpin_buffer(table_id, left);
-
+pagenum_t insert_into_parent(int64_t table_id, pagenum_t root, pagenum_t left, int64_t key, pagenum_t right, tree_path_t* path) {
     /* Case : New root */
-    if(parent == 0) {
+    if(path->empty()) {
         return insert_into_new_root(table_id, left, key, right);
     }
 
+    pagenum_t parent = path->back();
+    path->pop_back();
+
     pagenum_t left_index = get_left_idx(table_id, parent, left);
     buffer_t* parent_page = buffer_manager.buffer_read_page(table_id, parent);
     uint32_t num_keys = page_io::get_key_count((page_t*)parent_page->frame);
@@ -402,24 +456,30 @@ pagenum_t insert_into_parent(int64_t table_id, pagenum_t root, pagenum_t left, i
         return insert_into_node(table_id, root, parent, left_index, key, right);
     }
 
-    return insert_into_node_after_splitting(table_id, root, parent, left_index, key, right);
+    return insert_into_node_after_splitting(table_id, root, parent, left_index, key, right, path);
 }
 
-pagenum_t insert_into_node(int64_t table_id, pagenum_t root, pagenum_t node, slotnum_t left_idx, int64_t key, pagenum_t right) {
-    buffer_t* node_page = buffer_manager.buffer_read_page(table_id, node);
-    uint32_t num_keys = page_io::get_key_count((page_t*)node_page->frame);
+/* Put (key) and its right child (right) after child (left_idx) of internal page with room */
+static void insert_into_node_page(page_t* node_page, slotnum_t left_idx, int64_t key, pagenum_t right) {
+    uint32_t num_keys = page_io::get_key_count(node_page);
 
-    buffer_manager.buffer_write_page(table_id, node);
     for(pagenum_t i = num_keys; i > left_idx; --i) {
-        pagenum_t temp_child = page_io::internal::get_child((page_t*)node_page->frame, i);
-        page_io::internal::set_child((page_t*)node_page->frame, i + 1, temp_child);
-        int64_t temp_key = page_io::internal::get_key((page_t*)node_page->frame, i - 1);
-        page_io::internal::set_key((page_t*)node_page->frame, i, temp_key);
+        pagenum_t temp_child = page_io::internal::get_child(node_page, i);
+        page_io::internal::set_child(node_page, i + 1, temp_child);
+        int64_t temp_key = page_io::internal::get_key(node_page, i - 1);
+        page_io::internal::set_key(node_page, i, temp_key);
     }
 
-    page_io::internal::set_child((page_t*)node_page->frame, left_idx + 1, right);
-    page_io::internal::set_key((page_t*)node_page->frame, left_idx, key);
-    page_io::set_key_count((page_t*)node_page->frame, num_keys + 1);
+    page_io::internal::set_child(node_page, left_idx + 1, right);
+    page_io::internal::set_key(node_page, left_idx, key);
+    page_io::set_key_count(node_page, num_keys + 1);
+}
+
+pagenum_t insert_into_node(int64_t table_id, pagenum_t root, pagenum_t node, slotnum_t left_idx, int64_t key, pagenum_t right) {
+    buffer_t* node_page = buffer_manager.buffer_read_page(table_id, node);
+
+    buffer_manager.buffer_write_page(table_id, node);
+    insert_into_node_page((page_t*)node_page->frame, left_idx, key, right);
 
     buffer_manager.unpin_buffer(table_id, node);
 
@@ -448,7 +508,8 @@ pagenum_t insert(int64_t table_id, pagenum_t root, int64_t key, const char* valu
     }
 
     /* Case : the tree already exists. */
-    leaf = find_leaf(table_id, root, key);
+    tree_path_t path;
+    leaf = find_leaf(table_id, root, key, &path);
 
     /* Case : leaf has room for key and value. */
     buffer_t* leaf_page = buffer_manager.buffer_read_page(table_id, leaf);
@@ -460,7 +521,65 @@ pagenum_t insert(int64_t table_id, pagenum_t root, int64_t key, const char* valu
     }
 
     /* Case : leaf must be split. */
-    return insert_into_leaf_after_splitting(table_id, root, leaf, key, value, size);
+    return insert_into_leaf_after_splitting(table_id, root, leaf, key, value, size, &path);
+}
+
+/* Callers keep internal pages from splitting or merging, other writers only change
+ * leaves and split them into parents with room. A leaf split runs with the leaf and
+ * its parent latched, descents racing with it move right.
+ */
+int insert_in_leaf(int64_t table_id, pagenum_t root, int64_t key, const char* value, uint16_t size) {
+    if(root == 0) return -1;
+
+    tree_path_t path;
+    pagenum_t leaf = find_leaf(table_id, root, key, &path);
+    buffer_t* leaf_page = buffer_manager.buffer_read_page(table_id, leaf);
+    leaf_page = move_right(table_id, &leaf, leaf_page, key, PAGE_LATCH_EXCLUSIVE);
+
+    if(key_search::leaf_find_slot((page_t*)leaf_page->frame, key) >= 0) {
+        buffer_manager.unpin_buffer(table_id, leaf);
+        return 1;
+    }
+    if(page_io::leaf::get_free_space((page_t*)leaf_page->frame) >= size + SLOT_SIZE) {
+        slotnum_t insertion_point = key_search::leaf_upper_bound((page_t*)leaf_page->frame, key);
+        buffer_manager.buffer_write_page(table_id, leaf);
+        page_io::leaf::insert_slot((page_t*)leaf_page->frame, insertion_point, key, value, size);
+        buffer_manager.unpin_buffer(table_id, leaf);
+        return 0;
+    }
+
+    // the parent must take the new leaf without splitting, a new root changes the shape.
+    // internal pages don't split meanwhile, so a leaf moved right to keeps the parent of the descent
+    if(path.empty()) {
+        buffer_manager.unpin_buffer(table_id, leaf);
+        return -1;
+    }
+    pagenum_t parent = path.back();
+    buffer_t* parent_page = buffer_manager.buffer_read_page(table_id, parent);
+    if(page_io::get_key_count((page_t*)parent_page->frame) >= INTERNAL_ORDER - 1) {
+        buffer_manager.unpin_buffer(table_id, parent);
+        buffer_manager.unpin_buffer(table_id, leaf);
+        return -1;
+    }
+    // a parent that no longer points at the leaf is stale, the reshaping path finds the right one
+    slotnum_t num_keys = page_io::get_key_count((page_t*)parent_page->frame);
+    slotnum_t left_idx = 0;
+    while(left_idx <= num_keys && page_io::internal::get_child((page_t*)parent_page->frame, left_idx) != leaf) left_idx++;
+    if(left_idx > num_keys) {
+        buffer_manager.unpin_buffer(table_id, parent);
+        buffer_manager.unpin_buffer(table_id, leaf);
+        return -1;
+    }
+
+    int64_t new_key;
+    pagenum_t new_leaf = split_leaf(table_id, leaf, leaf_page, key, value, size, &new_key);
+    buffer_manager.unpin_buffer(table_id, leaf);
+
+    buffer_manager.buffer_write_page(table_id, parent);
+    insert_into_node_page((page_t*)parent_page->frame, left_idx, new_key, new_leaf);
+    buffer_manager.unpin_buffer(table_id, parent);
+
+    return 0;
 }
 
 /* * * * * * * * * * * * * * DELETE * * * * * * * * * * * * * */ 
@@ -480,11 +599,6 @@ pagenum_t adjust_root(int64_t table_id, pagenum_t root) {
     if(!is_leaf) {
         new_root = page_io::internal::get_child((page_t*)root_page->frame, 0);
 
-        buffer_t* new_root_page = buffer_manager.buffer_read_page(table_id, new_root);
-        buffer_manager.buffer_write_page(table_id, new_root);
-        page_io::set_parent_page((page_t*)new_root_page->frame, 0);
-        buffer_manager.unpin_buffer(table_id, new_root);
-
         buffer_t* header_page = buffer_manager.buffer_read_page(table_id, 0);
         buffer_manager.buffer_write_page(table_id, 0);
         page_io::header::set_root_page((page_t*)header_page->frame, new_root);
@@ -494,6 +608,7 @@ pagenum_t adjust_root(int64_t table_id, pagenum_t root) {
         new_root = 0;
 
         buffer_t* header_page = buffer_manager.buffer_read_page(table_id, 0);
+        buffer_manager.buffer_write_page(table_id, 0);
         page_io::header::set_root_page((page_t*)header_page->frame, 0);
         buffer_manager.unpin_buffer(table_id, 0);
     }
@@ -511,12 +626,8 @@ pagenum_t remove_entry_from_node(int64_t table_id, int64_t key, pagenum_t node)
 
     /* Case : Internal node. */
     if(!is_leaf) {
-        pagenum_t i = 0;
-        while(true) {
-            int64_t temp_key = page_io::internal::get_key((page_t*)node_page->frame, i);
-            if(temp_key == key) break;
-            i++;
-        }
+        // (key) is in the node, it is the last key <= itself
+        pagenum_t i = key_search::internal_child_idx((page_t*)node_page->frame, key) - 1;
 
         buffer_manager.buffer_write_page(table_id, node);
         pagenum_t j = i;
@@ -526,7 +637,8 @@ pagenum_t remove_entry_from_node(int64_t table_id, int64_t key, pagenum_t node)
             page_io::internal::set_key((page_t*)node_page->frame, i - 1, temp_key);
         }
 
-        for(++j; j < num_keys + 1; ++j) {
+        // the right child of the key goes with it, merges free that one
+        for(j += 2; j < num_keys + 1; ++j) {
             pagenum_t temp_child = page_io::internal::get_child((page_t*)node_page->frame, j);
             page_io::internal::set_child((page_t*)node_page->frame, j - 1, temp_child);
         }
@@ -538,35 +650,10 @@ pagenum_t remove_entry_from_node(int64_t table_id, int64_t key, pagenum_t node)
     }
     /* Case : leaf node */
     else {
-        pagenum_t i = 0;
-        while(true) {
-            int64_t temp_key = page_io::leaf::get_key((page_t*)node_page->frame, i);
-            if(temp_key == key) break;
-            i++;
-        }
+        slotnum_t i = key_search::leaf_find_slot((page_t*)node_page->frame, key);
 
         buffer_manager.buffer_write_page(table_id, node);
-        slotnum_t offset = (i == 0) ? PAGE_SIZE : page_io::leaf::get_offset((page_t*)node_page->frame, i - 1); 
-        pagenum_t num_keys = page_io::get_key_count((page_t*)node_page->frame);
-        for(++i; i < num_keys; ++i) {            
-            slotnum_t temp_offset = page_io::leaf::get_offset((page_t*)node_page->frame, i);
-            slotnum_t size = page_io::leaf::get_record_size((page_t*)node_page->frame, i);
-
-            char* temp_record = new char[size];
-            page_io::leaf::get_record((page_t*)node_page->frame, temp_offset, temp_record, size);
-    
-            slot_t temp_slot;
-            slot_io::read_slot((page_t*)node_page->frame, i, &temp_slot);
-            offset -= size;
-            slot_io::set_offset(&temp_slot, offset);
-            page_io::leaf::set_slot((page_t*)node_page->frame, i - 1, &temp_slot);
-            
-            page_io::leaf::set_record((page_t*)node_page->frame, offset, temp_record, size);
-            delete[] temp_record;
-        }
-
-        num_keys = page_io::get_key_count((page_t*)node_page->frame);
-        page_io::set_key_count((page_t*)node_page->frame, num_keys - 1);
+        page_io::leaf::remove_slot((page_t*)node_page->frame, i);
 
         buffer_manager.unpin_buffer(table_id, node);
     }
@@ -574,7 +661,7 @@ pagenum_t remove_entry_from_node(int64_t table_id, int64_t key, pagenum_t node)
     return node;    
 }
 
-pagenum_t redistribute_nodes(int64_t table_id, pagenum_t root, pagenum_t node, pagenum_t neighbor, pagenum_t neighbor_idx, pagenum_t prime_key_idx, int64_t prime_key) {
+pagenum_t redistribute_nodes(int64_t table_id, pagenum_t root, pagenum_t parent, pagenum_t node, pagenum_t neighbor, pagenum_t neighbor_idx, pagenum_t prime_key_idx, int64_t prime_key) {
     buffer_t* neighbor_page;
     buffer_t* node_page = buffer_manager.buffer_read_page(table_id, node);
     bool is_leaf = page_io::is_leaf((page_t*)node_page->frame);
@@ -596,63 +683,39 @@ pagenum_t redistribute_nodes(int64_t table_id, pagenum_t root, pagenum_t node, p
             neighbor_page = buffer_manager.buffer_read_page(table_id, neighbor);
             pagenum_t neighbor_num_keys = page_io::get_key_count((page_t*)neighbor_page->frame);
             pagenum_t child = page_io::internal::get_child((page_t*)neighbor_page->frame, neighbor_num_keys);
-            page_io::internal::set_child((page_t*)node_page, 0, child);
-
-            temp_child = page_io::internal::get_child((page_t*)node_page->frame, 0);
-
-            buffer_t* temp_child_page = buffer_manager.buffer_read_page(table_id, temp_child);
-            buffer_manager.buffer_write_page(table_id, temp_child);
-            page_io::set_parent_page((page_t*)temp_child_page->frame, node);
-            buffer_manager.unpin_buffer(table_id, temp_child);
+            page_io::internal::set_child((page_t*)node_page->frame, 0, child);
 
             page_io::internal::set_key((page_t*)node_page->frame, 0, prime_key);
 
-            pagenum_t parent = page_io::get_parent_page((page_t*)node_page->frame);
             buffer_t* parent_page = buffer_manager.buffer_read_page(table_id, parent);
             int64_t next_key = page_io::internal::get_key((page_t*)neighbor_page->frame, neighbor_num_keys - 1);
 
             buffer_manager.buffer_write_page(table_id, parent);
             page_io::internal::set_key((page_t*)parent_page->frame, prime_key_idx, next_key);
             buffer_manager.unpin_buffer(table_id, parent);
+
+            // left one of the pair ends at the new key of the parent
+            buffer_manager.buffer_write_page(table_id, neighbor);
+            page_io::set_high_key((page_t*)neighbor_page->frame, next_key);
         }
         else {
-            std::vector<comparison_struct> slots(num_keys + 1);
-            for(pagenum_t i = 0; i < num_keys; ++i) {
-                slot_io::read_slot((page_t*)node_page->frame, i, &slots[i + 1].slot);
-                slotnum_t offset = slot_io::get_offset(&slots[i + 1].slot);
-                slotnum_t cur_size = slot_io::get_record_size(&slots[i + 1].slot);
-                char* temp_record = new char[cur_size];
-                page_io::leaf::get_record((page_t*)node_page->frame, offset, temp_record, cur_size);
-                slots[i + 1].record = std::string(temp_record, cur_size);
-                delete[] temp_record;
-            }
+            // last record of the left neighbor becomes the first one of node
             neighbor_page = buffer_manager.buffer_read_page(table_id, neighbor);
-            slot_io::read_slot((page_t*)neighbor_page->frame, num_keys, &slots[0].slot);
-            slotnum_t offset = slot_io::get_offset(&slots[0].slot);
-            slotnum_t cur_size = slot_io::get_record_size(&slots[0].slot);
-            char* temp_record = new char[cur_size];
-            page_io::leaf::get_record((page_t*)neighbor_page->frame, offset, temp_record, cur_size);
-            slots[0].record = std::string(temp_record, cur_size);
-            delete[] temp_record;
+            slotnum_t last = page_io::get_key_count((page_t*)neighbor_page->frame) - 1;
+            int64_t moved_key = page_io::leaf::get_key((page_t*)neighbor_page->frame, last);
+            slotnum_t size = page_io::leaf::get_record_size((page_t*)neighbor_page->frame, last);
+            char record[PAGE_SIZE];
+            page_io::leaf::get_record((page_t*)neighbor_page->frame, page_io::leaf::get_offset((page_t*)neighbor_page->frame, last), record, size);
 
             buffer_manager.buffer_write_page(table_id, neighbor);
-            page_io::leaf::update_free_space((page_t*)neighbor_page->frame, -(cur_size + SLOT_SIZE));
-            page_io::leaf::set_free_space((page_t*)node_page->frame, INITIAL_FREE_SPACE);
-            offset = PAGE_SIZE;
-            for(pagenum_t i = 0; i < num_keys + 1; ++i) {
-                offset -= slot_io::get_record_size(&slots[i].slot);
-                slot_io::set_offset(&slots[i].slot, offset);
-                page_io::leaf::set_slot((page_t*)node_page->frame, i, &slots[i].slot);
-                page_io::leaf::set_record((page_t*)node_page->frame, offset, slots[i].record.c_str(), slots[i].record.size());
-                page_io::leaf::update_free_space((page_t*)node_page->frame, slots[i].record.size() + SLOT_SIZE);
-            }
+            page_io::leaf::insert_slot((page_t*)node_page->frame, 0, moved_key, record, size);
+            page_io::leaf::remove_slot((page_t*)neighbor_page->frame, last);
 
-            pagenum_t parent = page_io::get_parent_page((page_t*)node_page->frame);
             buffer_t* parent_page = buffer_manager.buffer_read_page(table_id, parent);
-            int64_t next_key = page_io::leaf::get_key((page_t*)node_page->frame, 0);
             buffer_manager.buffer_write_page(table_id, parent);
-            page_io::internal::set_key((page_t*)parent_page, prime_key_idx, next_key);
+            page_io::internal::set_key((page_t*)parent_page->frame, prime_key_idx, moved_key);
             buffer_manager.unpin_buffer(table_id, parent);
+            page_io::set_high_key((page_t*)neighbor_page->frame, moved_key);
         }
     }
     /* neighbor is on the extreme */
@@ -666,18 +729,15 @@ pagenum_t redistribute_nodes(int64_t table_id, pagenum_t root, pagenum_t node, p
             pagenum_t child = page_io::internal::get_child((page_t*)neighbor_page->frame, 0);
             page_io::internal::set_child((page_t*)node_page->frame, num_keys + 1, child);
 
-            buffer_t* child_page = buffer_manager.buffer_read_page(table_id, child);
-            buffer_manager.buffer_write_page(table_id, child);
-            page_io::set_parent_page((page_t*)child_page->frame, node);
-            buffer_manager.unpin_buffer(table_id, child);
-
-            pagenum_t parent = page_io::get_parent_page((page_t*)node_page->frame);
             buffer_t* parent_page = buffer_manager.buffer_read_page(table_id, parent);
             int64_t next_key = page_io::internal::get_key((page_t*)neighbor_page->frame, 0);
             
             buffer_manager.buffer_write_page(table_id, parent);
             page_io::internal::set_key((page_t*)parent_page->frame, prime_key_idx, next_key);
             buffer_manager.unpin_buffer(table_id, parent);
+            page_io::set_high_key((page_t*)node_page->frame, next_key);
+
+            buffer_manager.buffer_write_page(table_id, neighbor);
 
             /* Shift key and child */
             pagenum_t neighbor_num_keys = page_io::get_key_count((page_t*)neighbor_page->frame);
@@ -692,65 +752,34 @@ pagenum_t redistribute_nodes(int64_t table_id, pagenum_t root, pagenum_t node, p
             page_io::internal::set_child((page_t*)neighbor_page->frame, i, temp_child);
         }   
         else {
-            slotnum_t offset = page_io::leaf::get_offset((page_t*)node_page->frame, num_keys - 1);
-
+            // first record of the right neighbor becomes the last one of node
             neighbor_page = buffer_manager.buffer_read_page(table_id, neighbor);
-            
-            slot_t neighbor_slot;
-            slot_io::read_slot((page_t*)neighbor_page->frame, 0, &neighbor_slot);
-            slotnum_t neighbor_offset = slot_io::get_offset(&neighbor_slot);
-            slotnum_t neighbor_size = slot_io::get_record_size(&neighbor_slot);
-            char* temp_record = new char[neighbor_size];
-            page_io::leaf::get_record((page_t*)neighbor_page->frame, neighbor_offset, temp_record, neighbor_size);
+            int64_t moved_key = page_io::leaf::get_key((page_t*)neighbor_page->frame, 0);
+            slotnum_t size = page_io::leaf::get_record_size((page_t*)neighbor_page->frame, 0);
+            char record[PAGE_SIZE];
+            page_io::leaf::get_record((page_t*)neighbor_page->frame, page_io::leaf::get_offset((page_t*)neighbor_page->frame, 0), record, size);
 
             buffer_manager.buffer_write_page(table_id, node);
-            slot_io::set_offset(&neighbor_slot, offset - neighbor_size);
-            page_io::leaf::set_slot((page_t*)node_page->frame, num_keys, &neighbor_slot);
-            page_io::leaf::set_record((page_t*)node_page->frame, offset - neighbor_size, temp_record, neighbor_size);
-            delete[] temp_record;
-
             buffer_manager.buffer_write_page(table_id, neighbor);
-            page_io::leaf::update_free_space((page_t*)node_page->frame, neighbor_size + SLOT_SIZE);
-            page_io::leaf::update_free_space((page_t*)neighbor_page->frame, -(neighbor_size + SLOT_SIZE));
-
-            pagenum_t parent = page_io::get_parent_page((page_t*)node_page->frame);
+            page_io::leaf::insert_slot((page_t*)node_page->frame, num_keys, moved_key, record, size);
+            page_io::leaf::remove_slot((page_t*)neighbor_page->frame, 0);
 
             buffer_t* parent_page = buffer_manager.buffer_read_page(table_id, parent);
-            int64_t next_key = page_io::leaf::get_key((page_t*)neighbor_page->frame, 1);
+            int64_t next_key = page_io::leaf::get_key((page_t*)neighbor_page->frame, 0);
             buffer_manager.buffer_write_page(table_id, parent);
             page_io::internal::set_key((page_t*)parent_page->frame, prime_key_idx, next_key);
             buffer_manager.unpin_buffer(table_id, parent);
-
-            /* Shift key and child */
-            std::vector<comparison_struct> slots;
-            pagenum_t neighbor_num_keys = page_io::get_key_count((page_t*)neighbor_page->frame);
-            for(pagenum_t i = 0; i < neighbor_num_keys - 1; ++i) {
-                comparison_struct temp;
-                slot_io::read_slot((page_t*)neighbor_page->frame, i + 1, &temp.slot);
-                temp_record = new char[slot_io::get_record_size(&temp.slot)];
-                offset = slot_io::get_offset(&temp.slot);
-                page_io::leaf::get_record((page_t*)neighbor_page->frame, offset, temp_record, slot_io::get_record_size(&temp.slot));
-                temp.record = std::string(temp_record, slot_io::get_record_size(&temp.slot));
-                slots.push_back(temp);
-                delete[] temp_record;
-            }
-
-            page_io::leaf::set_free_space((page_t*)neighbor_page->frame, INITIAL_FREE_SPACE);
-            offset = PAGE_SIZE;
-            for(pagenum_t i = 0; i < neighbor_num_keys - 1; ++i) {
-                offset -= slot_io::get_record_size(&slots[i].slot);
-                slot_io::set_offset(&slots[i].slot, offset);
-                page_io::leaf::set_slot((page_t*)neighbor_page->frame, i, &slots[i].slot);
-                page_io::leaf::set_record((page_t*)neighbor_page->frame, offset, slots[i].record.c_str(), slots[i].record.size());
-                page_io::leaf::update_free_space((page_t*)neighbor_page->frame, slot_io::get_record_size(&slots[i].slot) + SLOT_SIZE);
-            }
+            page_io::set_high_key((page_t*)node_page->frame, next_key);
         }
     }
 
-    pagenum_t node_num_keys = page_io::get_key_count((page_t*)node_page->frame);
-    pagenum_t neighbor_num_keys = page_io::get_key_count((page_t*)neighbor_page->frame);
-    page_io::set_key_count((page_t*)node_page->frame, node_num_keys + 1);
-    page_io::set_key_count((page_t*)neighbor_page->frame, neighbor_num_keys - 1);
+    // leaf slots keep their own counts
+    if(!is_leaf) {
+        pagenum_t node_num_keys = page_io::get_key_count((page_t*)node_page->frame);
+        pagenum_t neighbor_num_keys = page_io::get_key_count((page_t*)neighbor_page->frame);
+        page_io::set_key_count((page_t*)node_page->frame, node_num_keys + 1);
+        page_io::set_key_count((page_t*)neighbor_page->frame, neighbor_num_keys - 1);
+    }
 
     buffer_manager.unpin_buffer(table_id, neighbor);
     buffer_manager.unpin_buffer(table_id, node);
@@ -758,7 +787,7 @@ pagenum_t redistribute_nodes(int64_t table_id, pagenum_t root, pagenum_t node, p
     return root;
 }
 
-pagenum_t merge_nodes(int64_t table_id, pagenum_t root, pagenum_t node, pagenum_t neighbor, pagenum_t neighbor_idx, int64_t prime_key) {
+pagenum_t merge_nodes(int64_t table_id, pagenum_t root, pagenum_t node, pagenum_t neighbor, pagenum_t neighbor_idx, int64_t prime_key, tree_path_t* path) {
     if(neighbor_idx == -1) std::swap(node, neighbor);
 
     buffer_t* neighbor_page = buffer_manager.buffer_read_page(table_id, neighbor);
@@ -793,137 +822,109 @@ pagenum_t merge_nodes(int64_t table_id, pagenum_t root, pagenum_t node, pagenum_
         pagenum_t temp_child = page_io::internal::get_child((page_t*)node_page->frame, j);
         page_io::internal::set_child((page_t*)neighbor_page->frame, i, temp_child);
 
-        neighbor_num_keys = page_io::get_key_count((page_t*)neighbor_page->frame);
-        for(pagenum_t i = 0; i < neighbor_num_keys + 1; ++i) {
-            pagenum_t child = page_io::internal::get_child((page_t*)neighbor_page->frame, i);
-            
-            buffer_t* child_page = buffer_manager.buffer_read_page(table_id, child);
-            buffer_manager.buffer_write_page(table_id, child);
-            page_io::set_parent_page((page_t*)child_page->frame, neighbor);
-            buffer_manager.unpin_buffer(table_id, child);
-        }
+        // neighbor now ends where node did
+        page_io::set_right_link((page_t*)neighbor_page->frame, page_io::get_right_link((page_t*)node_page->frame));
+        page_io::set_high_key((page_t*)neighbor_page->frame, page_io::get_high_key((page_t*)node_page->frame));
 
-        buffer_manager.unpin_buffer(table_id, neighbor);  
+        buffer_manager.unpin_buffer(table_id, neighbor);
     }
     else {
         /* Leaf node merge */
         pagenum_t num_keys = page_io::get_key_count((page_t*)node_page->frame);
-        slotnum_t offset = page_io::leaf::get_offset((page_t*)neighbor_page->frame, neighbor_insertion_idx - 1);
-        
+
+        // records of node go right below the neighbor's
         buffer_manager.buffer_write_page(table_id, neighbor);
         buffer_manager.buffer_write_page(table_id, node);
+        page_io::leaf::compact((page_t*)neighbor_page->frame);
         for(pagenum_t i = neighbor_insertion_idx, j = 0; j < num_keys; ++i, ++j) {
             slot_t temp_slot;
             slot_io::read_slot((page_t*)node_page->frame, j, &temp_slot);
-            slotnum_t size = slot_io::get_record_size(&temp_slot);
-            offset -= size;
-            slot_io::set_offset(&temp_slot, offset);
-            page_io::leaf::set_slot((page_t*)neighbor_page->frame, i, &temp_slot);
-
-            char* temp_record = new char[size];
-            slotnum_t temp_offset = slot_io::get_offset(&temp_slot);
-            page_io::leaf::get_record((page_t*)node_page->frame, temp_offset, temp_record, size);
-            page_io::leaf::set_record((page_t*)neighbor_page->frame, offset, temp_record, size);
-            delete[] temp_record;
-
-            /* update key count */
-            pagenum_t neighbor_num_keys = page_io::get_key_count((page_t*)neighbor_page->frame);
-            page_io::set_key_count((page_t*)neighbor_page->frame, neighbor_num_keys + 1);
-            page_io::leaf::update_free_space((page_t*)neighbor_page->frame, size + SLOT_SIZE);
+            const char* record = ((page_t*)node_page->frame)->data + slot_io::get_offset(&temp_slot);
+            page_io::leaf::insert_slot((page_t*)neighbor_page->frame, i, slot_io::get_key(&temp_slot), record, slot_io::get_record_size(&temp_slot));
         }
 
         pagenum_t right_sibling = page_io::leaf::get_right_sibling((page_t*)node_page->frame);
         page_io::leaf::set_right_sibling((page_t*)neighbor_page->frame, right_sibling);
+        page_io::set_high_key((page_t*)neighbor_page->frame, page_io::get_high_key((page_t*)node_page->frame));
 
         buffer_manager.unpin_buffer(table_id, neighbor);
     }
 
-    pagenum_t parent = page_io::get_parent_page((page_t*)node_page->frame);
     buffer_manager.unpin_buffer(table_id, node);
 
-    root = delete_entry(table_id, root, parent, prime_key);
+    // the key between the two goes out of the parent
+    pagenum_t parent = path->back();
+    path->pop_back();
+    root = delete_entry(table_id, root, parent, prime_key, path);
     buffer_manager.buffer_free_page(table_id, node);
 
     return root;
 }
 
-pagenum_t delete_entry(int64_t table_id, pagenum_t root, pagenum_t node, int64_t key) {
+pagenum_t delete_entry(int64_t table_id, pagenum_t root, pagenum_t node, int64_t key, tree_path_t* path) {
     node = remove_entry_from_node(table_id, key, node);
 
     /* Case : Deletion from the root */
     if(node == root) return adjust_root(table_id, root);
 
+    /* Page latches aren't reentrant and the helpers below latch these pages again,
+     * so every page is read and unpinned before the next one.
+     */
     buffer_t* node_page = buffer_manager.buffer_read_page(table_id, node);
     uint32_t num_keys = page_io::get_key_count((page_t*)node_page->frame);
     bool is_leaf = page_io::is_leaf((page_t*)node_page->frame);
+    pagenum_t free_space = page_io::leaf::get_free_space((page_t*)node_page->frame);
+    buffer_manager.unpin_buffer(table_id, node);
+    pagenum_t parent = path->back();
 
     int32_t min_keys = is_leaf ? -1 : cut_internal();
     
     /* Case : node stays at or above minimum after deletion */
-    if(!is_leaf && num_keys >= min_keys) {
-        buffer_manager.unpin_buffer(table_id, node);
-        return root;
-    }
-    else if(is_leaf) {
-        pagenum_t free_space = page_io::leaf::get_free_space((page_t*)node_page->frame);
-        if(free_space < THRESHOLD) {
-            buffer_manager.unpin_buffer(table_id, node);
-            return root;
-        }
-    }
+    if(!is_leaf && num_keys >= min_keys) return root;
+    else if(is_leaf && free_space < THRESHOLD) return root;
 
-    pagenum_t neighbor_idx = get_neighbor_idx(table_id, node);
+    pagenum_t neighbor_idx = get_neighbor_idx(table_id, parent, node);
     pagenum_t prime_key_idx = (neighbor_idx == -1) ? 0 : neighbor_idx;
-    int64_t prime_key = is_leaf 
-    ? page_io::leaf::get_key((page_t*)node_page->frame, prime_key_idx) 
-    : page_io::internal::get_key((page_t*)node_page->frame, prime_key_idx);
-    
-    pagenum_t parent = page_io::get_parent_page((page_t*)node_page->frame);
-    buffer_t* parent_page = buffer_manager.buffer_read_page(table_id, parent);
 
+    // key of the parent between node and its neighbor
+    buffer_t* parent_page = buffer_manager.buffer_read_page(table_id, parent);
+    int64_t prime_key = page_io::internal::get_key((page_t*)parent_page->frame, prime_key_idx);
     pagenum_t neighbor = (neighbor_idx == -1) 
     ? page_io::internal::get_child((page_t*)parent_page->frame, 1) 
     : page_io::internal::get_child((page_t*)parent_page->frame, neighbor_idx);
+    buffer_manager.unpin_buffer(table_id, parent);
 
     buffer_t* neighbor_page = buffer_manager.buffer_read_page(table_id, neighbor);
-
     uint32_t neighbor_num_keys = page_io::get_key_count((page_t*)neighbor_page->frame);
+    pagenum_t neighbor_free_space = page_io::leaf::get_free_space((page_t*)neighbor_page->frame);
+    buffer_manager.unpin_buffer(table_id, neighbor);
 
     if(!is_leaf) {
-        buffer_manager.unpin_buffer(table_id, node);
-        buffer_manager.unpin_buffer(table_id, neighbor);
-        buffer_manager.unpin_buffer(table_id, parent);
-    
-        if(neighbor_num_keys + num_keys < INTERNAL_ORDER - 1) return merge_nodes(table_id, root, node, neighbor, neighbor_idx, prime_key);
-        else return redistribute_nodes(table_id, root, node, neighbor, neighbor_idx, prime_key_idx, prime_key);
+        if(neighbor_num_keys + num_keys < INTERNAL_ORDER - 1) return merge_nodes(table_id, root, node, neighbor, neighbor_idx, prime_key, path);
+        else return redistribute_nodes(table_id, root, parent, node, neighbor, neighbor_idx, prime_key_idx, prime_key);
     }
     else {
-        pagenum_t free_space = page_io::leaf::get_free_space((page_t*)node_page->frame);
-        pagenum_t neighbor_free_space = page_io::leaf::get_free_space((page_t*)neighbor_page->frame);
         pagenum_t merged_space = (PAGE_SIZE - PAGE_HEADER_SIZE) - free_space
         + (PAGE_SIZE - PAGE_HEADER_SIZE) - neighbor_free_space;
 
         if(merged_space <= (PAGE_SIZE - PAGE_HEADER_SIZE)) {
-            buffer_manager.unpin_buffer(table_id, node);
-            buffer_manager.unpin_buffer(table_id, neighbor);
-            buffer_manager.unpin_buffer(table_id, parent);
-            return merge_nodes(table_id, root, node, neighbor, neighbor_idx, prime_key);
+            return merge_nodes(table_id, root, node, neighbor, neighbor_idx, prime_key, path);
         }
         else {
             do {
-                neighbor_idx = get_neighbor_idx(table_id, node);
+                neighbor_idx = get_neighbor_idx(table_id, parent, node);
                 prime_key_idx = (neighbor_idx == -1) ? 0 : neighbor_idx;
-                prime_key = page_io::leaf::get_key((page_t*)node_page->frame, prime_key_idx);
+                parent_page = buffer_manager.buffer_read_page(table_id, parent);
+                prime_key = page_io::internal::get_key((page_t*)parent_page->frame, prime_key_idx);
+                buffer_manager.unpin_buffer(table_id, parent);
 
-                root = redistribute_nodes(table_id, root, node, neighbor, neighbor_idx, prime_key_idx, prime_key);
+                root = redistribute_nodes(table_id, root, parent, node, neighbor, neighbor_idx, prime_key_idx, prime_key);
 
-                node_page = buffer_manager.buffer_read_page(table_id, node);                
+                node_page = buffer_manager.buffer_read_page(table_id, node);
+                free_space = page_io::leaf::get_free_space((page_t*)node_page->frame);
+                buffer_manager.unpin_buffer(table_id, node);
             }
-            while(page_io::leaf::get_free_space((page_t*)node_page->frame) >= THRESHOLD);
-
-            buffer_manager.unpin_buffer(table_id, node);
-            buffer_manager.unpin_buffer(table_id, neighbor);
-            buffer_manager.unpin_buffer(table_id, parent);
+            while(free_space >= THRESHOLD);
 
             return root;
         }
@@ -932,11 +933,191 @@ pagenum_t delete_entry(int64_t table_id, pagenum_t root, pagenum_t node, int64_t
 
 /* Master deletion function */
 pagenum_t master_delete(int64_t table_id, pagenum_t root, int64_t key) {
-    pagenum_t key_leaf = find_leaf(table_id, root, key);
+    tree_path_t path;
+    pagenum_t key_leaf = find_leaf(table_id, root, key, &path);
     auto location_pair = find(table_id, root, key);
 
     if(location_pair != std::pair<pagenum_t, slotnum_t>({0, 0})) 
-        root = delete_entry(table_id, root, key_leaf, key);
+        root = delete_entry(table_id, root, key_leaf, key, &path);
 
     return root;
 }
+
+/* Same conditions as delete_entry, a leaf that would underflow or an emptied root is left alone */
+int delete_in_leaf(int64_t table_id, pagenum_t root, int64_t key) {
+    if(root == 0) return 1;
+
+    pagenum_t leaf = find_leaf(table_id, root, key);
+    buffer_t* leaf_page = buffer_manager.buffer_read_page(table_id, leaf);
+    leaf_page = move_right(table_id, &leaf, leaf_page, key, PAGE_LATCH_EXCLUSIVE);
+
+    slotnum_t i = key_search::leaf_find_slot((page_t*)leaf_page->frame, key);
+    if(i < 0) {
+        buffer_manager.unpin_buffer(table_id, leaf);
+        return 1;
+    }
+
+    uint32_t num_keys = page_io::get_key_count((page_t*)leaf_page->frame);
+    pagenum_t free_space = page_io::leaf::get_free_space((page_t*)leaf_page->frame)
+    + page_io::leaf::get_record_size((page_t*)leaf_page->frame, i) + SLOT_SIZE;
+    if((leaf == root && num_keys == 1) || (leaf != root && free_space >= THRESHOLD)) {
+        buffer_manager.unpin_buffer(table_id, leaf);
+        return -1;
+    }
+
+    buffer_manager.buffer_write_page(table_id, leaf);
+    page_io::leaf::remove_slot((page_t*)leaf_page->frame, i);
+    buffer_manager.unpin_buffer(table_id, leaf);
+
+    return 0;
+}
+
+/* * * * * * * * * * * * * * BULK LOAD * * * * * * * * * * * * * */
+
+/* Nodes of one level waiting for their parent */
+struct bulk_level_t {
+    std::vector<std::pair<int64_t, pagenum_t>> pending;   // (lowest key, node)
+    pagenum_t last_parent;                                  // parent made last for nodes of this level, 0 before any
+
+    bulk_level_t() : last_parent(0) {}
+};
+
+/* Copy a page built off the buffer into page (pagenum) */
+static void write_page_image(int64_t table_id, pagenum_t pagenum, const page_t* image) {
+    buffer_t* page = buffer_manager.buffer_read_page(table_id, pagenum);
+    buffer_manager.buffer_write_page(table_id, pagenum);
+    memcpy(page->frame, image->data, PAGE_SIZE);
+    buffer_manager.unpin_buffer(table_id, pagenum);
+}
+
+static void init_leaf_image(page_t* image) {
+    memset(image->data, 0, PAGE_SIZE);
+    page_io::leaf::set_new_leaf_page(image);
+}
+
+/* Make the parent of (children) [begin, end), nodes of (level) */
+static pagenum_t make_bulk_parent(int64_t table_id, bulk_level_t* level, const std::vector<std::pair<int64_t, pagenum_t>>& children, size_t begin, size_t end) {
+    pagenum_t node = buffer_manager.buffer_alloc_page(table_id, children[end - 1].second);
+
+    page_t image;
+    memset(image.data, 0, PAGE_SIZE);
+    page_io::internal::set_new_internal_page(&image);
+    page_io::internal::set_child(&image, 0, children[begin].second);
+    for(size_t i = begin + 1; i < end; ++i) {
+        page_io::internal::set_key(&image, i - begin - 1, children[i].first);
+        page_io::internal::set_child(&image, i - begin, children[i].second);
+    }
+    page_io::set_key_count(&image, end - begin - 1);
+    write_page_image(table_id, node, &image);
+
+    // parents come left to right, the one before links to this one
+    if(level->last_parent != 0) {
+        buffer_t* left_page = buffer_manager.buffer_read_page(table_id, level->last_parent);
+        buffer_manager.buffer_write_page(table_id, level->last_parent);
+        page_io::set_right_link((page_t*)left_page->frame, node);
+        page_io::set_high_key((page_t*)left_page->frame, children[begin].first);
+        buffer_manager.unpin_buffer(table_id, level->last_parent);
+    }
+    level->last_parent = node;
+
+    return node;
+}
+
+/* Hand (node) of level (height) to the level above.
+ * A parent is made only once 2 * fan_out nodes wait, so the last ones can be split evenly.
+ */
+static void push_bulk_node(int64_t table_id, std::vector<bulk_level_t>& levels, size_t height,
+int64_t low_key, pagenum_t node, size_t fan_out) {
+    if(levels.size() == height) levels.push_back(bulk_level_t());
+
+    std::vector<std::pair<int64_t, pagenum_t>>& pending = levels[height].pending;
+    pending.push_back({low_key, node});
+    if(pending.size() < 2 * fan_out) return;
+
+    int64_t parent_low_key = pending[0].first;
+    pagenum_t parent = make_bulk_parent(table_id, &levels[height], pending, 0, fan_out);
+    pending.erase(pending.begin(), pending.begin() + fan_out);
+
+    push_bulk_node(table_id, levels, height + 1, parent_low_key, parent, fan_out);
+}
+
+/* Make parents of the nodes still waiting, level by level, and return the root */
+static pagenum_t finish_bulk_levels(int64_t table_id, std::vector<bulk_level_t>& levels, size_t fan_out) {
+    for(size_t height = 0; ; ++height) {
+        std::vector<std::pair<int64_t, pagenum_t>> pending = levels[height].pending;
+        if(levels[height].last_parent == 0 && pending.size() == 1) return pending[0].second;
+
+        // fewer than 2 * fan_out wait, at most two parents
+        size_t cut = pending.size() <= INTERNAL_ORDER ? pending.size() : pending.size() / 2;
+        pagenum_t parent = make_bulk_parent(table_id, &levels[height], pending, 0, cut);
+        push_bulk_node(table_id, levels, height + 1, pending[0].first, parent, fan_out);
+        if(cut < pending.size()) {
+            parent = make_bulk_parent(table_id, &levels[height], pending, cut, pending.size());
+            push_bulk_node(table_id, levels, height + 1, pending[cut].first, parent, fan_out);
+        }
+    }
+}
+
+/* Build the tree of an empty table from records in ascending key order.
+ * Leaves are filled left to right up to (fill_percent) of their space, internal levels
+ * are built bottom-up. On a bad record the records before it stay loaded and -1 is returned.
+ */
+int bulk_load(int64_t table_id, const bulk_load_next_t& next, int fill_percent) {
+    buffer_t* header = buffer_manager.buffer_read_page(table_id, 0, PAGE_LATCH_SHARED);
+    pagenum_t root = page_io::header::get_root_page((page_t*)header->frame);
+    buffer_manager.unpin_buffer(table_id, 0);
+    if(root != 0) return -1;
+
+    pagenum_t fill_space = INITIAL_FREE_SPACE * fill_percent / 100;
+    size_t fan_out = std::max(cut_internal() + 1, INTERNAL_ORDER * fill_percent / 100);
+    std::vector<bulk_level_t> levels;
+
+    page_t leaf_image;
+    pagenum_t leaf = 0;
+    int64_t leaf_low_key = 0;
+    uint32_t num_keys = 0;
+    int64_t prev_key = 0;
+    int ret = 0;
+
+    int64_t key;
+    const char* value;
+    uint16_t size;
+    while(next(&key, &value, &size)) {
+        if(size < 50 || size > 112 || (leaf != 0 && key <= prev_key)) {
+            ret = -1;
+            break;
+        }
+        prev_key = key;
+
+        if(leaf == 0) {
+            leaf = buffer_manager.buffer_alloc_page(table_id);
+            init_leaf_image(&leaf_image);
+        } else if(INITIAL_FREE_SPACE - page_io::leaf::get_free_space(&leaf_image) + size + SLOT_SIZE > fill_space) {
+            // leaf is full, the next one is its right sibling
+            pagenum_t new_leaf = buffer_manager.buffer_alloc_page(table_id, leaf);
+            page_io::leaf::set_right_sibling(&leaf_image, new_leaf);
+            page_io::set_high_key(&leaf_image, key);
+            write_page_image(table_id, leaf, &leaf_image);
+            push_bulk_node(table_id, levels, 0, leaf_low_key, leaf, fan_out);
+
+            leaf = new_leaf;
+            init_leaf_image(&leaf_image);
+            num_keys = 0;
+        }
+        if(num_keys == 0) leaf_low_key = key;
+
+        page_io::leaf::insert_slot(&leaf_image, num_keys++, key, value, size);
+    }
+    if(leaf == 0) return ret;
+
+    write_page_image(table_id, leaf, &leaf_image);
+    push_bulk_node(table_id, levels, 0, leaf_low_key, leaf, fan_out);
+    root = finish_bulk_levels(table_id, levels, fan_out);
+
+    header = buffer_manager.buffer_read_page(table_id, 0);
+    buffer_manager.buffer_write_page(table_id, 0);
+    page_io::header::set_root_page((page_t*)header->frame, root);
+    buffer_manager.unpin_buffer(table_id, 0);
+
+    return ret;
+}
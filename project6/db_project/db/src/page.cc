@@ -1,5 +1,7 @@
 #include "page.h"
 
+#include <algorithm>
+
 /* PAGE IO */
 // Set LSN
 void page_io::set_page_LSN(page_t* page, uint64_t LSN) {
@@ -35,17 +37,33 @@ uint32_t page_io::get_key_count(const page_t* page) {
 void page_io::set_key_count(page_t* page, uint32_t key_count) {
     memcpy(page->data + KEY_COUNT_OFFSET, &key_count, sizeof(uint32_t));
 }
-pagenum_t page_io::get_parent_page(const page_t* page) {
-    pagenum_t parent_page;
-    memcpy(&parent_page, page->data, sizeof(pagenum_t));
-    return parent_page;
-}
-void page_io::set_parent_page(page_t* page, pagenum_t parent_page) {
-    memcpy(page->data, &parent_page, sizeof(pagenum_t));
-}
 void page_io::set_free_page_next(page_t* page, pagenum_t next_free_page) {
     memcpy(page->data, &next_free_page, sizeof(pagenum_t));
 }
+// Get next page of the same level, 0 for the last one. Leaves keep it as their right sibling
+pagenum_t page_io::get_right_link(const page_t* page) {
+    if(page_io::is_leaf(page)) return page_io::leaf::get_right_sibling(page);
+    pagenum_t right_link;
+    memcpy(&right_link, page->data + INTERNAL_RIGHT_LINK_OFFSET, sizeof(pagenum_t));
+    return right_link;
+}
+void page_io::set_right_link(page_t* page, pagenum_t right_link) {
+    if(page_io::is_leaf(page)) page_io::leaf::set_right_sibling(page, right_link);
+    else memcpy(page->data + INTERNAL_RIGHT_LINK_OFFSET, &right_link, sizeof(pagenum_t));
+}
+// Get first key past the page, only meaningful with a right link
+int64_t page_io::get_high_key(const page_t* page) {
+    int64_t high_key;
+    memcpy(&high_key, page->data + HIGH_KEY_OFFSET, sizeof(int64_t));
+    return high_key;
+}
+void page_io::set_high_key(page_t* page, int64_t high_key) {
+    memcpy(page->data + HIGH_KEY_OFFSET, &high_key, sizeof(int64_t));
+}
+// Whether (key) belongs to a page right of this one
+bool page_io::is_past_high_key(const page_t* page, int64_t key) {
+    return page_io::get_right_link(page) != 0 && key >= page_io::get_high_key(page);
+}
 
 /* HEADER PAGE IO */
 
@@ -54,6 +72,8 @@ void page_io::set_free_page_next(page_t* page, pagenum_t next_free_page) {
 * [1] = next page number(next_free_page), 
 * [2] = number of pages(page_cnt),
 * [3] = root page number
+* [4] = first page never handed out (first_unused_page), set by set_first_unused_page
+* [5] = number of bitmap pages, [6..] = bitmap page of each group, set by add_bitmap_page
 */
 void page_io::header::set_header_page(page_t* header_page, pagenum_t next_free_page, pagenum_t page_cnt, pagenum_t root_page) {
     pagenum_t magic_number = MAGIC_NUMBER;
@@ -81,16 +101,102 @@ pagenum_t page_io::header::get_page_count(const page_t* header_page) {
     memcpy(&page_cnt, header_page->data + sizeof(pagenum_t) * 2, sizeof(pagenum_t));
     return page_cnt;
 }
+// Set first page of the unused extent, pages from it to page count were never written.
+void page_io::header::set_first_unused_page(page_t* header_page, pagenum_t first_unused_page) {
+    memcpy(header_page->data + sizeof(pagenum_t) * 4, &first_unused_page, sizeof(pagenum_t));
+}
+// Get first page of the unused extent.
+pagenum_t page_io::header::get_first_unused_page(const page_t* header_page) {
+    pagenum_t first_unused_page;
+    memcpy(&first_unused_page, header_page->data + sizeof(pagenum_t) * 4, sizeof(pagenum_t));
+    // 0: file grown by writing every free page, nothing is left unused
+    if(first_unused_page == 0) return get_page_count(header_page);
+    return first_unused_page;
+}
+// Get number of free space bitmap pages, 0 if the file still uses the free page list.
+uint64_t page_io::header::get_bitmap_count(const page_t* header_page) {
+    uint64_t bitmap_cnt;
+    memcpy(&bitmap_cnt, header_page->data + HEADER_BITMAP_COUNT_OFFSET, sizeof(uint64_t));
+    return bitmap_cnt;
+}
+// Get bitmap page of pages [group * PAGES_PER_BITMAP, (group + 1) * PAGES_PER_BITMAP)
+pagenum_t page_io::header::get_bitmap_page(const page_t* header_page, uint64_t group) {
+    pagenum_t bitmap_page;
+    memcpy(&bitmap_page, header_page->data + HEADER_BITMAP_PAGES_OFFSET + group * sizeof(pagenum_t), sizeof(pagenum_t));
+    return bitmap_page;
+}
+// Append bitmap page of the next group
+void page_io::header::add_bitmap_page(page_t* header_page, pagenum_t bitmap_page) {
+    uint64_t bitmap_cnt = get_bitmap_count(header_page);
+    memcpy(header_page->data + HEADER_BITMAP_PAGES_OFFSET + bitmap_cnt * sizeof(pagenum_t), &bitmap_page, sizeof(pagenum_t));
+    bitmap_cnt++;
+    memcpy(header_page->data + HEADER_BITMAP_COUNT_OFFSET, &bitmap_cnt, sizeof(uint64_t));
+}
+// Keep bitmap pages of the first (bitmap_cnt) groups only
+void page_io::header::set_bitmap_count(page_t* header_page, uint64_t bitmap_cnt) {
+    memcpy(header_page->data + HEADER_BITMAP_COUNT_OFFSET, &bitmap_cnt, sizeof(uint64_t));
+}
+// Get number of pages of (group) that exist in the file, the last group may be partial
+uint32_t page_io::header::get_group_size(const page_t* header_page, uint64_t group) {
+    pagenum_t page_cnt = get_page_count(header_page);
+    pagenum_t group_start = group * PAGES_PER_BITMAP;
+    if(page_cnt - group_start > PAGES_PER_BITMAP) return PAGES_PER_BITMAP;
+    return page_cnt - group_start;
+}
+// Get compression mode of the table, COMPRESSION_NONE (0) in files from before compression
+int page_io::header::get_compression(const page_t* header_page) {
+    uint64_t mode;
+    memcpy(&mode, header_page->data + HEADER_COMPRESSION_OFFSET, sizeof(uint64_t));
+    return (int)mode;
+}
+void page_io::header::set_compression(page_t* header_page, int mode) {
+    uint64_t mode_val = mode;
+    memcpy(header_page->data + HEADER_COMPRESSION_OFFSET, &mode_val, sizeof(uint64_t));
+}
+
+/* BITMAP PAGE IO */
+// Check page (idx) of the group is in use
+bool page_io::bitmap::is_used(const page_t* bitmap_page, uint32_t idx) {
+    return (bitmap_page->data[idx / 8] >> (idx % 8)) & 1;
+}
+void page_io::bitmap::set_used(page_t* bitmap_page, uint32_t idx) {
+    bitmap_page->data[idx / 8] |= (char)(1 << (idx % 8));
+}
+void page_io::bitmap::set_free(page_t* bitmap_page, uint32_t idx) {
+    bitmap_page->data[idx / 8] &= (char)~(1 << (idx % 8));
+}
+// Find free page in [from, limit) of the group, then wrap around to [0, from).
+// Returns -1 if every page up to (limit) is in use.
+int64_t page_io::bitmap::find_free(const page_t* bitmap_page, uint32_t from, uint32_t limit) {
+    for(int pass = 0; pass < 2; ++pass) {
+        uint32_t begin = pass == 0 ? from : 0;
+        uint32_t end = pass == 0 ? limit : (from < limit ? from : limit);
+        // 64 pages at a time, bits before idx in the first word don't count
+        for(uint32_t idx = begin; idx < end; idx = idx / 64 * 64 + 64) {
+            uint64_t word;
+            memcpy(&word, bitmap_page->data + idx / 64 * 8, sizeof(uint64_t));
+            word |= (1ULL << (idx % 64)) - 1;
+            if(word == ~0ULL) continue;
+
+            uint32_t found = idx / 64 * 64 + __builtin_ctzll(~word);
+            if(found < end) return found;
+            break;
+        }
+    }
+    return -1;
+}
 
 /* INTERNAL PAGE IO */
 void page_io::internal::set_new_internal_page(page_t* internal_page) {
-    pagenum_t parent_page = 0;
+    pagenum_t parent_page = 0;     // older files kept the parent here, it's unused now
     int32_t is_leaf = 0;
     uint32_t key_count = 0;
 
     memcpy(internal_page->data, &parent_page, sizeof(pagenum_t));
     memcpy(internal_page->data + sizeof(pagenum_t), &is_leaf, sizeof(int32_t));
     memcpy(internal_page->data + sizeof(pagenum_t) + sizeof(int32_t), &key_count, sizeof(uint32_t));
+    page_io::set_right_link(internal_page, 0);
+    page_io::set_high_key(internal_page, 0);
 }
 
 int64_t page_io::internal::get_key(const page_t* internal_page, pagenum_t idx) {
@@ -115,7 +221,7 @@ void page_io::internal::set_child(page_t* internal_page, pagenum_t idx, pagenum_
 void page_io::leaf::set_new_leaf_page(page_t* leaf_page) {
     int32_t is_leaf = 1;
     uint32_t key_count = 0;
-    pagenum_t parent_pagenum = 0;
+    pagenum_t parent_pagenum = 0;  // older files kept the parent here, it's unused now
     memcpy(leaf_page->data, &parent_pagenum, sizeof(pagenum_t));
     memcpy(leaf_page->data + sizeof(pagenum_t), &is_leaf, sizeof(int32_t));
     memcpy(leaf_page->data + sizeof(pagenum_t) + sizeof(uint32_t), &key_count, sizeof(uint32_t));
@@ -124,6 +230,8 @@ void page_io::leaf::set_new_leaf_page(page_t* leaf_page) {
     pagenum_t right_sibling = 0;
     memcpy(leaf_page->data + LEAF_PAGE_OFFSET, &free_space, sizeof(pagenum_t));
     memcpy(leaf_page->data + LEAF_PAGE_OFFSET + sizeof(pagenum_t), &right_sibling, sizeof(pagenum_t));
+    page_io::set_high_key(leaf_page, 0);
+    page_io::leaf::set_record_start(leaf_page, PAGE_SIZE);
 }
 // Modify free space of leaf page.
 void page_io::leaf::update_free_space(page_t* leaf_page, slotnum_t size) {
@@ -177,6 +285,80 @@ slotnum_t page_io::leaf::get_offset(const page_t* leaf_page, slotnum_t slot_num)
     return offset;
 }
 
+// Get lowest record offset, the free gap ends there. PAGE_SIZE if there is no record
+slotnum_t page_io::leaf::get_record_start(const page_t* leaf_page) {
+    slotnum_t record_start;
+    memcpy(&record_start, leaf_page->data + LEAF_RECORD_START_OFFSET, sizeof(slotnum_t));
+    if(record_start != 0) return record_start;
+
+    // leaf from before the header kept it
+    uint32_t num_keys = page_io::get_key_count(leaf_page);
+    int32_t lowest = PAGE_SIZE;
+    for(uint32_t i = 0; i < num_keys; ++i)
+        lowest = std::min<int32_t>(lowest, page_io::leaf::get_offset(leaf_page, i));
+    return lowest;
+}
+void page_io::leaf::set_record_start(page_t* leaf_page, slotnum_t record_start) {
+    memcpy(leaf_page->data + LEAF_RECORD_START_OFFSET, &record_start, sizeof(slotnum_t));
+}
+// Pack records against the end of the page in slot order, holes of deleted records are gone after
+void page_io::leaf::compact(page_t* leaf_page) {
+    page_t old_page;
+    memcpy(old_page.data, leaf_page->data, PAGE_SIZE);
+
+    uint32_t num_keys = page_io::get_key_count(leaf_page);
+    int32_t offset = PAGE_SIZE;
+    for(uint32_t i = 0; i < num_keys; ++i) {
+        slot_t slot;
+        slot_io::read_slot(&old_page, i, &slot);
+        slotnum_t size = slot_io::get_record_size(&slot);
+        offset -= size;
+        memcpy(leaf_page->data + offset, old_page.data + slot_io::get_offset(&slot), size);
+        slot_io::set_offset(&slot, offset);
+        page_io::leaf::set_slot(leaf_page, i, &slot);
+    }
+    page_io::leaf::set_record_start(leaf_page, offset);
+}
+// Insert a record as slot (slot_num), slots from there on move one up.
+// Free space must have room for the record and its slot.
+void page_io::leaf::insert_slot(page_t* leaf_page, slotnum_t slot_num, int64_t key, const char* value, uint16_t size) {
+    uint32_t num_keys = page_io::get_key_count(leaf_page);
+    int32_t slot_end = LEAF_PAGE_SLOT_OFFSET + (num_keys + 1) * SLOT_SIZE;
+    int32_t record_start = page_io::leaf::get_record_start(leaf_page);
+    if(record_start - slot_end < size) {
+        page_io::leaf::compact(leaf_page);
+        record_start = page_io::leaf::get_record_start(leaf_page);
+    }
+
+    char* slots = leaf_page->data + LEAF_PAGE_SLOT_OFFSET;
+    memmove(slots + (slot_num + 1) * SLOT_SIZE, slots + slot_num * SLOT_SIZE, (num_keys - slot_num) * SLOT_SIZE);
+
+    slot_t slot;
+    slotnum_t offset = record_start - size;
+    slot_io::set_new_slot(&slot, key, size, offset);
+    page_io::leaf::set_slot(leaf_page, slot_num, &slot);
+    page_io::leaf::set_record(leaf_page, offset, value, size);
+    page_io::leaf::set_record_start(leaf_page, offset);
+    page_io::leaf::update_free_space(leaf_page, size + SLOT_SIZE);
+    page_io::set_key_count(leaf_page, num_keys + 1);
+}
+// Remove slot (slot_num), its record is left as a hole
+void page_io::leaf::remove_slot(page_t* leaf_page, slotnum_t slot_num) {
+    uint32_t num_keys = page_io::get_key_count(leaf_page);
+    slotnum_t size = page_io::leaf::get_record_size(leaf_page, slot_num);
+    slotnum_t offset = page_io::leaf::get_offset(leaf_page, slot_num);
+
+    // the lowest record gives its bytes back to the gap, holes above it stay holes
+    slotnum_t record_start = page_io::leaf::get_record_start(leaf_page);
+    if(offset == record_start) page_io::leaf::set_record_start(leaf_page, num_keys == 1 ? PAGE_SIZE : offset + size);
+
+    char* slots = leaf_page->data + LEAF_PAGE_SLOT_OFFSET;
+    memmove(slots + slot_num * SLOT_SIZE, slots + (slot_num + 1) * SLOT_SIZE, (num_keys - slot_num - 1) * SLOT_SIZE);
+
+    page_io::leaf::update_free_space(leaf_page, -(size + SLOT_SIZE));
+    page_io::set_key_count(leaf_page, num_keys - 1);
+}
+
 /* SLOT IO */
 // Get slot from (slot_num) slot.
 void slot_io::read_slot(const page_t* page, slotnum_t slot_num, slot_t* slot) {
@@ -55,20 +55,10 @@ void TrxManager::undo_actions(int trx_id) {
     while(!log_stack.empty()) {
         auto& log = log_stack.top();
 
-        buffer_t* page = buffer_manager.buffer_read_page(log.table_id, log.page_id);
-        buffer_manager.buffer_write_page(log.table_id, log.page_id);
-        slotnum_t offset = page_io::leaf::get_offset((page_t*)page->frame, log.slot_num);
-
-        char* buf = new char[log.old_val_size];
-        page_io::leaf::get_record((page_t*)page->frame, offset, buf, log.old_val_size);
-        std::string cur_value = std::string(buf, log.old_val_size);
-        delete[] buf;
-
-        update_log_t* real_log = new update_log_t(trx_id, log.table_id, log.page_id, offset, log.old_val_size, cur_value, log.old_value);
-        log_buf_manager.add_log(real_log);
-        
-        page_io::leaf::set_record((page_t*)page->frame, offset, log.old_value.c_str(), log.old_val_size);
-        buffer_manager.unpin_buffer(log.table_id, log.page_id);
+        // the X lock keeps the record, the table access keeps vacuum off the descent
+        TableAccess access(log.table_id, TABLE_ACCESS_READ);
+        std::string cur_value;
+        trx_update_record(log.table_id, log.key, log.old_value.c_str(), log.old_val_size, trx_id, &cur_value);
 
         log_stack.pop();
     }
@@ -132,22 +122,9 @@ void TrxManager::update_graph(lock_t* lock_obj) {
         cur_lock_obj = cur_lock_obj->prev;
     }
 }
-void TrxManager::add_log_to_trx(int64_t table_id, pagenum_t page_id, slotnum_t slot_num, int trx_id) {
+void TrxManager::add_log_to_trx(int64_t table_id, int64_t key, const std::string& old_value, int trx_id) {
     pthread_mutex_lock(&trx_manager_latch);
-
-    char* old_value = nullptr;
-    int old_val_size;
-
-    buffer_t* page = buffer_manager.buffer_read_page(table_id, page_id);
-    slotnum_t offset = page_io::leaf::get_offset((page_t*)page->frame, slot_num);
-    old_val_size = page_io::leaf::get_record_size((page_t*)page->frame, slot_num);
-    old_value = new char[old_val_size];
-    page_io::leaf::get_record((page_t*)page->frame, offset, old_value, old_val_size);
-    buffer_manager.unpin_buffer(table_id, page_id);
-
-    trx_log_table[trx_id].push({std::string(old_value, old_val_size), old_val_size, table_id, page_id, slot_num});
-    delete[] old_value;
-
+    trx_log_table[trx_id].push({old_value, (int)old_value.size(), table_id, key});
     pthread_mutex_unlock(&trx_manager_latch);
 }
 void TrxManager::print_adj() {
@@ -188,8 +165,8 @@ int trx_commit(int trx_id) {
     return trx_id;
 }
 
-int trx_get_lock(int64_t table_id, pagenum_t page_id, slotnum_t slot_num, int trx_id, int lock_mode) {
-    lock_t* lock_obj = lock_acquire(table_id, page_id, slot_num, trx_id, lock_mode);
+int trx_get_lock(int64_t table_id, int64_t key, int trx_id, int lock_mode) {
+    lock_t* lock_obj = lock_acquire(table_id, key, trx_id, lock_mode);
 
     // transaction already has a lock on the record.
     if(lock_obj == nullptr) return 0;
@@ -220,4 +197,32 @@ int trx_abort(int trx_id) {
     trx_manager.abort_trx(trx_id);
 
     return trx_id;
-}
\ No newline at end of file
+}
+
+int trx_update_record(int64_t table_id, int64_t key, const char* value, uint16_t size, int trx_id, std::string* old_value) {
+    buffer_t* header = buffer_manager.buffer_read_page(table_id, 0, PAGE_LATCH_SHARED);
+    pagenum_t root = page_io::header::get_root_page((page_t*)header->frame);
+    buffer_manager.unpin_buffer(table_id, 0);
+
+    buffer_t* leaf_page;
+    slotnum_t slot;
+    pagenum_t leaf = latch_record(table_id, root, key, &leaf_page, &slot);
+    if(leaf == 0) return -1;
+
+    // slot and offset are only good while the leaf stays latched
+    uint16_t old_size = page_io::leaf::get_record_size((page_t*)leaf_page->frame, slot);
+    slotnum_t offset = page_io::leaf::get_offset((page_t*)leaf_page->frame, slot);
+    old_value->resize(old_size);
+    page_io::leaf::get_record((page_t*)leaf_page->frame, offset, &(*old_value)[0], old_size);
+
+    buffer_manager.buffer_write_page(table_id, leaf);
+    update_log_t* log = new update_log_t(trx_id, table_id, leaf, offset, old_size, *old_value, std::string(value, size));
+    // the log may be flushed and freed by the page cleaner or the checkpointer from here on
+    uint64_t LSN = log_buf_manager.add_log(log);
+
+    page_io::set_page_LSN((page_t*)leaf_page->frame, LSN);
+    page_io::leaf::set_record((page_t*)leaf_page->frame, offset, value, size);
+    buffer_manager.unpin_buffer(table_id, leaf);
+
+    return 0;
+}
@@ -0,0 +1,170 @@
+#include "uring.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include <algorithm>
+
+/* liburing isn't available, talk to the kernel directly */
+static int sys_io_uring_setup(unsigned entries, io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/* private */
+bool IoUring::submit_and_wait(unsigned count) {
+    unsigned submitted = 0;
+    while(submitted < count) {
+        int ret = sys_io_uring_enter(ring_fd, count - submitted, count - submitted, IORING_ENTER_GETEVENTS);
+        if(ret < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        submitted += ret;
+    }
+    return true;
+}
+bool IoUring::run_chunk(int opcode, uring_req_t* reqs, unsigned count) {
+    unsigned tail = *sq_tail;
+    for(unsigned i = 0; i < count; ++i) {
+        iovecs[i].iov_base = reqs[i].buf;
+        iovecs[i].iov_len = reqs[i].len;
+
+        unsigned idx = tail & *sq_mask;
+        io_uring_sqe* sqe = &sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = opcode;
+        sqe->fd = reqs[i].fd;
+        sqe->off = reqs[i].offset;
+        if(reqs[i].iov != nullptr) {
+            sqe->addr = (uint64_t)reqs[i].iov;
+            sqe->len = reqs[i].iovcnt;
+        } else {
+            sqe->addr = (uint64_t)&iovecs[i];
+            sqe->len = 1;
+        }
+        sqe->user_data = i;
+
+        sq_array[idx] = idx;
+        tail++;
+    }
+    // sqes must be visible to the kernel before the new tail
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+    if(!submit_and_wait(count)) return false;
+
+    bool ok = true;
+    unsigned reaped = 0;
+    while(reaped < count) {
+        unsigned head = *cq_head;
+        unsigned ready = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        if(head == ready) {
+            // completions we waited for may still be on their way
+            if(sys_io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) return false;
+            continue;
+        }
+        while(head != ready) {
+            io_uring_cqe* cqe = &cqes[head & *cq_mask];
+            // short read past the end of file is not an error, like pread
+            if(cqe->res < 0) ok = false;
+            head++;
+            reaped++;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return ok;
+}
+
+/* public */
+IoUring::IoUring() {
+    ring_fd = -1;
+    entries = 0;
+    sq_ptr = cq_ptr = nullptr;
+    sqes = nullptr;
+    sq_len = cq_len = sqes_len = 0;
+}
+
+IoUring::~IoUring() {
+    destroy();
+}
+
+bool IoUring::init(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = sys_io_uring_setup(entries, &params);
+    if(fd < 0) return false;
+
+    sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_len = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sqes_len = params.sq_entries * sizeof(io_uring_sqe);
+
+    sq_ptr = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    cq_ptr = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void* sqes_ptr = mmap(NULL, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || sqes_ptr == MAP_FAILED) {
+        if(sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_len);
+        if(cq_ptr != MAP_FAILED) munmap(cq_ptr, cq_len);
+        if(sqes_ptr != MAP_FAILED) munmap(sqes_ptr, sqes_len);
+        sq_ptr = cq_ptr = nullptr;
+        close(fd);
+        return false;
+    }
+
+    char* sq = (char*)sq_ptr;
+    char* cq = (char*)cq_ptr;
+    sq_head = (unsigned*)(sq + params.sq_off.head);
+    sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    sq_array = (unsigned*)(sq + params.sq_off.array);
+    cq_head = (unsigned*)(cq + params.cq_off.head);
+    cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    sqes = (io_uring_sqe*)sqes_ptr;
+
+    ring_fd = fd;
+    this->entries = params.sq_entries;
+    iovecs.resize(this->entries);
+
+    return true;
+}
+
+bool IoUring::is_ready() { return ring_fd >= 0; }
+
+bool IoUring::read(std::vector<uring_req_t>& reqs) {
+    bool ok = true;
+    for(size_t i = 0; i < reqs.size(); i += entries) {
+        unsigned count = std::min((size_t)entries, reqs.size() - i);
+        ok &= run_chunk(IORING_OP_READV, &reqs[i], count);
+    }
+    return ok;
+}
+
+bool IoUring::write(std::vector<uring_req_t>& reqs) {
+    bool ok = true;
+    for(size_t i = 0; i < reqs.size(); i += entries) {
+        unsigned count = std::min((size_t)entries, reqs.size() - i);
+        ok &= run_chunk(IORING_OP_WRITEV, &reqs[i], count);
+    }
+    return ok;
+}
+
+void IoUring::destroy() {
+    if(ring_fd < 0) return;
+
+    munmap(sqes, sqes_len);
+    munmap(cq_ptr, cq_len);
+    munmap(sq_ptr, sq_len);
+    close(ring_fd);
+
+    ring_fd = -1;
+    sq_ptr = cq_ptr = nullptr;
+    sqes = nullptr;
+}
@@ -0,0 +1,305 @@
+#include "vacuum.h"
+#include "log.h"
+
+#include <set>
+
+extern BufferManager buffer_manager;
+
+std::map<int64_t, table_latch_t*> table_latches;
+pthread_mutex_t table_latches_latch = PTHREAD_MUTEX_INITIALIZER;
+
+/* Tree pages of a table in the order vacuum lays them out */
+struct vacuum_plan_t {
+    std::vector<pagenum_t> location;                // current page of each node
+    std::vector<pagenum_t> dest;                    // page each node moves to
+    std::vector<size_t> parent;                     // parent node, the root has none (SIZE_MAX)
+    std::vector<int> depth;                         // level of each node, the root is at 0
+    std::unordered_map<pagenum_t, size_t> owner;    // node in a page
+    size_t first_leaf;                              // nodes [first_leaf, ) are leaves in key order
+};
+
+/************************************************************************/
+// * TABLE LATCHES                                                      //
+/************************************************************************/
+
+void init_table_latch(int64_t table_id) {
+    pthread_mutex_lock(&table_latches_latch);
+    if(table_latches.find(table_id) == table_latches.end()) {
+        table_latch_t* latch = new table_latch_t;
+        pthread_rwlock_init(&latch->access_latch, NULL);
+        pthread_rwlock_init(&latch->modify_latch, NULL);
+        table_latches[table_id] = latch;
+    }
+    pthread_mutex_unlock(&table_latches_latch);
+}
+// No latch, like get_fd: a table is opened before anyone uses it
+table_latch_t* get_table_latch(int64_t table_id) {
+    auto it = table_latches.find(table_id);
+    return it == table_latches.end() ? nullptr : it->second;
+}
+
+TableAccess::TableAccess(int64_t table_id, int mode) {
+    latch = get_table_latch(table_id);
+    this->mode = mode;
+    if(latch == nullptr) return;
+
+    if(mode == TABLE_ACCESS_MODIFY) pthread_rwlock_rdlock(&latch->modify_latch);
+    if(mode == TABLE_ACCESS_RESHAPE || mode == TABLE_ACCESS_MERGE) pthread_rwlock_wrlock(&latch->modify_latch);
+    // readers go first (default rwlock), and never wait on a record lock while they hold it
+    if(mode == TABLE_ACCESS_MERGE) pthread_rwlock_wrlock(&latch->access_latch);
+    else pthread_rwlock_rdlock(&latch->access_latch);
+}
+TableAccess::~TableAccess() {
+    if(latch == nullptr) return;
+
+    pthread_rwlock_unlock(&latch->access_latch);
+    if(mode != TABLE_ACCESS_READ) pthread_rwlock_unlock(&latch->modify_latch);
+}
+
+/************************************************************************/
+// * VACUUM STATS                                                       //
+/************************************************************************/
+
+vacuum_stats_t::vacuum_stats_t() {
+    pages_before = pages_after = pages_moved = 0;
+    leaf_count = leaves_skipped = 0;
+    leaf_runs_before = leaf_runs_after = 0;
+}
+uint64_t vacuum_stats_t::reclaimed_bytes() const {
+    return (pages_before - pages_after) * PAGE_SIZE;
+}
+double vacuum_stats_t::sequential_ratio_before() const {
+    if(leaf_count < 2) return 1;
+    return (double)(leaf_count - leaf_runs_before) / (leaf_count - 1);
+}
+double vacuum_stats_t::sequential_ratio_after() const {
+    if(leaf_count < 2) return 1;
+    return (double)(leaf_count - leaf_runs_after) / (leaf_count - 1);
+}
+void vacuum_stats_t::print(std::ostream& os) const {
+    os << "vacuum: " << pages_before << " -> " << pages_after << " pages, reclaimed "
+       << reclaimed_bytes() << " bytes, moved " << pages_moved << " pages" << std::endl;
+    os << "  leaves: " << leaf_count << ", skipped " << leaves_skipped
+       << ", runs " << leaf_runs_before << " -> " << leaf_runs_after
+       << ", sequential ratio " << sequential_ratio_before() << " -> " << sequential_ratio_after() << std::endl;
+}
+
+/************************************************************************/
+// * VACUUM                                                             //
+/************************************************************************/
+
+/* Count runs of leaves in consecutive pages */
+static pagenum_t count_leaf_runs(const vacuum_plan_t& plan) {
+    pagenum_t runs = 0;
+    for(size_t i = plan.first_leaf; i < plan.location.size(); ++i)
+        if(i == plan.first_leaf || plan.location[i] != plan.location[i - 1] + 1) runs++;
+    return runs;
+}
+
+/* Collect tree pages level by level, leaves of the last level come in key order */
+static void make_vacuum_plan(int64_t table_id, vacuum_plan_t* plan) {
+    buffer_t* header = buffer_manager.buffer_read_page(table_id, 0, PAGE_LATCH_SHARED);
+    pagenum_t root = page_io::header::get_root_page((page_t*)header->frame);
+    std::set<pagenum_t> bitmap_pagenums;
+    for(uint64_t group = 0; group < page_io::header::get_bitmap_count((page_t*)header->frame); ++group)
+        bitmap_pagenums.insert(page_io::header::get_bitmap_page((page_t*)header->frame, group));
+    buffer_manager.unpin_buffer(table_id, 0);
+
+    plan->first_leaf = 0;
+    if(root == 0) return;
+
+    // height of the tree, from the leftmost path
+    int height = 0;
+    for(pagenum_t c = root; ; ++height) {
+        buffer_t* page = buffer_manager.buffer_read_page(table_id, c, PAGE_LATCH_SHARED);
+        bool is_leaf = page_io::is_leaf((page_t*)page->frame);
+        pagenum_t child = is_leaf ? 0 : page_io::internal::get_child((page_t*)page->frame, 0);
+        buffer_manager.unpin_buffer(table_id, c);
+        if(is_leaf) break;
+        c = child;
+    }
+
+    plan->location.push_back(root);
+    plan->parent.push_back(SIZE_MAX);
+    plan->depth.push_back(0);
+    size_t level_begin = 0;
+    for(int level = 0; level < height; ++level) {
+        size_t level_end = plan->location.size();
+        for(size_t i = level_begin; i < level_end; ++i) {
+            pagenum_t node = plan->location[i];
+            buffer_t* page = buffer_manager.buffer_read_page(table_id, node, PAGE_LATCH_SHARED);
+            uint32_t num_keys = page_io::get_key_count((page_t*)page->frame);
+            for(uint32_t j = 0; j <= num_keys; ++j) {
+                plan->location.push_back(page_io::internal::get_child((page_t*)page->frame, j));
+                plan->parent.push_back(i);
+                plan->depth.push_back(level + 1);
+            }
+            buffer_manager.unpin_buffer(table_id, node);
+        }
+        level_begin = level_end;
+    }
+    plan->first_leaf = level_begin;
+
+    // lowest pages of the file, past the header and bitmap pages
+    for(pagenum_t pagenum = 1; plan->dest.size() < plan->location.size(); ++pagenum)
+        if(bitmap_pagenums.count(pagenum) == 0) plan->dest.push_back(pagenum);
+
+    for(size_t i = 0; i < plan->location.size(); ++i) plan->owner[plan->location[i]] = i;
+}
+
+/* Move node (idx) of the plan to page (to), which is allocated already, and free its old page */
+static void move_node(int64_t table_id, vacuum_plan_t* plan, size_t idx, pagenum_t to) {
+    pagenum_t from = plan->location[idx];
+
+    buffer_t* src = buffer_manager.buffer_read_page(table_id, from);
+    buffer_t* dst = buffer_manager.buffer_read_page(table_id, to);
+    buffer_manager.buffer_write_page(table_id, to);
+
+    // old logs of (to) must not be redone over the copy
+    uint64_t LSN = std::max(page_io::get_page_LSN((page_t*)src->frame), page_io::get_page_LSN((page_t*)dst->frame));
+    memcpy(dst->frame, src->frame, PAGE_SIZE);
+    page_io::set_page_LSN((page_t*)dst->frame, LSN);
+
+    // parent comes from the plan, the tree shape doesn't change while vacuum runs
+    pagenum_t parent = plan->parent[idx] == SIZE_MAX ? 0 : plan->location[plan->parent[idx]];
+
+    buffer_manager.unpin_buffer(table_id, to);
+    buffer_manager.unpin_buffer(table_id, from);
+
+    // moves aren't logged, a crash between steps must leave a tree on disk: the copy and
+    // its allocation land before anything points to it
+    buffer_t* header_page = buffer_manager.buffer_read_page(table_id, 0, PAGE_LATCH_SHARED);
+    pagenum_t to_bitmap = page_io::header::get_bitmap_page((page_t*)header_page->frame, to / PAGES_PER_BITMAP);
+    buffer_manager.unpin_buffer(table_id, 0);
+    buffer_manager.buffer_flush_pages(table_id, {to, to_bitmap});
+
+    // pointers to (from) now point to (to)
+    std::vector<pagenum_t> repointed = {parent};
+    if(parent == 0) {
+        buffer_t* header = buffer_manager.buffer_read_page(table_id, 0);
+        buffer_manager.buffer_write_page(table_id, 0);
+        page_io::header::set_root_page((page_t*)header->frame, to);
+        buffer_manager.unpin_buffer(table_id, 0);
+    } else {
+        buffer_t* parent_page = buffer_manager.buffer_read_page(table_id, parent);
+        buffer_manager.buffer_write_page(table_id, parent);
+        for(uint32_t i = 0; i <= page_io::get_key_count((page_t*)parent_page->frame); ++i) {
+            if(page_io::internal::get_child((page_t*)parent_page->frame, i) == from) {
+                page_io::internal::set_child((page_t*)parent_page->frame, i, to);
+                break;
+            }
+        }
+        buffer_manager.unpin_buffer(table_id, parent);
+    }
+
+    // nodes of a level are in key order, the one before links here
+    if(idx > 0 && plan->depth[idx - 1] == plan->depth[idx]) {
+        pagenum_t left = plan->location[idx - 1];
+        buffer_t* left_page = buffer_manager.buffer_read_page(table_id, left);
+        if(page_io::get_right_link((page_t*)left_page->frame) == from) {
+            buffer_manager.buffer_write_page(table_id, left);
+            page_io::set_right_link((page_t*)left_page->frame, to);
+            repointed.push_back(left);
+        }
+        buffer_manager.unpin_buffer(table_id, left);
+    }
+
+    // and nothing points to (from) on disk before its page is free, at worst a crash leaks it
+    buffer_manager.buffer_flush_pages(table_id, repointed);
+    buffer_manager.buffer_free_page(table_id, from);
+
+    plan->owner.erase(from);
+    plan->owner[to] = idx;
+    plan->location[idx] = to;
+}
+
+/* Check a transaction locks a record of leaf (pagenum), its logs name the page */
+static bool is_page_locked(int64_t table_id, pagenum_t pagenum) {
+    buffer_t* page = buffer_manager.buffer_read_page(table_id, pagenum, PAGE_LATCH_SHARED);
+    uint32_t num_keys = page_io::get_key_count((page_t*)page->frame);
+    bool locked = page_io::is_leaf((page_t*)page->frame) && num_keys > 0
+        && lock_is_range_locked(table_id, page_io::leaf::get_key((page_t*)page->frame, 0),
+                                page_io::leaf::get_key((page_t*)page->frame, num_keys - 1));
+    buffer_manager.unpin_buffer(table_id, pagenum);
+    return locked;
+}
+
+/* Move node (idx) to its destination, moving the node there out of the way first.
+ * Pages with record locks stay where they are. Returns the number of pages moved
+ */
+static int place_node(int64_t table_id, vacuum_plan_t* plan, size_t idx, vacuum_stats_t* stats) {
+    pagenum_t from = plan->location[idx];
+    pagenum_t to = plan->dest[idx];
+    if(from == to) return 0;
+
+    if(is_page_locked(table_id, from)) {
+        if(idx >= plan->first_leaf) stats->leaves_skipped++;
+        return 0;
+    }
+
+    int moved = 0;
+    auto it = plan->owner.find(to);
+    if(it != plan->owner.end()) {
+        // a node left in place earlier, or a locked one, keeps the page
+        size_t other = it->second;
+        if(other < idx || is_page_locked(table_id, to)) return 0;
+
+        pagenum_t spare = buffer_manager.buffer_alloc_page(table_id, plan->dest.back() + 1);
+        if(spare == 0) return 0;
+        move_node(table_id, plan, other, spare);
+        moved++;
+    }
+
+    // (to) is free now, it's taken at its exact place and anything else isn't ours to move
+    pagenum_t claimed = buffer_manager.buffer_alloc_page(table_id, to);
+    if(claimed != to) {
+        if(claimed != 0) buffer_manager.buffer_free_page(table_id, claimed);
+        return moved;
+    }
+
+    move_node(table_id, plan, idx, to);
+    return moved + 1;
+}
+
+int vacuum_table(int64_t table_id, vacuum_stats_t* stats) {
+    table_latch_t* latch = get_table_latch(table_id);
+    if(latch == nullptr) return -1;
+
+    pthread_rwlock_wrlock(&latch->modify_latch);
+
+    pthread_rwlock_rdlock(&latch->access_latch);
+    buffer_t* header = buffer_manager.buffer_read_page(table_id, 0, PAGE_LATCH_SHARED);
+    stats->pages_before = page_io::header::get_page_count((page_t*)header->frame);
+    buffer_manager.unpin_buffer(table_id, 0);
+
+    vacuum_plan_t plan;
+    make_vacuum_plan(table_id, &plan);
+    stats->leaf_count = plan.location.size() - plan.first_leaf;
+    stats->leaf_runs_before = count_leaf_runs(plan);
+    pthread_rwlock_unlock(&latch->access_latch);
+
+    // operations on the table go on between steps
+    for(size_t idx = 0; idx < plan.location.size();) {
+        pthread_rwlock_wrlock(&latch->access_latch);
+        int moved = 0;
+        for(; idx < plan.location.size() && moved < VACUUM_STEP_PAGES; ++idx)
+            moved += place_node(table_id, &plan, idx, stats);
+        pthread_rwlock_unlock(&latch->access_latch);
+        stats->pages_moved += moved;
+    }
+
+    pthread_rwlock_wrlock(&latch->access_latch);
+    // moves aren't logged: moved pages, their parents and the header reach the disk before
+    // the pages they replaced are cut off
+    buffer_manager.buffer_flush_table(table_id);
+    stats->pages_after = buffer_manager.buffer_truncate_table(table_id);
+    pthread_rwlock_unlock(&latch->access_latch);
+
+    stats->leaf_runs_after = count_leaf_runs(plan);
+
+    pthread_rwlock_unlock(&latch->modify_latch);
+
+    // log records before this name pages by their old numbers, redo must start past them
+    log_buf_manager.checkpoint();
+    return 0;
+}
@@ -1,8 +1,11 @@
 #include "file.h"
+#include "db.h"
+#include "test_helpers.h"
 
 #include <gtest/gtest.h>
 
 #include <string>
+#include <vector>
 
 /*******************************************************************************
  * The test structures stated here were written to give you and idea of what a
@@ -52,8 +55,8 @@ TEST(FileInitTest, HandlesInitialization) {
 
 /*
  * Tests page allocation and free
- * 1. Allocate 2 pages and free one of them, traverse the free page list
- *    and check the existence/absence of the freed/allocated page
+ * 1. Allocate 2 pages and free one of them, check the free space bitmap
+ *    for the freed/allocated page
  */
 TEST(PageTest, HandlesPageAllocation) {
     std::string pathname = "page_test.db";
@@ -70,27 +73,25 @@ TEST(PageTest, HandlesPageAllocation) {
     // Free one page
     file_free_page(table_id, freed_page);
 
-    // Traverse the free page list and check the existence of the freed/allocated
-    // pages. You might need to open a few APIs soley for testing.
-    bool is_freed_page_exist = false;
-
-    page_t cur_page;
-    pagenum_t next_free_page;
-    file_read_page(table_id, 0, &cur_page);
-    memcpy(&next_free_page, cur_page.data + sizeof(pagenum_t), sizeof(pagenum_t));
-    while(next_free_page != 0) {
-        if(next_free_page == freed_page) is_freed_page_exist = true;
-     
-        file_read_page(table_id, next_free_page, &cur_page);
-        memcpy(&next_free_page, cur_page.data, sizeof(pagenum_t));
-    }
+    // Check the bits of the freed/allocated pages in the free space bitmap
+    page_t header_page, bitmap_page;
+    file_read_page(table_id, 0, &header_page);
+    file_read_page(table_id, page_io::header::get_bitmap_page(&header_page, 0), &bitmap_page);
+    bool is_freed_page_free = !page_io::bitmap::is_used(&bitmap_page, freed_page);
+    bool is_allocated_page_used = page_io::bitmap::is_used(&bitmap_page, allocated_page);
+
+    // Freed page is handed out again
+    pagenum_t reallocated_page = file_alloc_page(table_id, freed_page);
 
     file_close_table_files();
 
     remove(pathname.c_str());
 
-    EXPECT_TRUE(is_freed_page_exist)
-        << "The freed page does not exist in the free page list";
+    EXPECT_TRUE(is_freed_page_free)
+        << "The freed page is still marked in use";
+    EXPECT_TRUE(is_allocated_page_used)
+        << "The allocated page is marked free";
+    EXPECT_EQ(reallocated_page, freed_page);
 }
 
 /*
@@ -169,3 +170,45 @@ TEST(FileDoublingTest, CheckFileDoubling) {
 
     remove(pathname.c_str());
 }
+
+const int max_buf = 4;
+
+TEST(TableCatalogTest, HandlesMoreTablesThanDescriptors) {
+    const int T = 40;
+    std::remove("catalog_test_catalog");
+    remove_log_files("catalog_test.log");
+    for(int t = 0; t < T; ++t) std::remove(("catalog_table_" + std::to_string(t) + ".db").c_str());
+
+    // more tables than descriptors, the fd cache reopens them on demand
+    file_set_catalog_path("catalog_test_catalog");
+    file_set_max_open_files(8);
+    char log_path[] = "catalog_test.log";
+    char logmsg_path[] = "catalog_test_log.txt";
+    EXPECT_EQ(init_db(max_buf, 0, 0, log_path, logmsg_path), 0);
+    std::vector<int64_t> table_ids;
+    for(int t = 0; t < T; ++t) {
+        int64_t table_id = open_table(("catalog_table_" + std::to_string(t) + ".db").c_str());
+        EXPECT_GT(table_id, 0);
+        table_ids.push_back(table_id);
+    }
+    for(int t = 0; t < T; ++t) {
+        std::string value(100, 'a' + t % 26);
+        EXPECT_EQ(db_insert(table_ids[t], t, value.c_str(), value.length()), 0);
+    }
+    shutdown_db();
+
+    // ids come from the catalog, opened in reverse they are still the same
+    EXPECT_EQ(init_db(max_buf, 0, 0, log_path, logmsg_path), 0);
+    for(int t = T - 1; t >= 0; --t) {
+        EXPECT_EQ(open_table(("catalog_table_" + std::to_string(t) + ".db").c_str()), table_ids[t]);
+        char buf[200];
+        uint16_t sz = 0;
+        EXPECT_EQ(db_find(table_ids[t], t, buf, &sz), 0);
+        EXPECT_EQ(std::string(buf, sz), std::string(100, 'a' + t % 26));
+    }
+    shutdown_db();
+
+    file_set_max_open_files(DEFAULT_MAX_OPEN_FILES);
+    file_set_catalog_path(DEFAULT_CATALOG_PATH);
+    for(int t = 0; t < T; ++t) std::remove(("catalog_table_" + std::to_string(t) + ".db").c_str());
+}
@@ -1,13 +1,18 @@
 #include "db.h"
+#include "test_helpers.h"
 
 #include <gtest/gtest.h>
 
 #include <string>
 #include <random>
 #include <algorithm>
+#include <thread>
+#include <atomic>
 
 extern BufferManager buffer_manager;
 
+const int max_buf = 4;
+
 std::string get_random_string(int length) {
     std::string ret;
 
@@ -85,6 +90,506 @@ TEST(OnDiskBplusTreeTest, ScanTest) {
         << "shutdown_db failed.\n";
 }
 
+TEST(OnDiskBplusTreeTest, BulkLoadTest) {
+    if(!std::remove("DATA9")) std::cout << "ALERT : remove existing file.\n";
+    std::remove("bulk_load_test.log");
+    std::remove("bulk_load_test_log.txt");
+    char log_path[] = "bulk_load_test.log";
+    char logmsg_path[] = "bulk_load_test_log.txt";
+    init_db(64, 0, 0, log_path, logmsg_path);
+    int64_t table_id = open_table("DATA9");
+    EXPECT_GE(table_id, 0)
+        << "open table failed.\n";
+
+    std::vector<std::string> records(100'000);
+    for(int i = 0; i < 100'000; ++i) records[i] = get_random_string(50 + i % 63);
+
+    int i = 0;
+    int flag = db_bulk_load(table_id, [&](int64_t* key, const char** value, uint16_t* size) {
+        if(i == 100'000) return false;
+        *key = 2 * i;
+        *value = records[i].c_str();
+        *size = records[i].size();
+        i++;
+        return true;
+    });
+    EXPECT_EQ(flag, 0)
+        << "bulk load failed.\n";
+
+    char buf[200];
+    uint16_t val_size;
+    for(int j = 0; j < 100'000; ++j) {
+        int64_t key = 2 * j;
+        EXPECT_EQ(db_find(table_id, key, buf, &val_size), 0)
+            << "FAIL : find failed / key has not been found. (" << key << " key).\n";
+        EXPECT_EQ(std::string(buf, val_size), records[j])
+            << "Fetched data is not same as loaded data.\n";
+    }
+
+    // loaded tree takes insertions and deletions
+    for(int j = 0; j < 10'000; ++j) {
+        EXPECT_EQ(db_insert(table_id, 2 * j + 1, records[j].c_str(), records[j].size()), 0)
+            << "insertion failed(" << 2 * j + 1 << " key).\n";
+        EXPECT_EQ(db_delete(table_id, 2 * j), 0)
+            << "deletion failed(" << 2 * j << " key).\n";
+    }
+
+    std::vector<int64_t> keys;
+    std::vector<char*> values;
+    std::vector<uint16_t> val_sizes;
+    EXPECT_EQ(db_scan(table_id, 0, 200'000, &keys, &values, &val_sizes), 0)
+        << "scan failed.\n";
+    EXPECT_EQ(keys.size(), 100'000)
+        << "Fetched key count is not correct.\n";
+    for(char* value : values) delete[] value;
+
+    // only an empty table can be bulk loaded
+    EXPECT_NE(db_bulk_load(table_id, [](int64_t*, const char**, uint16_t*) { return false; }), 0)
+        << "bulk load into a non-empty table.\n";
+
+    EXPECT_EQ(shutdown_db(), 0)
+        << "shutdown_db failed.\n";
+
+    std::remove("DATA9");
+}
+
+// every page reachable from the root is marked used in the bitmap
+void check_tree_pages_used(int64_t table_id) {
+    buffer_t* header = buffer_manager.buffer_read_page(table_id, 0, PAGE_LATCH_SHARED);
+    page_t header_page;
+    memcpy(&header_page, header->frame, PAGE_SIZE);
+    buffer_manager.unpin_buffer(table_id, 0);
+
+    pagenum_t root = page_io::header::get_root_page(&header_page);
+    std::vector<pagenum_t> pages;
+    if(root != 0) pages.push_back(root);
+    for(size_t i = 0; i < pages.size(); ++i) {
+        pagenum_t pagenum = pages[i];
+        EXPECT_LT(pagenum, page_io::header::get_page_count(&header_page))
+            << "tree page " << pagenum << " is past the end of the file.\n";
+
+        pagenum_t bitmap_pagenum = page_io::header::get_bitmap_page(&header_page, pagenum / PAGES_PER_BITMAP);
+        buffer_t* bitmap = buffer_manager.buffer_read_page(table_id, bitmap_pagenum, PAGE_LATCH_SHARED);
+        EXPECT_TRUE(page_io::bitmap::is_used((page_t*)bitmap->frame, pagenum % PAGES_PER_BITMAP))
+            << "tree page " << pagenum << " is free in the bitmap.\n";
+        buffer_manager.unpin_buffer(table_id, bitmap_pagenum);
+
+        buffer_t* page = buffer_manager.buffer_read_page(table_id, pagenum, PAGE_LATCH_SHARED);
+        if(!page_io::is_leaf((page_t*)page->frame)) {
+            for(uint32_t j = 0; j <= page_io::get_key_count((page_t*)page->frame); ++j)
+                pages.push_back(page_io::internal::get_child((page_t*)page->frame, j));
+        }
+        buffer_manager.unpin_buffer(table_id, pagenum);
+    }
+}
+
+// records of the tree in the table file itself, as a crash would leave it
+int count_records_on_disk(int64_t table_id) {
+    page_t header_page;
+    file_read_page(table_id, 0, &header_page);
+    pagenum_t page_cnt = page_io::header::get_page_count(&header_page);
+
+    int records = 0;
+    std::vector<pagenum_t> pages;
+    if(page_io::header::get_root_page(&header_page) != 0) pages.push_back(page_io::header::get_root_page(&header_page));
+    for(size_t i = 0; i < pages.size(); ++i) {
+        EXPECT_LT(pages[i], page_cnt)
+            << "tree page " << pages[i] << " is past the end of the file.\n";
+        if(pages[i] >= page_cnt) continue;
+
+        page_t page;
+        file_read_page(table_id, pages[i], &page);
+        if(page_io::is_leaf(&page)) {
+            records += page_io::get_key_count(&page);
+            continue;
+        }
+        for(uint32_t j = 0; j <= page_io::get_key_count(&page); ++j)
+            pages.push_back(page_io::internal::get_child(&page, j));
+    }
+    return records;
+}
+
+TEST(OnDiskBplusTreeTest, VacuumTest) {
+    if(!std::remove("DATA8")) std::cout << "ALERT : remove existing file.\n";
+    std::remove("vacuum_test.log");
+    std::remove("vacuum_test_log.txt");
+    char log_path[] = "vacuum_test.log";
+    char logmsg_path[] = "vacuum_test_log.txt";
+    init_db(64, 0, 0, log_path, logmsg_path);
+    int64_t table_id = open_table("DATA8");
+    EXPECT_GE(table_id, 0)
+        << "open table failed.\n";
+
+    std::string value = get_random_string(100);
+    for(int i = 0; i < 50'000; ++i)
+        EXPECT_EQ(db_insert(table_id, i, value.c_str(), value.size()), 0)
+            << "insertion failed(" << i << " key).\n";
+    // keep every 20th record, the rest of the file is free pages
+    for(int i = 0; i < 50'000; ++i) {
+        if(i % 20 != 0) {
+            EXPECT_EQ(db_delete(table_id, i), 0)
+                << "deletion failed(" << i << " key).\n";
+        }
+    }
+
+    check_tree_pages_used(table_id);
+
+    vacuum_stats_t stats;
+    EXPECT_EQ(db_vacuum(table_id, &stats), 0)
+        << "vacuum failed.\n";
+    EXPECT_LT(stats.pages_after, stats.pages_before)
+        << "vacuum reclaimed nothing.\n";
+    // deletions merged the leaves, only the last one may hold less than a merge leaves behind
+    EXPECT_LE(stats.leaf_count, 2'500 * (value.size() + SLOT_SIZE) / (PAGE_SIZE - LEAF_PAGE_SLOT_OFFSET - THRESHOLD) + 1)
+        << "leaves were not merged.\n";
+    EXPECT_EQ(stats.leaf_runs_after, 1)
+        << "leaves are not contiguous after vacuum.\n";
+    EXPECT_GE(stats.sequential_ratio_after(), stats.sequential_ratio_before());
+    check_tree_pages_used(table_id);
+    EXPECT_EQ(count_records_on_disk(table_id), 2'500)
+        << "table file doesn't hold the vacuumed tree.\n";
+
+    char buf[200];
+    uint16_t val_size;
+    for(int i = 0; i < 50'000; i += 20) {
+        EXPECT_EQ(db_find(table_id, i, buf, &val_size), 0)
+            << "FAIL : find failed / key has not been found. (" << i << " key).\n";
+        EXPECT_EQ(std::string(buf, val_size), value)
+            << "Fetched data is not same as inserted data.\n";
+    }
+
+    // vacuumed tree takes insertions
+    for(int i = 1; i < 50'000; i += 20)
+        EXPECT_EQ(db_insert(table_id, i, value.c_str(), value.size()), 0)
+            << "insertion failed(" << i << " key).\n";
+
+    std::vector<int64_t> keys;
+    std::vector<char*> values;
+    std::vector<uint16_t> val_sizes;
+    EXPECT_EQ(db_scan(table_id, 0, 50'000, &keys, &values, &val_sizes), 0)
+        << "scan failed.\n";
+    EXPECT_EQ(keys.size(), 5'000)
+        << "Fetched key count is not correct.\n";
+    EXPECT_TRUE(std::is_sorted(keys.begin(), keys.end()))
+        << "scan is out of order.\n";
+    for(char* value : values) delete[] value;
+    check_tree_pages_used(table_id);
+
+    EXPECT_EQ(shutdown_db(), 0)
+        << "shutdown_db failed.\n";
+
+    std::remove("DATA8");
+}
+
+TEST(OnDiskBplusTreeTest, LeafCompressionTest) {
+    const int N = 3000;
+    std::remove("compress_table.db");
+    std::remove((std::string("compress_table.db") + COMPRESSED_FILE_SUFFIX).c_str());
+    remove_log_files("compress_test.log");
+
+    char log_path[] = "compress_test.log";
+    char logmsg_path[] = "compress_test_log.txt";
+    EXPECT_EQ(init_db(max_buf, 0, 0, log_path, logmsg_path), 0);
+    int64_t table_id = open_table("compress_table.db");
+    EXPECT_GT(table_id, 0);
+    EXPECT_EQ(db_set_compression(table_id, COMPRESSION_LZ), 0);
+    for(int i = 0; i < N; ++i) {
+        std::string value = "value of key " + std::to_string(i % 7) + std::string(80, '-');
+        EXPECT_EQ(db_insert(table_id, i, value.c_str(), value.length()), 0);
+    }
+    // the tiny pool writes leaves back while they fill
+    compression_stats_t stats = db_get_compression_stats(table_id);
+    stats.print(std::cout);
+    EXPECT_GT(stats.ratio(), 1.0);
+    shutdown_db();
+
+    // leaves come back from extents on every miss of the tiny pool
+    EXPECT_EQ(init_db(max_buf, 0, 0, log_path, logmsg_path), 0);
+    table_id = open_table("compress_table.db");
+    for(int i = 0; i < N; ++i) {
+        char buf[200];
+        uint16_t sz = 0;
+        EXPECT_EQ(db_find(table_id, i, buf, &sz), 0);
+        EXPECT_EQ(std::string(buf, sz), "value of key " + std::to_string(i % 7) + std::string(80, '-'));
+    }
+    stats = db_get_compression_stats(table_id);
+    stats.print(std::cout);
+    EXPECT_GT(stats.stored_pages, 0);
+    EXPECT_GT(stats.pages_read, 0);
+    shutdown_db();
+
+    std::remove("compress_table.db");
+    std::remove((std::string("compress_table.db") + COMPRESSED_FILE_SUFFIX).c_str());
+}
+
+TEST(OnDiskBplusTreeTest, KeySearchKernelsTest) {
+    page_t internal_page, leaf_page;
+    page_io::internal::set_new_internal_page(&internal_page);
+    page_io::leaf::set_new_leaf_page(&leaf_page);
+
+    // keys with gaps, probes fall on, between and around them
+    std::mt19937 engine(2022);
+    std::vector<int64_t> keys;
+    int64_t key = -1000;
+    for(int i = 0; i < INTERNAL_ORDER - 1; ++i) keys.push_back(key += 1 + engine() % 5);
+    for(int i = 0; i < (int)keys.size(); ++i) {
+        slot_t slot;
+        slot_io::set_new_slot(&slot, keys[i], 0, 0);
+        page_io::internal::set_key(&internal_page, i, keys[i]);
+        page_io::leaf::set_slot(&leaf_page, i, &slot);
+    }
+
+    int best = key_search::set_kernel(KEY_SEARCH_AUTO);
+    for(int kernel = KEY_SEARCH_SCALAR; kernel <= best; ++kernel) {
+        EXPECT_EQ(key_search::set_kernel(kernel), kernel);
+        // window sizes and the tails of every kernel
+        for(int n : {0, 1, 3, 7, 8, 9, 31, 248}) {
+            page_io::set_key_count(&internal_page, n);
+            page_io::set_key_count(&leaf_page, n);
+            for(int64_t probe = -1005; probe <= key + 5; ++probe) {
+                slotnum_t expected = std::upper_bound(keys.begin(), keys.begin() + n, probe) - keys.begin();
+                EXPECT_EQ(key_search::internal_child_idx(&internal_page, probe), expected);
+                EXPECT_EQ(key_search::leaf_find_slot(&leaf_page, probe), (expected > 0 && keys[expected - 1] == probe) ? expected - 1 : -1);
+            }
+        }
+    }
+    key_search::set_kernel(KEY_SEARCH_AUTO);
+}
+
+TEST(OnDiskBplusTreeTest, SlottedLeafInsertDeleteTest) {
+    const int N = 5000;
+    std::remove("slotted_table.db");
+    remove_log_files("slotted_test.log");
+
+    char log_path[] = "slotted_test.log";
+    char logmsg_path[] = "slotted_test_log.txt";
+    EXPECT_EQ(init_db(max_buf, 0, 0, log_path, logmsg_path), 0);
+    int64_t table_id = open_table("slotted_table.db");
+    EXPECT_GT(table_id, 0);
+
+    // random order and sizes, deletes leave holes that later inserts compact away
+    std::mt19937 engine(2022);
+    std::vector<int> keys(N);
+    for(int i = 0; i < N; ++i) keys[i] = i;
+    std::shuffle(keys.begin(), keys.end(), engine);
+    auto value_of = [](int key) { return std::string(50 + key % 63, 'a' + key % 26); };
+    for(int key : keys) EXPECT_EQ(db_insert(table_id, key, value_of(key).c_str(), value_of(key).length()), 0);
+    for(int i = 0; i < N; i += 2) EXPECT_EQ(db_delete(table_id, keys[i]), 0);
+    for(int i = 0; i < N; i += 2) EXPECT_EQ(db_insert(table_id, keys[i] + N, value_of(keys[i] + N).c_str(), value_of(keys[i] + N).length()), 0);
+
+    for(int i = 0; i < N; ++i) {
+        int key = (i % 2 == 0) ? keys[i] + N : keys[i];
+        char buf[200];
+        uint16_t sz = 0;
+        EXPECT_EQ(db_find(table_id, key, buf, &sz), 0);
+        EXPECT_EQ(std::string(buf, sz), value_of(key));
+        if(i % 2 == 0) {
+            EXPECT_NE(db_find(table_id, keys[i], buf, &sz), 0);
+        }
+    }
+
+    // leaf chain is still in key order
+    std::vector<int64_t> scanned;
+    std::vector<char*> values;
+    std::vector<uint16_t> val_sizes;
+    EXPECT_EQ(db_scan(table_id, 0, 2 * N, &scanned, &values, &val_sizes), 0);
+    EXPECT_EQ(scanned.size(), (size_t)N);
+    EXPECT_TRUE(std::is_sorted(scanned.begin(), scanned.end()));
+    for(char* value : values) delete[] value;
+    shutdown_db();
+    std::remove("slotted_table.db");
+}
+
+TEST(OnDiskBplusTreeTest, ConcurrentInsertDeleteTest) {
+    const int N = 20000;
+    const int T = 4;
+    std::remove("concurrent_table.db");
+    remove_log_files("concurrent_test.log");
+
+    char log_path[] = "concurrent_test.log";
+    char logmsg_path[] = "concurrent_test_log.txt";
+    EXPECT_EQ(init_db(64, 0, 0, log_path, logmsg_path), 0);
+    int64_t table_id = open_table("concurrent_table.db");
+    EXPECT_GT(table_id, 0);
+
+    // threads take interleaved keys, so they share leaves and split them under each other
+    auto value_of = [](int key) { return std::string(50 + key % 63, 'a' + key % 26); };
+    std::vector<std::thread> threads;
+    for(int t = 0; t < T; ++t) {
+        threads.emplace_back([&, t]() {
+            std::mt19937 engine(t);
+            std::vector<int> keys;
+            for(int key = t; key < N; key += T) keys.push_back(key);
+            std::shuffle(keys.begin(), keys.end(), engine);
+            for(int key : keys) db_insert(table_id, key, value_of(key).c_str(), value_of(key).length());
+            for(int key : keys) if(key % 3 == 0) db_delete(table_id, key);
+        });
+    }
+    for(auto& thread : threads) thread.join();
+
+    for(int key = 0; key < N; ++key) {
+        char buf[200];
+        uint16_t sz = 0;
+        if(key % 3 == 0) {
+            EXPECT_NE(db_find(table_id, key, buf, &sz), 0);
+            continue;
+        }
+        EXPECT_EQ(db_find(table_id, key, buf, &sz), 0);
+        EXPECT_EQ(std::string(buf, sz), value_of(key));
+    }
+
+    std::vector<int64_t> scanned;
+    std::vector<char*> values;
+    std::vector<uint16_t> val_sizes;
+    EXPECT_EQ(db_scan(table_id, 0, N, &scanned, &values, &val_sizes), 0);
+    EXPECT_EQ(scanned.size(), (size_t)(N - (N + 2) / 3));
+    EXPECT_TRUE(std::is_sorted(scanned.begin(), scanned.end()));
+    for(char* value : values) delete[] value;
+    shutdown_db();
+    std::remove("concurrent_table.db");
+}
+
+// every level, followed by right links, is in key order and ends at its high keys
+void check_blink_levels(int64_t table_id) {
+    buffer_t* header = buffer_manager.buffer_read_page(table_id, 0, PAGE_LATCH_SHARED);
+    pagenum_t first = page_io::header::get_root_page((page_t*)header->frame);
+    buffer_manager.unpin_buffer(table_id, 0);
+
+    while(first != 0) {
+        pagenum_t next_level = 0;
+        bool has_prev = false;
+        int64_t prev_high_key = 0;
+        for(pagenum_t c = first; c != 0;) {
+            buffer_t* page = buffer_manager.buffer_read_page(table_id, c, PAGE_LATCH_SHARED);
+            page_t* frame = (page_t*)page->frame;
+            bool is_leaf = page_io::is_leaf(frame);
+            uint32_t num_keys = page_io::get_key_count(frame);
+            if(c == first && !is_leaf) next_level = page_io::internal::get_child(frame, 0);
+            for(uint32_t i = 0; i < num_keys; ++i) {
+                int64_t key = is_leaf ? page_io::leaf::get_key(frame, i) : page_io::internal::get_key(frame, i);
+                if(has_prev) {
+                    EXPECT_GE(key, prev_high_key);
+                }
+                if(page_io::get_right_link(frame) != 0) {
+                    EXPECT_LT(key, page_io::get_high_key(frame));
+                }
+            }
+            has_prev = true;
+            prev_high_key = page_io::get_high_key(frame);
+            pagenum_t right = page_io::get_right_link(frame);
+            buffer_manager.unpin_buffer(table_id, c);
+            c = right;
+        }
+        first = next_level;
+    }
+}
+
+TEST(OnDiskBplusTreeTest, BLinkConcurrentSplitsTest) {
+    const int N = 40000;
+    const int T = 3;
+    std::remove("blink_table.db");
+    remove_log_files("blink_test.log");
+
+    char log_path[] = "blink_test.log";
+    char logmsg_path[] = "blink_test_log.txt";
+    EXPECT_EQ(init_db(64, 0, 0, log_path, logmsg_path), 0);
+    int64_t table_id = open_table("blink_table.db");
+    EXPECT_GT(table_id, 0);
+
+    auto value_of = [](int key) { return std::string(50 + key % 63, 'a' + key % 26); };
+    for(int key = 0; key < N; key += 2) EXPECT_EQ(db_insert(table_id, key, value_of(key).c_str(), value_of(key).length()), 0);
+    check_blink_levels(table_id);
+
+    // odd keys split leaves under a reader of the even ones, it must never miss
+    std::atomic<bool> done(false);
+    std::atomic<int> misses(0);
+    std::thread reader([&]() {
+        char buf[200];
+        uint16_t sz;
+        while(!done) {
+            for(int key = 0; key < N; key += 2)
+                if(db_find(table_id, key, buf, &sz) != 0 || std::string(buf, sz) != value_of(key)) misses++;
+        }
+    });
+    std::vector<std::thread> writers;
+    for(int t = 0; t < T; ++t) {
+        writers.emplace_back([&, t]() {
+            for(int key = 2 * t + 1; key < N; key += 2 * T) db_insert(table_id, key, value_of(key).c_str(), value_of(key).length());
+        });
+    }
+    for(auto& writer : writers) writer.join();
+    done = true;
+    reader.join();
+    EXPECT_EQ(misses.load(), 0);
+    check_blink_levels(table_id);
+
+    // merges and redistributions keep the links too, and the reader of the kept keys still never misses
+    done = false;
+    std::thread kept_reader([&]() {
+        char buf[200];
+        uint16_t sz;
+        while(!done) {
+            for(int key = 0; key < N; key += 4)
+                if(db_find(table_id, key, buf, &sz) != 0 || std::string(buf, sz) != value_of(key)) misses++;
+        }
+    });
+    for(int key = 0; key < N; ++key) {
+        if(key % 4 != 0) {
+            EXPECT_EQ(db_delete(table_id, key), 0);
+        }
+    }
+    done = true;
+    kept_reader.join();
+    EXPECT_EQ(misses.load(), 0);
+    check_blink_levels(table_id);
+    for(int key = 0; key < N; ++key) {
+        char buf[200];
+        uint16_t sz;
+        EXPECT_EQ(db_find(table_id, key, buf, &sz), key % 4 == 0 ? 0 : -1);
+    }
+    shutdown_db();
+    std::remove("blink_table.db");
+}
+
+TEST(OnDiskBplusTreeTest, SplitsDirtyOnlyChangedPagesTest) {
+    const int N = 12000;
+    std::remove("path_table.db");
+    remove_log_files("path_test.log");
+
+    char log_path[] = "path_test.log";
+    char logmsg_path[] = "path_test_log.txt";
+    EXPECT_EQ(init_db(2000, 0, 0, log_path, logmsg_path), 0);
+    int64_t table_id = open_table("path_table.db");
+    EXPECT_GT(table_id, 0);
+
+    // no page keeps a parent, an internal split leaves the children it moves clean
+    auto value_of = [](int key) { return std::string(50 + key % 63, 'a' + key % 26); };
+    size_t max_dirty = 0;
+    for(int key = 0; key < N; ++key) {
+        buffer_manager.write_back_before(UINT64_MAX);
+        EXPECT_EQ(db_insert(table_id, key, value_of(key).c_str(), value_of(key).length()), 0);
+        std::vector<dirty_page_t> dirty;
+        buffer_manager.get_dirty_pages(dirty);
+        max_dirty = std::max(max_dirty, dirty.size());
+    }
+    EXPECT_LE(max_dirty, (size_t)10);
+
+    // internal pages split: the root is two levels above the leaves
+    buffer_t* header = buffer_manager.buffer_read_page(table_id, 0, PAGE_LATCH_SHARED);
+    pagenum_t root = page_io::header::get_root_page((page_t*)header->frame);
+    buffer_manager.unpin_buffer(table_id, 0);
+    buffer_t* root_page = buffer_manager.buffer_read_page(table_id, root, PAGE_LATCH_SHARED);
+    pagenum_t child = page_io::internal::get_child((page_t*)root_page->frame, 0);
+    buffer_manager.unpin_buffer(table_id, root);
+    buffer_t* child_page = buffer_manager.buffer_read_page(table_id, child, PAGE_LATCH_SHARED);
+    EXPECT_FALSE(page_io::is_leaf((page_t*)child_page->frame));
+    buffer_manager.unpin_buffer(table_id, child);
+
+    check_blink_levels(table_id);
+    shutdown_db();
+    std::remove("path_table.db");
+}
+
 TEST(OnDiskBplusTreeTest, InsertionClearInsertTest) {
     if(!std::remove("clear_test.db")) std::cout << "ALERT : remove existing file.\n";
     int64_t table_id = open_table("clear_test.db");
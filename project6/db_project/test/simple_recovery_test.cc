@@ -2,10 +2,13 @@
 
 #include <string>
 #include <random>
+#include <fstream>
+#include <filesystem>
 
 #include "db.h"
 #include "log.h"
 #include "trx.h"
+#include "test_helpers.h"
 
 const int max_buf = 4;
 
@@ -26,10 +29,12 @@ std::string get_random_string(int length) {
 
 TEST(SimpleRecoveryTest, MakeTable) {
     std::remove("DATA1");
-    std::remove("data1.log");
+    remove_log_files("data1.log");
     std::remove("data1_log.txt");
 
-    EXPECT_EQ(init_db(max_buf, 0, 0, "data1.log", "data1_log.txt"), 0);
+    char log_path[] = "data1.log";
+    char logmsg_path[] = "data1_log.txt";
+    EXPECT_EQ(init_db(max_buf, 0, 0, log_path, logmsg_path), 0);
     int table_id = open_table("DATA1");
     EXPECT_GT(table_id, 0);
 
@@ -47,7 +52,9 @@ TEST(SimpleRecoveryTest, MakeTable) {
 }
 
 TEST(SimpleRecoveryTest, SimpleCrash) {
-    EXPECT_EQ(init_db(max_buf, 0, 0, "data1.log", "data1_log.txt"), 0);
+    char log_path[] = "data1.log";
+    char logmsg_path[] = "data1_log.txt";
+    EXPECT_EQ(init_db(max_buf, 0, 0, log_path, logmsg_path), 0);
     int table_id = open_table("DATA1");
     EXPECT_GT(table_id, 0);
 
@@ -74,7 +81,124 @@ TEST(SimpleRecoveryTest, SimpleCrash) {
 }
 
 TEST(SimpleRecoveryTest, RecoveryTest) {
-    EXPECT_EQ(init_db(max_buf, 0, 0, "data1.log", "data1_recovery_log.txt"), 0);
+    char log_path[] = "data1.log";
+    char recovery_logmsg_path[] = "data1_recovery_log.txt";
+    EXPECT_EQ(init_db(max_buf, 0, 0, log_path, recovery_logmsg_path), 0);
     int table_id = open_table("DATA1");
     shutdown_db();
-}
\ No newline at end of file
+}
+TEST(SimpleRecoveryTest, CheckpointCrash) {
+    std::remove("DATA2");
+    remove_log_files("data2.log");
+    std::remove("data2_log.txt");
+    std::remove("data2_recovery_log.txt");
+
+    char log_path[] = "data2.log";
+    char logmsg_path[] = "data2_log.txt";
+    EXPECT_EQ(init_db(max_buf, 0, 0, log_path, logmsg_path), 0);
+    int table_id = open_table("DATA2");
+    EXPECT_GT(table_id, 0);
+
+    const int N = 10;
+    std::string original(100, 'a');
+    for(int i = 1; i <= N; ++i)
+        EXPECT_EQ(db_insert(table_id, i, original.c_str(), original.length()), 0);
+    shutdown_db();
+
+    EXPECT_EQ(init_db(max_buf, 0, 0, log_path, logmsg_path), 0);
+    table_id = open_table("DATA2");
+
+    std::string committed(100, 'b');
+    int winner = trx_begin();
+    for(int i = 1; i <= N / 2; ++i) {
+        uint16_t sz = 0;
+        EXPECT_EQ(db_update(table_id, i, (char*)committed.c_str(), committed.length(), &sz, winner), 0);
+    }
+    trx_commit(winner);
+    EXPECT_EQ(db_checkpoint(), 0);
+
+    // loser begins before the last checkpoint, only its transaction table tells about it
+    std::string uncommitted(100, 'c');
+    int loser = trx_begin();
+    for(int i = N / 2 + 1; i <= N; ++i) {
+        uint16_t sz = 0;
+        EXPECT_EQ(db_update(table_id, i, (char*)uncommitted.c_str(), uncommitted.length(), &sz, loser), 0);
+    }
+    EXPECT_EQ(db_checkpoint(), 0);
+
+    std::cout << "Crash has occured." << std::endl;
+}
+
+TEST(SimpleRecoveryTest, CheckpointRecoveryTest) {
+    char log_path[] = "data2.log";
+    char recovery_logmsg_path[] = "data2_recovery_log.txt";
+    EXPECT_EQ(init_db(max_buf, 0, 0, log_path, recovery_logmsg_path), 0);
+    int table_id = open_table("DATA2");
+
+    const int N = 10;
+    for(int i = 1; i <= N; ++i) {
+        char buf[200];
+        uint16_t sz = 0;
+        EXPECT_EQ(db_find(table_id, i, buf, &sz), 0);
+        EXPECT_EQ(std::string(buf, sz), std::string(100, i <= N / 2 ? 'b' : 'a'))
+            << "key " << i << " is not recovered.\n";
+    }
+    shutdown_db();
+
+    std::ifstream recovery_log("data2_recovery_log.txt");
+    std::string messages((std::istreambuf_iterator<char>(recovery_log)), std::istreambuf_iterator<char>());
+    EXPECT_NE(messages.find("[ANALYSIS] Start from checkpoint"), std::string::npos)
+        << "analysis did not start from the checkpoint.\n";
+}
+
+TEST(SimpleRecoveryTest, LogSegmentRecycle) {
+    std::remove("DATA3");
+    remove_log_files("data3.log");
+    std::remove("data3_log.txt");
+    std::remove("data3_recovery_log.txt");
+
+    // smallest segments, a few thousand updates fill several of them
+    log_buf_manager.set_segment_size(LOG_SEGMENT_FILL_CHUNK);
+    char log_path[] = "data3.log";
+    char logmsg_path[] = "data3_log.txt";
+    char recovery_logmsg_path[] = "data3_recovery_log.txt";
+    EXPECT_EQ(init_db(max_buf, 0, 0, log_path, logmsg_path), 0);
+    int table_id = open_table("DATA3");
+    EXPECT_GT(table_id, 0);
+
+    const int N = 10;
+    const int rounds = 1000;
+    for(int i = 1; i <= N; ++i) {
+        std::string value(100, 'a');
+        EXPECT_EQ(db_insert(table_id, i, value.c_str(), value.length()), 0);
+    }
+    for(int round = 0; round < rounds; ++round) {
+        std::string value(100, 'a' + round % 26);
+        int trx_id = trx_begin();
+        for(int i = 1; i <= N; ++i) {
+            uint16_t sz = 0;
+            EXPECT_EQ(db_update(table_id, i, (char*)value.c_str(), value.length(), &sz, trx_id), 0);
+        }
+        trx_commit(trx_id);
+    }
+    EXPECT_EQ(db_checkpoint(), 0);
+
+    // segments before the checkpoint are renamed ahead of the log or removed
+    EXPECT_FALSE(std::filesystem::exists("data3.log.000000"));
+    EXPECT_LE(remove_log_files("data3.log", true), 1 + LOG_SEGMENT_SPARES);
+    shutdown_db();
+    log_buf_manager.set_segment_size(LOG_SEGMENT_SIZE);
+
+    // restart finds the end of log in a reused segment
+    EXPECT_EQ(init_db(max_buf, 0, 0, log_path, recovery_logmsg_path), 0);
+    EXPECT_GT(log_buf_manager.next_LSN, (uint64_t)rounds * N * DEFAULT_UPDATE_LOG_SIZE);
+    table_id = open_table("DATA3");
+    std::string last(100, 'a' + (rounds - 1) % 26);
+    for(int i = 1; i <= N; ++i) {
+        char buf[200];
+        uint16_t sz = 0;
+        EXPECT_EQ(db_find(table_id, i, buf, &sz), 0);
+        EXPECT_EQ(std::string(buf, sz), last);
+    }
+    shutdown_db();
+}
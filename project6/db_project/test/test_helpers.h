@@ -0,0 +1,23 @@
+#ifndef TEST_HELPERS_H
+#define TEST_HELPERS_H
+
+#include <filesystem>
+#include <string>
+
+#include "log.h"
+
+// log segments and master record of 'log_path', returns how many segments there were
+inline int remove_log_files(const std::string& log_path, bool count_only = false) {
+    int count = 0;
+    if(!count_only) std::remove((log_path + CHECKPOINT_MASTER_SUFFIX).c_str());
+    for(const auto& entry : std::filesystem::directory_iterator(".")) {
+        std::string name = entry.path().filename().string();
+        if(name.compare(0, log_path.size() + 1, log_path + ".") != 0) continue;
+        if(name.find_first_not_of("0123456789", log_path.size() + 1) != std::string::npos) continue;
+        count++;
+        if(!count_only) std::remove(name.c_str());
+    }
+    return count;
+}
+
+#endif
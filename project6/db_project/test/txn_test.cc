@@ -8,6 +8,7 @@
 #include <string>
 #include <random>
 #include <algorithm>
+#include <chrono>
 
 extern BufferManager buffer_manager;
 
@@ -53,7 +54,9 @@ TEST(SingleThreadTxnTest, SLockOnlyTest) {
     if(!std::remove(pathname))
         std::cout << "Remove existing file " << pathname << std::endl;
 
-    init_db(64, 0, 0, "log", "logmsg.txt");
+    char log_path[] = "log";
+    char logmsg_path[] = "logmsg.txt";
+    init_db(64, 0, 0, log_path, logmsg_path);
     int64_t table_id = open_table(pathname);
 
     std::vector<std::string> values;
@@ -103,7 +106,9 @@ TEST(SingleThreadTxnTest, XLockOnlyTest) {
     if(!std::remove(pathname))
         std::cout << "Remove existing file " << pathname << std::endl;
 
-    init_db(64, 0, 0, "log2", "logmsg.txt");
+    char log_path[] = "log2";
+    char logmsg_path[] = "logmsg.txt";
+    init_db(64, 0, 0, log_path, logmsg_path);
     int64_t table_id = open_table(pathname);
 
     std::vector<std::string> values;
@@ -167,7 +172,9 @@ TEST(SingleThreadTxnTest, SXLockTest) {
     if(!std::remove(pathname))
         std::cout << "Remove existing file " << pathname << std::endl;
 
-    init_db(64, 0, 0, "log3", "logmsg.txt");
+    char log_path[] = "log3";
+    char logmsg_path[] = "logmsg.txt";
+    init_db(64, 0, 0, log_path, logmsg_path);
     int64_t table_id = open_table(pathname);
 
     std::vector<std::string> values;
@@ -313,7 +320,9 @@ TEST(MultiThreadTxnTest, SLockOnlyTest) {
         std::cout << "File " << path_multi_thread_rd << " has been removed." << std::endl;
     int64_t table_id = open_table(path_multi_thread_rd);
 
-    init_db(64, 0, 0, "log4", "logmsg.txt");
+    char log_path[] = "log4";
+    char logmsg_path[] = "logmsg.txt";
+    init_db(64, 0, 0, log_path, logmsg_path);
     make_random_tree(table_id, 1000, multi_rd_values, multi_rd_keys);
     std::cout << "Random tree has been created." << std::endl;
     shutdown_db();
@@ -321,7 +330,7 @@ TEST(MultiThreadTxnTest, SLockOnlyTest) {
     int64_t* tid = new int64_t;
     *tid = open_table(path_multi_thread_rd);
 
-    init_db(64, 0, 0, "log4", "logmsg.txt");
+    init_db(64, 0, 0, log_path, logmsg_path);
     for(int i = 0; i < THREAD_N; ++i) {
         pthread_create(&threads[i], 0, thread_rnd_read, tid);
     }
@@ -335,6 +344,138 @@ TEST(MultiThreadTxnTest, SLockOnlyTest) {
     shutdown_db();
 }
 
+#define HIT_THREAD_MAX 32
+#define HIT_N 20000
+
+int64_t hit_table_id;
+
+void* thread_hit_read(void* arg) {
+    std::mt19937 gen(*((int*)arg));
+    std::uniform_int_distribution<int> dis(0, multi_rd_keys.size() - 1);
+
+    for(int i = 0; i < HIT_N; ++i) {
+        char buf[150]; uint16_t val_size;
+        int idx = dis(gen);
+        int flag = db_find(hit_table_id, multi_rd_keys[idx], buf, &val_size);
+
+        EXPECT_EQ(flag, 0)
+            << "db_find failed | key : " << multi_rd_keys[idx] << '\n';
+    }
+
+    return NULL;
+}
+
+void run_hit_scaling(const char* path_hit, int buf_policy) {
+    if(!std::remove(path_hit))
+        std::cout << "File " << path_hit << " has been removed." << std::endl;
+
+    /* pool is large enough to keep the whole tree, so every read is a hit */
+    char log_path[] = "log5";
+    char logmsg_path[] = "logmsg.txt";
+    init_db(1024, 0, 0, log_path, logmsg_path, buf_policy);
+    hit_table_id = open_table(path_hit);
+    make_random_tree(hit_table_id, 1000, multi_rd_values, multi_rd_keys);
+    std::cout << "Random tree has been created." << std::endl;
+    buffer_manager.reset_stats();
+
+    pthread_t hit_threads[HIT_THREAD_MAX];
+    int seeds[HIT_THREAD_MAX];
+
+    for(int thread_n = 1; thread_n <= HIT_THREAD_MAX; thread_n *= 2) {
+        auto start = std::chrono::steady_clock::now();
+
+        for(int i = 0; i < thread_n; ++i) {
+            seeds[i] = i;
+            pthread_create(&hit_threads[i], 0, thread_hit_read, &seeds[i]);
+        }
+        for(int i = 0; i < thread_n; ++i) {
+            pthread_join(hit_threads[i], NULL);
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        double sec = std::chrono::duration<double>(end - start).count();
+        std::cout << "threads " << thread_n << " : "
+            << (uint64_t)(thread_n * HIT_N / sec) << " finds/sec" << std::endl;
+    }
+
+    buffer_stats_t stats = get_buffer_stats();
+    stats.print(std::cout);
+    buffer_table_stats_t total = stats.total();
+    for(int i = 0; i < NUM_PAGE_TYPES; ++i) EXPECT_EQ(total.misses[i], 0);
+    EXPECT_GT(total.hits[PAGE_TYPE_LEAF], 0);
+
+    shutdown_db();
+}
+
+TEST(MultiThreadTxnTest, BufferHitScalingTest) {
+    run_hit_scaling("DATA5", BUFFER_POLICY_LRU);
+}
+
+TEST(MultiThreadTxnTest, ClockHitScalingTest) {
+    run_hit_scaling("DATA6", BUFFER_POLICY_CLOCK);
+}
+
+#define MOVE_KEY_N 2000
+
+int64_t move_table_id;
+
+void* thread_fill_leaves(void* arg) {
+    std::string value(80, 'a');
+    // keys between the updated ones shift their slots and split their leaves
+    for(int k = 1; k < 10; ++k)
+        for(int i = 0; i < MOVE_KEY_N; ++i)
+            EXPECT_EQ(db_insert(move_table_id, i * 10 + k, value.c_str(), value.size()), 0);
+    return NULL;
+}
+
+void* thread_update_moving(void* arg) {
+    std::string committed(80, 'b'), aborted(80, 'c');
+    for(int i = 0; i < MOVE_KEY_N; ++i) {
+        uint16_t old_val_size;
+        int trx_id = trx_begin();
+        EXPECT_EQ(db_update(move_table_id, i * 10, (char*)committed.c_str(), committed.size(), &old_val_size, trx_id), 0);
+        trx_commit(trx_id);
+
+        trx_id = trx_begin();
+        EXPECT_EQ(db_update(move_table_id, i * 10, (char*)aborted.c_str(), aborted.size(), &old_val_size, trx_id), 0);
+        char buf[150]; uint16_t val_size;
+        EXPECT_EQ(db_find(move_table_id, i * 10, buf, &val_size, trx_id), 0);
+        EXPECT_EQ(std::string(buf, val_size), aborted);
+        trx_abort(trx_id);
+    }
+    return NULL;
+}
+
+TEST(MultiThreadTxnTest, UpdateMovingRecordsTest) {
+    const char* path_move = "DATA7";
+    if(!std::remove(path_move))
+        std::cout << "File " << path_move << " has been removed." << std::endl;
+
+    char log_path[] = "log7";
+    char logmsg_path[] = "logmsg.txt";
+    init_db(64, 0, 0, log_path, logmsg_path);
+    move_table_id = open_table(path_move);
+    std::string value(80, 'a');
+    for(int i = 0; i < MOVE_KEY_N; ++i) db_insert(move_table_id, i * 10, value.c_str(), value.size());
+
+    pthread_t fill_thread, update_thread;
+    pthread_create(&fill_thread, 0, thread_fill_leaves, NULL);
+    pthread_create(&update_thread, 0, thread_update_moving, NULL);
+    pthread_join(fill_thread, NULL);
+    pthread_join(update_thread, NULL);
+
+    // updates and their undo hit their own records wherever those went
+    for(int64_t key = 0; key < MOVE_KEY_N * 10; ++key) {
+        char buf[150]; uint16_t val_size;
+        EXPECT_EQ(db_find(move_table_id, key, buf, &val_size), 0)
+            << "key " << key << " has not been found.\n";
+        EXPECT_EQ(std::string(buf, val_size), std::string(80, key % 10 == 0 ? 'b' : 'a'))
+            << "key " << key << " has a wrong value.\n";
+    }
+
+    shutdown_db();
+}
+
 // #define WRR_N 500
 
 // void* thread_deadlock_gen(void* argv) {